@@ -20,6 +20,26 @@ int main() {
 	cout << "insert complete" << endl;
 	test.printTree();
 	test.close();
+
+	// 64-bit keys, too large for an int
+	BTreeIndexT<Int64Key> test64;
+	test64.open("testIndex64.ind", 'w');
+	for (long long k = 0; k < 500; k++) {
+		test64.insert(k * 10000000000LL, rid);
+	}
+	cout << "insert complete" << endl;
+	test64.printTree();
+	test64.close();
+
+	// composite keys, ordered by the first part, then by the second
+	BTreeIndexT<PairKey<IntKey, IntKey> > testPair;
+	testPair.open("testIndexPair.ind", 'w');
+	for (int k = 0; k < 500; k++) {
+		testPair.insert(KeyPair<IntKey, IntKey>::make(k % 7, k), rid);
+	}
+	cout << "insert complete" << endl;
+	testPair.printTree();
+	testPair.close();
 	/*
 	BTLeafNode* test = new BTLeafNode();
 	RecordId rid1 = {5, 9};
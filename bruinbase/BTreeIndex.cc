@@ -7,6 +7,8 @@
  * @date 3/24/2008
  */
 
+#include <climits>
+#include <algorithm>
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
 
@@ -17,15 +19,30 @@ using namespace std;
  * BTreeIndex metadata format:
  * ===========================
  *
- * -----------------------------------------
- * |  rootPid  |  treeHeight  |         |  |
- * -----------------------------------------
- *    4Bytes       4Bytes
+ * ----------------------------------------------------------------------
+ * |  rootPid  |  treeHeight  |  magic  |  version  |  pageSize  | counted |
+ * ----------------------------------------------------------------------
+ *    4Bytes       4Bytes       4Bytes     4Bytes      4Bytes      4Bytes
+ *
+ * ----------------------------------
+ * |  keyType  |  minKey  |  maxKey  |
+ * ----------------------------------
+ *    4Bytes     sizeof(Key) each
+ *
+ * An index written before the node pages had a header has no magic
+ * number. open() refuses such an index, and an index written with
+ * another page size.
+ * counted is 1 if the nonleaf nodes keep subtree counts, 0 otherwise.
+ * keyType is the TYPE_ID of the key-traits policy, so an index is not
+ * opened with another key type than the one it was built with.
+ * minKey and maxKey are the smallest and the largest key in the index,
+ * for the query planner.
  *
  **********************************************************
  */
 
-int BTreeIndex::fetch_new_page()
+template <class Traits>
+int BTreeIndexT<Traits>::fetch_new_page()
 {
 	PageId pid = pf.endPid();
 
@@ -36,35 +53,51 @@ int BTreeIndex::fetch_new_page()
 }
 
 
-int BTreeIndex::read_metadata()
+template <class Traits>
+int BTreeIndexT<Traits>::read_metadata()
 {
 	int *ptr = (int *) buffer;
 
-	if (!pf.read(BTINDEX_MD_PID, buffer)) {
-		rootPid = *ptr;
-		treeHeight = *(ptr + 1);
-		return 0;
-	} else {
+	if (pf.read(BTINDEX_MD_PID, buffer)) {
+		return -1;
+	}
+	if (*(ptr + 2) != BTINDEX_MAGIC || *(ptr + 3) != BTINDEX_VERSION ||
+	    *(ptr + 4) != PageFile::PAGE_SIZE || *(ptr + 6) != Traits::TYPE_ID) {
 		return -1;
 	}
+	rootPid = *ptr;
+	treeHeight = *(ptr + 1);
+	counted = (*(ptr + 5) != 0);
+	memcpy(&minKey, ptr + 7, sizeof(Key));
+	memcpy(&maxKey, (char*) (ptr + 7) + sizeof(Key), sizeof(Key));
+	return 0;
 }
 
-int BTreeIndex::commit_metadata()
+template <class Traits>
+int BTreeIndexT<Traits>::commit_metadata()
 {
 	int *ptr = (int *) buffer;
 
 	*ptr = rootPid;
 	*(ptr + 1) = treeHeight;
+	*(ptr + 2) = BTINDEX_MAGIC;
+	*(ptr + 3) = BTINDEX_VERSION;
+	*(ptr + 4) = PageFile::PAGE_SIZE;
+	*(ptr + 5) = counted;
+	*(ptr + 6) = Traits::TYPE_ID;
+	memcpy(ptr + 7, &minKey, sizeof(Key));
+	memcpy((char*) (ptr + 7) + sizeof(Key), &maxKey, sizeof(Key));
 
 	return pf.write(BTINDEX_MD_PID, buffer);
 }
 
-void BTreeIndex::printTree() {
+template <class Traits>
+void BTreeIndexT<Traits>::printTree() {
 	queue<PageId> bfs;
 	bfs.push(rootPid);
 	bfs.push(-1);
-	BTNonLeafNode currNonLeafNode;
-	BTLeafNode currLeafNode;
+	NonLeafNode currNonLeafNode;
+	LeafNode currLeafNode;
 	int currHeight = 1;
 	PageId currPid = -1;
 	while(!bfs.empty()) {
@@ -97,10 +130,16 @@ void BTreeIndex::printTree() {
 /*
  * BTreeIndex constructor
  */
-BTreeIndex::BTreeIndex()
+template <class Traits>
+BTreeIndexT<Traits>::BTreeIndexT()
 {
     rootPid = -1;
     treeHeight = 0;
+    counted = false;
+    minKey = Traits::maxKey();
+    maxKey = Traits::minKey();
+    readAheadPid = -1;
+    readAheadEndKey = Traits::maxKey();
 }
 
 /*
@@ -110,7 +149,8 @@ BTreeIndex::BTreeIndex()
  * @param mode[IN] 'r' for read, 'w' for write
  * @return error code. 0 if no error
  */
-RC BTreeIndex::open(const string& indexname, char mode)
+template <class Traits>
+RC BTreeIndexT<Traits>::open(const string& indexname, char mode)
 {
 	RC ret;
 
@@ -121,8 +161,12 @@ RC BTreeIndex::open(const string& indexname, char mode)
 	if (pf.endPid() == 0) {
 		rootPid = -1;
 		treeHeight = 0;
-	} else {
-		read_metadata();
+		counted = false;
+		minKey = Traits::maxKey();
+		maxKey = Traits::minKey();
+	} else if (read_metadata()) {
+		pf.close();
+		return RC_INVALID_FILE_FORMAT;
 	}
 	return 0;
 }
@@ -131,35 +175,51 @@ RC BTreeIndex::open(const string& indexname, char mode)
  * Close the index file.
  * @return error code. 0 if no error
  */
-RC BTreeIndex::close()
+template <class Traits>
+RC BTreeIndexT<Traits>::close()
 {
 	return pf.close();
 }
 
+/*
+ * Insert (key, rid) under the node pid at depth. When the node splits,
+ * return RC_NODE_FULL with the first key, the pid and the entry count of
+ * the new sibling in splitkey, splitpid and splitcount.
+ */
+template <class Traits>
 RC
-BTreeIndex::_insert(int pid, int depth, int key, const RecordId& rid,
-		    int &splitkey, int &splitpid)
+BTreeIndexT<Traits>::_insert(int pid, int depth, const Key& key, const RecordId& rid,
+			     Key &splitkey, int &splitpid, int &splitcount)
 {
 	RC ret;
 
 	// Leaf nodes
 	if (depth == treeHeight) {
-		BTLeafNode node;
+		LeafNode node;
 		node.read(pid, pf);
-		ret = node.insert(key, rid);
+		ret = node.insert(key, rid, pf);
 		if (ret == RC_NODE_FULL) {
-			BTLeafNode sibling;
+			LeafNode sibling;
+			PageId next = node.getNextNodePtr();
 
 			splitpid = fetch_new_page();
-			node.insertAndSplit(key, rid, sibling, splitkey);
+			node.insertAndSplit(key, rid, sibling, splitkey, pf);
+			splitcount = sibling.getEntryCount();
+			sibling.setPrevNodePtr(pid);
 			sibling.write(splitpid, pf);
 			node.setNextNodePtr(splitpid);
+			if (next >= 0) {
+				LeafNode nextNode;
+				nextNode.read(next, pf);
+				nextNode.setPrevNodePtr(splitpid);
+				nextNode.write(next, pf);
+			}
 		}
 		node.write(pid, pf);
 	} else {
 	// NonLeaf nodes
 		PageId n_pid;
-		BTNonLeafNode node;
+		NonLeafNode node;
 		node.read(pid, pf);
 		ret = node.locateChildPtr(key, n_pid);
 		if (ret) {
@@ -167,20 +227,36 @@ BTreeIndex::_insert(int pid, int depth, int key, const RecordId& rid,
 		}
 
 		ret = this->_insert(n_pid, depth + 1, key,
-				    rid, splitkey, splitpid);
+				    rid, splitkey, splitpid, splitcount);
 		if (ret == SUCCESS) {
-			// Do nothing
+			// only the count of the child changes
+			if (counted) {
+				node.countInsert(key);
+				node.write(pid, pf);
+			}
 		} else if (ret == RC_NODE_FULL) {
-			ret = node.insert(splitkey, splitpid);
+			node.countInsert(key);
+			ret = node.insert(splitkey, splitpid, splitcount);
 			if (ret == RC_NODE_FULL) {
 				PageId new_pid = fetch_new_page();
-				BTNonLeafNode sibling;
-				int midkey;
-				node.insertAndSplit(splitkey, splitpid,
-						    sibling, midkey);
+				PageId next = node.getNextNodePtr();
+				NonLeafNode sibling;
+				Key midkey;
+				node.insertAndSplit(splitkey, splitpid, sibling,
+						    midkey, splitcount);
 				splitkey = midkey;
 				splitpid = new_pid;
+				splitcount = counted ? sibling.getEntryCount() : 0;
+				sibling.setNextNodePtr(next);
+				sibling.setPrevNodePtr(pid);
 				sibling.write(new_pid, pf);
+				node.setNextNodePtr(new_pid);
+				if (next >= 0) {
+					NonLeafNode nextNode;
+					nextNode.read(next, pf);
+					nextNode.setPrevNodePtr(new_pid);
+					nextNode.write(next, pf);
+				}
 			}
 			node.write(pid, pf);
 		}
@@ -194,26 +270,42 @@ BTreeIndex::_insert(int pid, int depth, int key, const RecordId& rid,
  * @param rid[IN] the RecordId for the record being inserted into the index
  * @return error code. 0 if no error
  */
-RC BTreeIndex::insert(int key, const RecordId& rid)
+template <class Traits>
+RC BTreeIndexT<Traits>::insert(const Key& key, const RecordId& rid)
 {
 	RC ret;
-	int splitkey = -1, splitpid = -1;
+	Key splitkey = Traits::minKey();
+	int splitpid = -1, splitcount = 0;
 
 	if (treeHeight == 0) {
+		LeafNode root;
+
 		treeHeight = 1;
 		fetch_new_page();
 		rootPid = fetch_new_page();
+		root.write(rootPid, pf);
+		minKey = maxKey = key;
+		commit_metadata();
+	} else if (Traits::less(key, minKey) || Traits::less(maxKey, key)) {
+		if (Traits::less(key, minKey)) {
+			minKey = key;
+		} else {
+			maxKey = key;
+		}
 		commit_metadata();
 	}
 
-	ret = this->_insert(rootPid, 1, key, rid, splitkey, splitpid);
+	ret = this->_insert(rootPid, 1, key, rid, splitkey, splitpid, splitcount);
 	// check if there was a split, we should create new node
 	// and initialize it as root, and also update rootPid
 	if (ret == RC_NODE_FULL) {
 		PageId new_pid = fetch_new_page();
-		BTNonLeafNode root_node;
+		NonLeafNode root_node(counted);
+		int count = counted ? entryCount(rootPid, 1) : 0;
 
-		root_node.initializeRoot(rootPid, splitkey, splitpid);
+		root_node.initializeRoot(rootPid, splitkey, splitpid,
+					 count, splitcount);
+		root_node.setLevel(treeHeight);
 		rootPid = new_pid;
 		root_node.write(new_pid, pf);
 		treeHeight++;
@@ -224,22 +316,307 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
 }
 
 
-RC BTreeIndex::_locate(PageId pid, int depth, int searchKey,
-		       IndexCursor& cursor)
+// orders index entries by key, and entries with the same key by rid
+template <class Traits>
+static bool entryLess(const IndexEntryT<Traits>& e1, const IndexEntryT<Traits>& e2)
+{
+	return Traits::less(e1.key, e2.key) ||
+	       (!Traits::less(e2.key, e1.key) && e1.rid < e2.rid);
+}
+
+/*
+ * Build an empty index bottom-up from (key, RecordId) pairs.
+ * @param entries[IN/OUT] the pairs to load. sorted on return
+ * @param fillFactor[IN] the fraction of each node to fill, in (0, 1]
+ * @return error code. 0 if no error.
+ */
+template <class Traits>
+RC BTreeIndexT<Traits>::bulkLoad(vector<Entry>& entries, double fillFactor)
+{
+	vector<Key>    keys;    // the smallest key under each node of a level
+	vector<PageId> pids;    // the nodes of a level
+	vector<int>    counts;  // the # of entries under each node of a level
+	vector<int>    starts;  // the first entry of each key
+	vector<PageId> postings; // the posting list of each key. -1 if none
+	vector<int>    sizes;   // the bytes each key takes in a leaf node
+	vector<RecordId> rids;
+	int n = entries.size();
+	int perNode, nodeCount, keyCount, leafCount, used;
+	long long total, done;
+	PageId first;
+	RC ret;
+
+	if (treeHeight != 0 || fillFactor <= 0 || fillFactor > 1) {
+		return RC_INVALID_ATTRIBUTE;
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	for (int i = 1; i < n; i++) {
+		if (entryLess<Traits>(entries[i], entries[i - 1])) {
+			sort(entries.begin(), entries.end(), entryLess<Traits>);
+			break;
+		}
+	}
+
+	// the metadata page comes first. it is written at the end
+	fetch_new_page();
+
+	// the rids of a key with too many of them for a leaf node go to
+	// posting pages, ahead of the leaves
+	total = 0;
+	for (int i = 0, j; i < n; i = j) {
+		PageId posting = -1;
+		int size;
+
+		rids.clear();
+		for (j = i; j < n && !Traits::less(entries[i].key, entries[j].key); j++) {
+			rids.push_back(entries[j].rid);
+		}
+		size = LeafNode::entrySize(&rids[0], j - i);
+		if (size > LeafNode::ENTRY_SIZE + LeafNode::MAX_INLINE_SIZE) {
+			if ((ret = BTPostingList::write(pf, &rids[0], j - i, posting))) {
+				return ret;
+			}
+			size = LeafNode::ENTRY_SIZE;
+		}
+		starts.push_back(i);
+		postings.push_back(posting);
+		sizes.push_back(size);
+		total += size;
+	}
+	starts.push_back(n);
+	keyCount = postings.size();
+
+	// the leaf level. the keys are spread evenly, by their bytes, over
+	// the fewest leaves that hold them at the fill factor, and the leaves
+	// take consecutive pages in key order. a key starts a new leaf when
+	// it would end past the share of the leaf
+	perNode = max(1, (int) (fillFactor * LeafNode::MAX_LEAF_KEY_COUNT)) *
+		  LeafNode::ENTRY_SIZE;
+	nodeCount = (total + perNode - 1) / perNode;
+	first = pf.endPid();
+	leafCount = 0;
+	done = 0;
+	for (int k = 0; k < keyCount; leafCount++) {
+		LeafNode leaf;
+		int begin = starts[k];
+
+		used = 0;
+		do {
+			int count = starts[k + 1] - starts[k];
+
+			rids.clear();
+			if (postings[k] < 0) {
+				for (int j = starts[k]; j < starts[k + 1]; j++) {
+					rids.push_back(entries[j].rid);
+				}
+			}
+			if ((ret = leaf.append(entries[starts[k]].key, rids.empty() ? NULL : &rids[0],
+					       count, postings[k]))) {
+				return ret;
+			}
+			done += sizes[k];
+			used += sizes[k];
+			k++;
+		} while (k < keyCount &&
+			 (done + sizes[k]) * nodeCount <= (leafCount + 1) * total &&
+			 used + sizes[k] <= LeafNode::CAPACITY);
+
+		if (leafCount > 0) {
+			leaf.setPrevNodePtr(first + leafCount - 1);
+		}
+		if (k < keyCount) {
+			leaf.setNextNodePtr(first + leafCount + 1);
+		}
+		if ((ret = leaf.write(first + leafCount, pf))) {
+			return ret;
+		}
+		// the key between two leaves is only as long as it takes to
+		// tell them apart
+		keys.push_back(leafCount == 0 ? entries[begin].key :
+			       Traits::separator(entries[begin - 1].key, entries[begin].key));
+		pids.push_back(first + leafCount);
+		counts.push_back(leaf.getEntryCount());
+	}
+	treeHeight = 1;
+
+	// build each nonleaf level on the one below until one node is left.
+	// every node gets at least two children
+	perNode = counted ? NonLeafNode::MAX_COUNTED_KEY_COUNT
+			  : NonLeafNode::MAX_NONLEAF_KEY_COUNT;
+	perNode = max(2, (int) (fillFactor * (perNode + 1)));
+	while (pids.size() > 1) {
+		vector<Key>    upperKeys;
+		vector<PageId> upperPids;
+		vector<int>    upperCounts;
+
+		n = pids.size();
+		nodeCount = min((n + perNode - 1) / perNode, n / 2);
+		first = pf.endPid();
+		for (int i = 0; i < nodeCount; i++) {
+			NonLeafNode node(counted);
+			int begin = (long long) i * n / nodeCount;
+			int end = (long long) (i + 1) * n / nodeCount;
+			int count = counts[begin] + counts[begin + 1];
+
+			node.setLevel(treeHeight);
+			node.initializeRoot(pids[begin], keys[begin + 1], pids[begin + 1],
+					    counts[begin], counts[begin + 1]);
+			for (int j = begin + 2; j < end; j++) {
+				node.append(keys[j], pids[j], counts[j]);
+				count += counts[j];
+			}
+			if (i > 0) {
+				node.setPrevNodePtr(first + i - 1);
+			}
+			if (i < nodeCount - 1) {
+				node.setNextNodePtr(first + i + 1);
+			}
+			if ((ret = node.write(first + i, pf))) {
+				return ret;
+			}
+			upperKeys.push_back(keys[begin]);
+			upperPids.push_back(first + i);
+			upperCounts.push_back(count);
+		}
+		keys.swap(upperKeys);
+		pids.swap(upperPids);
+		counts.swap(upperCounts);
+		treeHeight++;
+	}
+
+	rootPid = pids[0];
+	minKey = entries.front().key;
+	maxKey = entries.back().key;
+	return commit_metadata();
+}
+
+/*
+ * Return the smallest and the largest key in the index.
+ * @param minKey[OUT] the smallest key
+ * @param maxKey[OUT] the largest key
+ * @return error code. 0 if no error.
+ */
+template <class Traits>
+RC BTreeIndexT<Traits>::getKeyRange(Key& minKey, Key& maxKey) const
+{
+	if (treeHeight == 0) {
+		return RC_NO_SUCH_RECORD;
+	}
+	minKey = this->minKey;
+	maxKey = this->maxKey;
+	return 0;
+}
+
+/*
+ * Make an empty index a counted one, or not.
+ * @param counted[IN] true for a counted index
+ * @return error code. 0 if no error.
+ */
+template <class Traits>
+RC BTreeIndexT<Traits>::setCounted(bool counted)
+{
+	if (treeHeight != 0) {
+		return RC_INVALID_ATTRIBUTE;
+	}
+	this->counted = counted;
+	return 0;
+}
+
+/*
+ * Return the # of index entries under the node pid at depth.
+ */
+template <class Traits>
+int BTreeIndexT<Traits>::entryCount(PageId pid, int depth)
+{
+	if (depth == treeHeight) {
+		LeafNode leaf;
+		return leaf.read(pid, pf) ? 0 : leaf.getEntryCount();
+	}
+
+	NonLeafNode node;
+	return node.read(pid, pf) ? 0 : node.getEntryCount();
+}
+
+/*
+ * Count the entries with keys smaller than key (not larger than key if
+ * inclusive), adding up the counts in front of the path to the leaf node.
+ */
+template <class Traits>
+RC BTreeIndexT<Traits>::_rank(const Key& key, bool inclusive, int& count)
+{
+	PageId pid = rootPid;
+	NonLeafNode node;
+	LeafNode leaf;
+	int n;
+	RC ret;
+
+	count = 0;
+	for (int depth = 1; depth < treeHeight; depth++) {
+		if ((ret = node.read(pid, pf)) ||
+		    (ret = node.locateChildRank(key, inclusive, pid, n))) {
+			return ret;
+		}
+		count += n;
+	}
+	if ((ret = leaf.read(pid, pf)) ||
+	    (ret = leaf.locateRank(key, inclusive, n))) {
+		return ret;
+	}
+	count += n;
+	return 0;
+}
+
+/*
+ * Count the entries whose keys are between lowKey and highKey (inclusive).
+ * @param lowKey[IN] the smallest key to count
+ * @param highKey[IN] the largest key to count
+ * @param count[OUT] the # of entries in the range
+ * @return error code. 0 if no error.
+ */
+template <class Traits>
+RC BTreeIndexT<Traits>::countRange(const Key& lowKey, const Key& highKey, int& count)
+{
+	int below;
+	RC ret;
+
+	count = 0;
+	if (!counted) {
+		return RC_INVALID_ATTRIBUTE;
+	}
+	if (treeHeight == 0 || Traits::less(highKey, lowKey)) {
+		return 0;
+	}
+
+	if ((ret = _rank(highKey, true, count)) ||
+	    (ret = _rank(lowKey, false, below))) {
+		return ret;
+	}
+	count -= below;
+	return 0;
+}
+
+template <class Traits>
+RC BTreeIndexT<Traits>::_locate(PageId pid, int depth, const Key& searchKey,
+				IndexCursor& cursor)
 {
 	RC ret;
 
 	if (depth == treeHeight) {
-		BTLeafNode node;
+		LeafNode node;
 		node.read(pid, pf);
 		ret = node.locate(searchKey, cursor.eid);
 		if (ret == SUCCESS) {
 			cursor.pid = pid;
+			cursor.postingPid = -1;
+			cursor.pos = 0;
 		}
 		return ret;
 	} else {
 		int new_pid;
-		BTNonLeafNode node;
+		NonLeafNode node;
 
 		node.read(pid, pf);
 		if ((ret = node.locateChildPtr(searchKey, new_pid))) {
@@ -270,12 +647,14 @@ RC BTreeIndex::_locate(PageId pid, int depth, int searchKey,
  * @return error code. 0 if no error.
  *    RC_NO_SUCH_RECORD - when there are no entries
  */
-RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
+template <class Traits>
+RC BTreeIndexT<Traits>::locate(const Key& searchKey, IndexCursor& cursor)
 {
 	if (treeHeight == 0) {
 		return RC_NO_SUCH_RECORD;
 	}
 
+	readAheadPid = -1;
 	return _locate(rootPid, 1 /* depth */,
 		       searchKey, cursor);
 }
@@ -288,24 +667,143 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
  * @param rid[OUT] the RecordId stored at the index cursor location.
  * @return error code. 0 if no error
  */
-RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
+template <class Traits>
+RC BTreeIndexT<Traits>::readForward(IndexCursor& cursor, Key& key, RecordId& rid)
 {
-	PageId currPid = cursor.pid;
-	int currEid = cursor.eid;
-	BTLeafNode currLeaf;
-
-	// Reading in the page from the cursor
-	currLeaf.read(currPid, pf);
-	currLeaf.readEntry(currEid, key, rid);
-	int keyCount = currLeaf.getKeyCount();
-
-	// Check to see if we have reached the end of valid (key, rid) pairs
-	if (currEid < keyCount - 1) {
-		cursor.eid++;
-	} else {
+	Entry entry;
+	int count;
+	RC ret;
+
+	// a scan up to the end of the tree, a pair at a time
+	if ((ret = readBatch(cursor, Traits::maxKey(), &entry, 1, count))) {
+		return ret;
+	}
+	key = entry.key;
+	rid = entry.rid;
+	return 0;
+}
+
+/*
+ * Read the (key, rid) pairs from the location specified by the index
+ * cursor on, up to the last pair whose key is not larger than endKey,
+ * and move the cursor past them.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param endKey[IN] the largest key to read
+ * @param entries[OUT] the (key, rid) pairs read, in key and rid order
+ * @param maxCount[IN] the capacity of entries
+ * @param count[OUT] the number of pairs read
+ * @return error code. 0 if no error
+ */
+template <class Traits>
+RC BTreeIndexT<Traits>::readBatch(IndexCursor& cursor, const Key& endKey,
+				  Entry* entries, int maxCount, int& count)
+{
+	LeafNode currLeaf;
+	int keyCount, n;
+	RC ret;
+
+	count = 0;
+	for (;;) {
+		if (cursor.pid < 0) {
+			return RC_END_OF_TREE;
+		}
+		if ((ret = currLeaf.read(cursor.pid, pf))) {
+			return ret;
+		}
+		keyCount = currLeaf.getKeyCount();
+		if (cursor.eid < keyCount) {
+			break;
+		}
+		cursor.pid = currLeaf.getNextNodePtr();
+		cursor.eid = 0;
+	}
+
+	// the rids of a key may take several calls. the cursor keeps the
+	// rid to go on from
+	while (count < maxCount && cursor.eid < keyCount) {
+		if (Traits::less(endKey, currLeaf.getKey(cursor.eid))) {
+			// the next key is larger than endKey. the scan is over
+			cursor.pid = -1;
+			break;
+		}
+		if ((ret = currLeaf.readEntries(cursor.eid, cursor.postingPid, cursor.pos,
+						entries + count, maxCount - count, n, pf))) {
+			return ret;
+		}
+		count += n;
+		if (cursor.pos < 0) {
+			cursor.eid++;
+			cursor.postingPid = -1;
+			cursor.pos = 0;
+		}
+	}
+
+	if (cursor.pid >= 0 && cursor.eid == keyCount) {
 		cursor.eid = 0;
 		cursor.pid = currLeaf.getNextNodePtr();
+
+		// entering the last leaf read ahead so far (or the first leaf
+		// after locate()), read the next ones ahead
+		if (cursor.pid >= 0 && count > 0 &&
+		    (readAheadPid < 0 || cursor.pid == readAheadPid)) {
+			readAhead(entries[count - 1].key);
+		}
 	}
 
-    return 0;
+	return count > 0 ? 0 : RC_END_OF_TREE;
+}
+
+template <class Traits>
+void BTreeIndexT<Traits>::setReadAheadLimit(const Key& endKey)
+{
+	readAheadEndKey = endKey;
 }
+
+/*
+ * Start reading the leaf nodes that follow the leaf node holding key
+ * in the background. The parent node of the leaf gives their page ids,
+ * so the read-ahead stops at the last child of the parent.
+ * @param key[IN] a key in the leaf node the scan is leaving
+ */
+template <class Traits>
+void BTreeIndexT<Traits>::readAhead(const Key& key)
+{
+	PageId pids[READ_AHEAD_COUNT + 2];
+	PageId pid = rootPid;
+	NonLeafNode node;
+	int count;
+
+	readAheadPid = -1;
+	if (treeHeight < 2) {
+		return;
+	}
+
+	// walk down to the parent of the leaf node holding key
+	for (int depth = 1; depth < treeHeight - 1; depth++) {
+		if (node.read(pid, pf) || node.locateChildPtr(key, pid)) {
+			return;
+		}
+	}
+	if (node.read(pid, pf) ||
+	    node.locateChildPtrs(key, readAheadEndKey, pids,
+				 READ_AHEAD_COUNT + 2, count)) {
+		return;
+	}
+
+	// pids[0] is the leaf node holding key, pids[1] the one the scan
+	// is entering, and the rest are read ahead
+	for (int i = 1; i < count; i++) {
+		pf.prefetch(pids[i]);
+	}
+	if (count > 2) {
+		readAheadPid = pids[count - 1];
+	}
+}
+
+// the key types the B+tree is built for (see KeyTraits.h)
+template class BTreeIndexT<IntKey>;
+template class BTreeIndexT<Int64Key>;
+template class BTreeIndexT<FixedStringKey<16> >;
+template class BTreeIndexT<FixedStringKey<32> >;
+template class BTreeIndexT<PairKey<IntKey, IntKey> >;
+template class BTreeIndexT<PairKey<IntKey, FixedStringKey<16> > >;
@@ -13,14 +13,21 @@
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeNode.h"
 #include <queue>
+#include <vector>
 #include <iostream>
 
 #define BTINDEX_MD_PID 0
+#define BTINDEX_MAGIC 0x58495442  // "BTIX"
+#define BTINDEX_VERSION 7  // the index format. bumped with BTNODE_VERSION too
+
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
  * An IndexCursor consists of pid (PageId of the leaf node) and
- * eid (the location of the index entry inside the node).
+ * eid (the location of the index entry inside the node), and the rid
+ * of the entry to read next (postingPid and pos, see
+ * BTLeafNodeT::readEntries()).
  * IndexCursor is used for index lookup and traversal.
  */
 typedef struct {
@@ -28,22 +35,38 @@ typedef struct {
   PageId  pid;
   // The entry number inside the node
   int     eid;
+  // The posting page of the rid to read next. -1 if none
+  PageId  postingPid;
+  // The rid to read next among the rids of the entry
+  int     pos;
 } IndexCursor;
 
 /**
- * Implements a B-Tree index for bruinbase.
- *
+ * Implements a B-Tree index for bruinbase, on the keys of the key-traits
+ * policy Traits (see KeyTraits.h). The index of the key column of a table
+ * is a BTreeIndex, the instance on int keys. Int64Key and FixedStringKey
+ * instances index 64-bit identifiers and short strings without hashing
+ * them down to an int, and PairKey instances index composite keys.
  */
-class BTreeIndex {
+template <class Traits>
+class BTreeIndexT {
  public:
-  BTreeIndex();
+  typedef typename Traits::Key    Key;
+  typedef IndexEntryT<Traits>     Entry;
+  typedef BTLeafNodeT<Traits>     LeafNode;
+  typedef BTNonLeafNodeT<Traits>  NonLeafNode;
+
+  BTreeIndexT();
 
   /**
    * Open the index file in read or write mode.
    * Under 'w' mode, the index file should be created if it does not exist.
    * @param indexname[IN] the name of the index file
    * @param mode[IN] 'r' for read, 'w' for write
-   * @return error code. 0 if no error
+   * @return error code. 0 if no error.
+   *    RC_INVALID_FILE_FORMAT - when the index was written in an older
+   *    page format, with another page size or on another key type.
+   *    such an index has to be dropped and rebuilt
    */
   RC open(const std::string& indexname, char mode);
 
@@ -55,11 +78,72 @@ class BTreeIndex {
 
   /**
    * Insert (key, RecordId) pair to the index.
+   * The rids of a key are kept together in its leaf node, or in posting
+   * pages for a key with many of them (see BTLeafNodeT).
    * @param key[IN] the key for the value inserted into the index
    * @param rid[IN] the RecordId for the record being inserted into the index
    * @return error code. 0 if no error
    */
-  RC insert(int key, const RecordId& rid);
+  RC insert(const Key& key, const RecordId& rid);
+
+  /**
+   * Build an empty index bottom-up from (key, RecordId) pairs.
+   * The pairs are sorted by key first unless they are sorted already.
+   * The leaf nodes are filled to fillFactor of their capacity in key
+   * order, after the posting pages of the keys with too many rids to keep
+   * in a leaf node, and every nonleaf level is built on top of the level below it,
+   * so each node is written exactly once, in the order of page id.
+   * A nonleaf node takes the separators of Traits::separator() for the
+   * children after its first.
+   * @param entries[IN/OUT] the pairs to load. sorted on return
+   * @param fillFactor[IN] the fraction of each node to fill, in (0, 1]
+   * @return error code. 0 if no error.
+   *    RC_INVALID_ATTRIBUTE - when the index is not empty
+   */
+  RC bulkLoad(std::vector<Entry>& entries, double fillFactor);
+
+  /**
+   * Make an empty index a counted one, or not. The nonleaf nodes of a
+   * counted index keep the number of entries under each child, so that
+   * countRange() works, at the cost of fewer keys per nonleaf node.
+   * @param counted[IN] true for a counted index
+   * @return error code. 0 if no error.
+   *    RC_INVALID_ATTRIBUTE - when the index is not empty
+   */
+  RC setCounted(bool counted);
+
+  /**
+   * Return whether the index is counted (see setCounted()).
+   * @return true for a counted index
+   */
+  bool isCounted() const { return counted; }
+
+  /**
+   * Count the entries whose keys are between lowKey and highKey
+   * (inclusive), with two root-to-leaf descents of a counted index.
+   * @param lowKey[IN] the smallest key to count
+   * @param highKey[IN] the largest key to count
+   * @param count[OUT] the # of entries in the range
+   * @return error code. 0 if no error.
+   *    RC_INVALID_ATTRIBUTE - when the index is not counted
+   */
+  RC countRange(const Key& lowKey, const Key& highKey, int& count);
+
+  /**
+   * Return the height of the tree. 0 if the index is empty.
+   * @return the height of the tree
+   */
+  int getTreeHeight() const { return treeHeight; }
+
+  /**
+   * Return the smallest and the largest key in the index.
+   * They are kept in the index metadata, so no node is read.
+   * @param minKey[OUT] the smallest key
+   * @param maxKey[OUT] the largest key
+   * @return error code. 0 if no error.
+   *    RC_NO_SUCH_RECORD - when the index is empty
+   */
+  RC getKeyRange(Key& minKey, Key& maxKey) const;
 
   /**
    * Find the leaf-node index entry whose key value is larger than or
@@ -81,7 +165,7 @@ class BTreeIndex {
    * with the key value
    * @return error code. 0 if no error.
    */
-  RC locate(int searchKey, IndexCursor& cursor);
+  RC locate(const Key& searchKey, IndexCursor& cursor);
 
   /**
    * Read the (key, rid) pair at the location specified by the index cursor,
@@ -89,11 +173,44 @@ class BTreeIndex {
    * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
    * @param key[OUT] the key stored at the index cursor location
    * @param rid[OUT] the RecordId stored at the index cursor location
-   * @return error code. 0 if no error
+   * @return error code. 0 if no error.
+   *    RC_END_OF_TREE - when the cursor is past the last entry of the tree
    */
-  RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+  RC readForward(IndexCursor& cursor, Key& key, RecordId& rid);
+
+  /**
+   * Read the (key, rid) pairs from the location specified by the index
+   * cursor on, up to the last pair whose key is not larger than endKey,
+   * and move the cursor past them. A call reads from one leaf node only,
+   * so the pairs of a leaf node are returned with one page access, plus
+   * the posting pages of its keys with many rids. The pairs of a key come
+   * in rid order, and a long posting list is streamed over several calls.
+   * The cursor moves to the next leaf node once its leaf node is used up,
+   * and becomes invalid (pid -1) once a key larger than endKey is found.
+   * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+   * @param endKey[IN] the largest key to read
+   * @param entries[OUT] the (key, rid) pairs read, in key and rid order
+   * @param maxCount[IN] the capacity of entries
+   * @param count[OUT] the number of pairs read. at least one if no error
+   * @return error code. 0 if no error.
+   *    RC_END_OF_TREE - when no pair is left up to endKey
+   */
+  RC readBatch(IndexCursor& cursor, const Key& endKey, Entry* entries,
+               int maxCount, int& count);
+
+  /**
+   * Limit the read-ahead of readForward() to the leaf nodes that may hold
+   * keys up to endKey. When readForward() moves to the next leaf node,
+   * it starts reading the following READ_AHEAD_COUNT leaf nodes in the
+   * background (see PageFile::prefetch()). By default, it reads ahead up
+   * to the end of the tree.
+   * @param endKey[IN] the largest key the scan is interested in
+   */
+  void setReadAheadLimit(const Key& endKey);
   void printTree();
 
+  static const int READ_AHEAD_COUNT = 8;  /// # of leaf nodes to read ahead
+
  private:
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
   char buffer[PageFile::PAGE_SIZE];
@@ -103,14 +220,27 @@ class BTreeIndex {
   /// this class is destructed. Make sure to store the values of the two
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
+  /// The same holds for the three below, which are stored along with them
+  /// in the index metadata.
+  bool     counted;    /// true if the nonleaf nodes keep subtree counts
+  Key      minKey;     /// the smallest key in the index
+  Key      maxKey;     /// the largest key in the index
+  /// The read-ahead state of a scan is not stored.
+  PageId   readAheadPid;    /// the last leaf node read ahead. -1 if none
+  Key      readAheadEndKey; /// the largest key worth reading ahead
 
   int read_metadata();
   int commit_metadata();
   int fetch_new_page();
-  RC _insert(int pid, int depth, int key, const RecordId& rid,
-	     int &splitkey, int &splitpid);
-  RC _locate(PageId pid, int depth, int searchKey,
+  RC _insert(int pid, int depth, const Key& key, const RecordId& rid,
+	     Key &splitkey, int &splitpid, int &splitcount);
+  RC _rank(const Key& key, bool inclusive, int& count);
+  int entryCount(PageId pid, int depth);
+  RC _locate(PageId pid, int depth, const Key& searchKey,
 	     IndexCursor& cursor);
+  void readAhead(const Key& key);
 };
 
+typedef BTreeIndexT<IntKey> BTreeIndex;
+
 #endif /* BTREEINDEX_H */
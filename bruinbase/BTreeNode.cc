@@ -1,222 +1,506 @@
 #include "BTreeNode.h"
 #include <stdio.h>
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 
-BTLeafNode::BTLeafNode() {
-	memset(this->buffer, 0xff, PageFile::PAGE_SIZE);
+/*
+ * Initialize the header of an empty node of the given level.
+ */
+static void initHeader(BTNodeHeader* header, int level)
+{
+	header->version = BTNODE_VERSION;
+	header->level = level;
+	header->flags = 0;
+	header->keyCount = 0;
+	header->nextPid = -1;
+	header->prevPid = -1;
+}
+
+/*
+ * A rid as a number: its pid and sid in the high and low 32 bits, so that
+ * the rids of a table page are close to each other.
+ */
+static inline unsigned long long ridValue(const RecordId& rid)
+{
+	return ((unsigned long long) (unsigned) rid.pid << 32) | (unsigned) rid.sid;
+}
+
+static inline RecordId valueRid(unsigned long long value)
+{
+	RecordId rid = { (int) (value >> 32), (int) (value & 0xffffffffULL) };
+	return rid;
+}
+
+/*
+ * Store value in 7-bit groups, the lowest first, with the top bit set in
+ * every byte but the last. Return the # of bytes; out may be NULL.
+ */
+static inline int putVarint(unsigned long long value, char* out)
+{
+	int n = 0;
+
+	while (value >= 0x80) {
+		if (out) out[n] = (char) (value | 0x80);
+		value >>= 7;
+		n++;
+	}
+	if (out) out[n] = (char) value;
+	return n + 1;
+}
+
+static inline const char* getVarint(const char* in, unsigned long long& value)
+{
+	unsigned char c;
+	int shift = 0;
+
+	value = 0;
+	do {
+		c = *in++;
+		value |= (unsigned long long) (c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return in;
+}
+
+// the parts of a posting page
+static inline BTNodeHeader* postingHeader(char* page)
+{
+	return (BTNodeHeader*) page;
+}
+
+static inline int& postingBytes(char* page)
+{
+	return *(int*) (page + sizeof(BTNodeHeader));
+}
+
+static inline RecordId& postingLast(char* page)
+{
+	return *(RecordId*) (page + sizeof(BTNodeHeader) + sizeof(int));
+}
+
+static inline char* postingData(char* page)
+{
+	return page + BTPostingList::PAGE_HEADER;
+}
+
+/*
+ * Fill a posting page with count rids.
+ */
+static void fillPostingPage(char* page, const RecordId* rids, int count,
+			    PageId next, PageId prev)
+{
+	memset(page, 0, PageFile::PAGE_SIZE);
+	initHeader(postingHeader(page), BTPOSTING_LEVEL);
+	postingHeader(page)->keyCount = count;
+	postingHeader(page)->nextPid = next;
+	postingHeader(page)->prevPid = prev;
+	postingBytes(page) = BTPostingList::encode(rids, count, postingData(page));
+	postingLast(page) = rids[count - 1];
+}
+
+/*
+ * Read a posting page into page.
+ */
+static RC readPostingPage(const PageFile& pf, PageId pid, char* page)
+{
+	RC rc;
+
+	if ((rc = pf.read(pid, page)) < 0) {
+		return rc;
+	}
+	if (postingHeader(page)->version != BTNODE_VERSION ||
+	    postingHeader(page)->level != BTPOSTING_LEVEL) {
+		return RC_INVALID_FILE_FORMAT;
+	}
+	return 0;
+}
+
+int BTPostingList::encode(const RecordId* rids, int count, char* out)
+{
+	unsigned long long prev = 0, value;
+	int n = 0;
+
+	for (int i = 0; i < count; i++) {
+		value = ridValue(rids[i]);
+		n += putVarint(value - prev, out ? out + n : NULL);
+		prev = value;
+	}
+	return n;
+}
+
+void BTPostingList::decode(const char* in, int count, RecordId* rids)
+{
+	unsigned long long value = 0, delta;
+
+	for (int i = 0; i < count; i++) {
+		in = getVarint(in, delta);
+		value += delta;
+		rids[i] = valueRid(value);
+	}
+}
+
+RC BTPostingList::write(PageFile& pf, const RecordId* rids, int count, PageId& head)
+{
+	char page[PageFile::PAGE_SIZE];
+	vector<int> starts;
+	int bytes = 0, n, pageCount;
+	RC rc;
+
+	if (count <= 0) {
+		return RC_INVALID_ATTRIBUTE;
+	}
+
+	// fill each page as far as it goes
+	starts.push_back(0);
+	for (int i = 0; i < count; i++) {
+		n = putVarint(ridValue(rids[i]) - (i == starts.back() ? 0 : ridValue(rids[i - 1])), NULL);
+		if (bytes + n > CAPACITY) {
+			starts.push_back(i);
+			bytes = putVarint(ridValue(rids[i]), NULL);
+		} else {
+			bytes += n;
+		}
+	}
+	starts.push_back(count);
+
+	head = pf.endPid();
+	pageCount = starts.size() - 1;
+	for (int p = 0; p < pageCount; p++) {
+		fillPostingPage(page, rids + starts[p], starts[p + 1] - starts[p],
+				p + 1 < pageCount ? head + p + 1 : -1,
+				p == 0 ? head + pageCount - 1 : head + p - 1);
+		if ((rc = pf.write(head + p, page)) < 0) {
+			return rc;
+		}
+	}
+	return 0;
+}
+
+RC BTPostingList::insert(PageFile& pf, PageId head, const RecordId& rid)
+{
+	char first[PageFile::PAGE_SIZE], page[PageFile::PAGE_SIZE];
+	char next[PageFile::PAGE_SIZE];
+	RecordId rids[MAX_PAGE_RIDS + 1];
+	PageId pid, newPid;
+	int count, n, half;
+	RC rc;
+
+	if ((rc = readPostingPage(pf, head, first)) < 0) {
+		return rc;
+	}
+
+	// LOAD inserts the rids of a key in rid order, so most of them
+	// go after the last rid of the list
+	pid = postingHeader(first)->prevPid;
+	if (pid == head) {
+		memcpy(page, first, PageFile::PAGE_SIZE);
+	} else if ((rc = readPostingPage(pf, pid, page)) < 0) {
+		return rc;
+	}
+	if (!(rid < postingLast(page))) {
+		n = putVarint(ridValue(rid) - ridValue(postingLast(page)), NULL);
+		if (postingBytes(page) + n <= CAPACITY) {
+			putVarint(ridValue(rid) - ridValue(postingLast(page)),
+				  postingData(page) + postingBytes(page));
+			postingBytes(page) += n;
+			postingHeader(page)->keyCount++;
+			postingLast(page) = rid;
+			return pf.write(pid, page);
+		}
+
+		// a new last page
+		newPid = pf.endPid();
+		fillPostingPage(next, &rid, 1, -1, pid);
+		if ((rc = pf.write(newPid, next)) < 0) {
+			return rc;
+		}
+		postingHeader(page)->nextPid = newPid;
+		if (pid == head) {
+			postingHeader(page)->prevPid = newPid;
+			return pf.write(pid, page);
+		}
+		if ((rc = pf.write(pid, page)) < 0) {
+			return rc;
+		}
+		postingHeader(first)->prevPid = newPid;
+		return pf.write(head, first);
+	}
+
+	// otherwise the rid goes to the last page whose first rid is not
+	// larger than it
+	pid = head;
+	memcpy(page, first, PageFile::PAGE_SIZE);
+	while (postingHeader(page)->nextPid >= 0) {
+		if ((rc = readPostingPage(pf, postingHeader(page)->nextPid, next)) < 0) {
+			return rc;
+		}
+		decode(postingData(next), 1, rids);
+		if (rid < rids[0]) {
+			break;
+		}
+		pid = postingHeader(page)->nextPid;
+		memcpy(page, next, PageFile::PAGE_SIZE);
+	}
+
+	count = postingHeader(page)->keyCount;
+	decode(postingData(page), count, rids);
+	n = upper_bound(rids, rids + count, rid) - rids;
+	memmove(rids + n + 1, rids + n, (count - n) * sizeof(RecordId));
+	rids[n] = rid;
+	count++;
+
+	if (encode(rids, count, NULL) <= CAPACITY) {
+		fillPostingPage(page, rids, count, postingHeader(page)->nextPid,
+				postingHeader(page)->prevPid);
+		return pf.write(pid, page);
+	}
+
+	// split the page in two
+	half = count / 2;
+	newPid = pf.endPid();
+	fillPostingPage(next, rids + half, count - half, postingHeader(page)->nextPid, pid);
+	if ((rc = pf.write(newPid, next)) < 0) {
+		return rc;
+	}
+	if (postingHeader(page)->nextPid >= 0) {
+		// the page after the new one points back to it
+		char after[PageFile::PAGE_SIZE];
+		if ((rc = readPostingPage(pf, postingHeader(page)->nextPid, after)) < 0) {
+			return rc;
+		}
+		postingHeader(after)->prevPid = newPid;
+		if ((rc = pf.write(postingHeader(page)->nextPid, after)) < 0) {
+			return rc;
+		}
+	} else if (pid != head) {
+		postingHeader(first)->prevPid = newPid;
+		if ((rc = pf.write(head, first)) < 0) {
+			return rc;
+		}
+	}
+	fillPostingPage(page, rids, half, newPid,
+			pid == head && postingHeader(page)->nextPid < 0 ? newPid
+									: postingHeader(page)->prevPid);
+	return pf.write(pid, page);
+}
+
+RC BTPostingList::readPage(const PageFile& pf, PageId pid, RecordId* rids,
+			   int& count, PageId& next)
+{
+	char page[PageFile::PAGE_SIZE];
+	RC rc;
+
+	count = 0;
+	if ((rc = readPostingPage(pf, pid, page)) < 0) {
+		return rc;
+	}
+	count = postingHeader(page)->keyCount;
+	next = postingHeader(page)->nextPid;
+	decode(postingData(page), count, rids);
+	return 0;
+}
+
+/* ------------------------------------------------------------------- */
+
+template <class Traits>
+BTLeafNodeT<Traits>::BTLeafNodeT() {
+	this->buffer = this->page;
+	memset(this->buffer, 0, PageFile::PAGE_SIZE);
+	initHeader(header(), 0);
+	listStart() = LIST_END;
 }
 
 /*
  * Read the content of the node from the page pid in the PageFile pf.
+ * The page is pinned in the buffer pool and the node works on it in place.
  * @param pid[IN] the PageId to read
  * @param pf[IN] PageFile to read from
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::read(PageId pid, const PageFile& pf)
+template <class Traits>
+RC BTLeafNodeT<Traits>::read(PageId pid, const PageFile& pf)
 {
-	return pf.read(pid, this->buffer);
+	RC rc;
+
+	if ((rc = pf.fetch(pid, this->handle)) < 0) {
+		return rc;
+	}
+	this->buffer = this->handle.data();
+
+	if (header()->version != BTNODE_VERSION || header()->level != 0) {
+		this->handle.unpin();
+		this->buffer = this->page;
+		return RC_INVALID_FILE_FORMAT;
+	}
+	return 0;
 }
-    
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
  * @param pf[IN] PageFile to write to
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::write(PageId pid, PageFile& pf)
+template <class Traits>
+RC BTLeafNodeT<Traits>::write(PageId pid, PageFile& pf)
 {
 	return pf.write(pid, this->buffer);
 }
 
 /*
- * Return the number of keys stored in the node.
- * @return the number of keys in the node
+ * Insert a (key, rid) pair to the node. A key the node has already takes
+ * the rid into its rids.
+ * @param key[IN] the key to insert
+ * @param rid[IN] the RecordId to insert
+ * @param pf[IN] PageFile of the posting pages of the node
+ * @return 0 if successful. Return an error code if the node is full.
  */
-int BTLeafNode::getKeyCount()
+template <class Traits>
+RC BTLeafNodeT<Traits>::insert(const Key& key, const RecordId& rid, PageFile& pf)
 {
-	int count = 0;
-	int key;
-	RecordId rid;
-	char *tbuffer = this->buffer;
-
-	/*
-	 * Logic: We assume that the page is initialized to zero
-	 * and key value will never be 0.
-	 */
-	foreach(tbuffer, key, rid, rid.pid != -1) {
-		count++;
+	int keyCount = getKeyCount();
+	int pos = Traits::lowerBound(keys(), keyCount, key);
+	Item item;
+	int oldSize;
+	RC rc;
+
+	if (pos == keyCount || Traits::less(key, keys()[pos])) {
+		if (usedSpace() + ENTRY_SIZE > CAPACITY) {
+			return RC_NODE_FULL;
+		}
+		insertKey(pos, key);
+		refs()[pos] = rid;
+		return 0;
 	}
 
-	return count;
+	// the rids of a key in posting pages grow there, and a list in the
+	// node by rewriting it. a list that grows too long for the node moves
+	// to posting pages, which never fills the node
+	getItem(pos, item);
+	oldSize = item.list.size();
+	if ((rc = addRid(item, rid, pf)) < 0) {
+		return rc;
+	}
+	if (usedSpace() - oldSize + (int) item.list.size() > CAPACITY) {
+		return RC_NODE_FULL;
+	}
+	setItem(pos, item);
+	return 0;
 }
 
 /*
- * Insert a (key, rid) pair to the node.
- * @param key[IN] the key to insert
- * @param rid[IN] the RecordId to insert
+ * Append a key with its rids after the last entry of the node.
+ * @param key[IN] the key to append
+ * @param rids[IN] the rids of the key, sorted. not read if posting >= 0
+ * @param count[IN] the # of rids
+ * @param posting[IN] the first page of the posting list of the rids, or -1
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTLeafNode::insert(int key, const RecordId& rid)
+template <class Traits>
+RC BTLeafNodeT<Traits>::append(const Key& key, const RecordId* rids, int count,
+			       PageId posting)
 {
-	int keyCount = this->getKeyCount();
-	RecordId currRid = {0, 0};
-	int currKey = 0;
-	int ind = 0;
+	int keyCount = getKeyCount();
+	Item item;
 
-	if (keyCount == MAX_LEAF_KEY_COUNT) {
-		return RC_NODE_FULL;
-	}
-	else if (keyCount == 0) {
-		memcpy(this->buffer, &rid, BTLeafNode::RECORD_ID_SIZE);
-		memcpy(this->buffer + BTLeafNode::RECORD_ID_SIZE, &key, BTNonLeafNode::KEY_SIZE);
-		return 0;
+	if (count <= 0) {
+		return RC_INVALID_ATTRIBUTE;
 	}
-	else {
-		// assumes buffer has been initialized to 0xff
-		while(currRid.pid != -1) {
-			// Parse the rid first and increment the index
-			memcpy(&currRid, this->buffer + ind, BTLeafNode::RECORD_ID_SIZE);
-			ind += BTLeafNode::RECORD_ID_SIZE;
-
-			// Parse the key next and increment the index
-			memcpy(&currKey, this->buffer + ind, BTNonLeafNode::KEY_SIZE);
-			ind += BTNonLeafNode::KEY_SIZE;
-
-			if ((key < currKey) || (currKey == -1)) {
-				PageId nextPid = getNextNodePtr();
-				// Move the index back to be before this current key
-				ind -= (BTLeafNode::RECORD_ID_SIZE + BTNonLeafNode::KEY_SIZE);
-
-				// Move the memory block over by one rid and one key size
-				memmove(this->buffer + ind + BTLeafNode::RECORD_ID_SIZE + BTNonLeafNode::KEY_SIZE,
-					this->buffer + ind, PageFile::PAGE_SIZE - (ind + BTLeafNode::RECORD_ID_SIZE + BTNonLeafNode::KEY_SIZE));
-
-				// Copy RID and key into the buffer
-				memcpy(this->buffer + ind, &rid,
-				       BTLeafNode::RECORD_ID_SIZE);
-				ind += BTLeafNode::RECORD_ID_SIZE;
-
-				memcpy(this->buffer + ind, &key,
-				       BTNonLeafNode::KEY_SIZE);
-				ind += BTNonLeafNode::KEY_SIZE;
-				setNextNodePtr(nextPid);
-				return 0;
-			}
+	if (posting >= 0) {
+		item.ref.pid = -2 - posting;
+		item.ref.sid = count;
+	} else {
+		makeList(item, rids, count);
+		if ((int) item.list.size() > MAX_INLINE_SIZE) {
+			return RC_INVALID_ATTRIBUTE;
 		}
-		// If the end of the array has been reached
-		// append key and rid to end
-		memcpy(this->buffer + ind, &rid, BTLeafNode::RECORD_ID_SIZE);
-		ind += BTLeafNode::RECORD_ID_SIZE;
-
-		// Parse the key next and increment the index
-		memcpy(this->buffer + ind, &key, BTNonLeafNode::KEY_SIZE);
-		return 0;
 	}
-	// Should never reach this point
-	return RC_INVALID_ATTRIBUTE; 
+	if (usedSpace() + ENTRY_SIZE + (int) item.list.size() > CAPACITY) {
+		return RC_NODE_FULL;
+	}
+
+	insertKey(keyCount, key);
+	item.key = key;
+	setItem(keyCount, item);
+	return 0;
 }
 
-RC BTLeafNode::_insert(int key, const RecordId& rid)
+template <class Traits>
+int BTLeafNodeT<Traits>::entrySize(const RecordId* rids, int count)
 {
-	int keyCount = this->getKeyCount();
-	RecordId currRid = {0, 0};
-	int currKey = 0;
-	int ind = 0;
+	Item item;
 
-	if (keyCount == 0) {
-		memcpy(this->buffer, &rid, BTLeafNode::RECORD_ID_SIZE);
-		memcpy(this->buffer + BTLeafNode::RECORD_ID_SIZE, &key, BTNonLeafNode::KEY_SIZE);
-		return 0;
-	}
-	else {
-		// assumes buffer has been initialized to 0xff
-		while(currRid.pid != -1) {
-			// Parse the rid first and increment the index
-			memcpy(&currRid, this->buffer + ind, BTLeafNode::RECORD_ID_SIZE);
-			ind += BTLeafNode::RECORD_ID_SIZE;
-
-			// Parse the key next and increment the index
-			memcpy(&currKey, this->buffer + ind, BTNonLeafNode::KEY_SIZE);
-			ind += BTNonLeafNode::KEY_SIZE;
-
-			if ((key < currKey) || (currKey == -1)) {
-				// Move the index back to be before this current key
-				ind -= (BTLeafNode::RECORD_ID_SIZE + BTNonLeafNode::KEY_SIZE);
-
-				// Move the memory block over by one rid and one key size
-				memmove(this->buffer + ind + BTLeafNode::RECORD_ID_SIZE + BTNonLeafNode::KEY_SIZE,
-					this->buffer + ind, PageFile::PAGE_SIZE - (ind + BTLeafNode::RECORD_ID_SIZE + BTNonLeafNode::KEY_SIZE));
-
-				// Copy RID and key into the buffer
-				memcpy(this->buffer + ind, &rid, BTLeafNode::RECORD_ID_SIZE);
-				ind += BTLeafNode::RECORD_ID_SIZE;
-				memcpy(this->buffer + ind, &key, BTNonLeafNode::KEY_SIZE);
-				ind += BTNonLeafNode::KEY_SIZE;
-				return 0;
-			}
-		}
-		// If the end of the array has been reached
-		// append key and rid to end
-		memcpy(this->buffer + ind, &rid, BTLeafNode::RECORD_ID_SIZE);
-		ind += BTLeafNode::RECORD_ID_SIZE;
-
-		// Parse the key next and increment the index
-		memcpy(this->buffer + ind, &key, BTNonLeafNode::KEY_SIZE);
-		return 0;
-	}
-	// Should never reach this point
-	return RC_INVALID_ATTRIBUTE; 
+	makeList(item, rids, count);
+	return ENTRY_SIZE + item.list.size();
 }
 
 /*
  * Insert the (key, rid) pair to the node
- * and split the node half and half with sibling.
- * The first key of the sibling node is returned in siblingKey.
+ * and split the node half and half, by bytes, with sibling.
+ * The separator of the last key of the node and the first key of the
+ * sibling (see Traits::separator()) is returned in siblingKey. The
+ * sibling takes over the next sibling pointer of the node. The caller
+ * has to point the node (and the old next node) to the sibling.
  * @param key[IN] the key to insert.
  * @param rid[IN] the RecordId to insert.
  * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
- * @param siblingKey[OUT] the first key in the sibling node after split.
+ * @param siblingKey[OUT] the key to insert into the parent node.
+ * @param pf[IN] PageFile of the posting pages of the node
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, 
-                              BTLeafNode& sibling, int& siblingKey)
+template <class Traits>
+RC BTLeafNodeT<Traits>::insertAndSplit(const Key& key, const RecordId& rid,
+				       BTLeafNodeT& sibling, Key& siblingKey,
+				       PageFile& pf)
 {
+	vector<Item> items;
+	int keyCount = getKeyCount();
+	int pos = Traits::lowerBound(keys(), keyCount, key);
+	int total = 0, bytes = 0, half;
+	RC rc;
 
 	if (sibling.getKeyCount() != 0) {
 		return RC_INVALID_ATTRIBUTE;
 	}
 
-	sibling.setNextNodePtr(this->getNextNodePtr());
-
-	// Insert the (key, pid) pair into the node first
-	this->_insert(key, rid);
-
-	// Calculate the keyCount
-	int keyCount = this->getKeyCount();
-	int origBufferSize = keyCount * (BTLeafNode::RECORD_ID_SIZE + BTNonLeafNode::KEY_SIZE);
-	
-	// Reach the middle of the node
-	int ind = (keyCount / 2) * (BTLeafNode::RECORD_ID_SIZE + BTNonLeafNode::KEY_SIZE);
+	// Insert the (key, rid) pair into the items of the node first
+	getItems(items);
+	if (pos < keyCount && !Traits::less(key, keys()[pos])) {
+		if ((rc = addRid(items[pos], rid, pf)) < 0) {
+			return rc;
+		}
+	} else {
+		Item item;
+		item.key = key;
+		item.ref = rid;
+		items.insert(items.begin() + pos, item);
+	}
+	keyCount = items.size();
+	if (keyCount < 2) {
+		return RC_NODE_FULL;
+	}
 
-	// New start of the sibling node
-	// int newStart = ind + BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE;
+	// Move the items past the first half of the bytes to the sibling
+	for (int i = 0; i < keyCount; i++) {
+		total += ENTRY_SIZE + items[i].list.size();
+	}
+	for (half = 0; half < keyCount; half++) {
+		int size = ENTRY_SIZE + items[half].list.size();
+		if (2 * (bytes + size) > total) {
+			break;
+		}
+		bytes += size;
+	}
+	half = max(1, min(keyCount - 1, half));
 
-	// Copy the midKey and copy contents into new buffer
-	memcpy(&siblingKey, this->buffer + ind + BTLeafNode::RECORD_ID_SIZE, BTNonLeafNode::KEY_SIZE);
-	memcpy(&sibling.buffer, this->buffer + ind, origBufferSize - ind);
+	setItems(&items[0], half);
+	sibling.setItems(&items[half], keyCount - half);
+	sibling.setNextNodePtr(getNextNodePtr());
 
-	// Clear everything in the buffer starting from the midKey
-	memset(this->buffer + ind, 0xff, origBufferSize - ind);
+	siblingKey = Traits::separator(items[half - 1].key, items[half].key);
 	return 0;
-
-	/*
-	 * TODO: I don't have the pid of the sibling to set nextNodePtr.
-	 * setNextNodePtr(getNextNodePtr());
-	 * *********************************
-	 */
-
 }
 
 /*
@@ -227,96 +511,434 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
  * @param eid[OUT] the entry number that contains a key larger than or equalty to searchKey
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::locate(int searchKey, int& eid)
+template <class Traits>
+RC BTLeafNodeT<Traits>::locate(const Key& searchKey, int& eid)
 {
-	char *tbuffer = this->buffer;
-	int count = getKeyCount();
-	int entry = 0;
-
-	if (count == 0) {
+	if (getKeyCount() == 0) {
 		return RC_INVALID_ATTRIBUTE;
 	}
 
-	while (count) {
-		if (*(int *) (tbuffer + BTLeafNode::RECORD_ID_SIZE) >= searchKey) {
-			eid = entry;
-			return 0;
-		}
-		tbuffer += (BTNonLeafNode::KEY_SIZE + BTLeafNode::RECORD_ID_SIZE);
-		entry++;
-		count--;
+	eid = Traits::lowerBound(keys(), getKeyCount(), searchKey);
+	return 0;
+}
+
+/*
+ * Count the rids of the keys smaller than searchKey
+ * (not larger than searchKey if inclusive).
+ * @param searchKey[IN] the key to count up to.
+ * @param inclusive[IN] true to count the rids of searchKey as well.
+ * @param count[OUT] the # of such rids.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class Traits>
+RC BTLeafNodeT<Traits>::locateRank(const Key& searchKey, bool inclusive, int& count)
+{
+	int n = inclusive ? Traits::upperBound(keys(), getKeyCount(), searchKey)
+			  : Traits::lowerBound(keys(), getKeyCount(), searchKey);
+
+	count = 0;
+	for (int i = 0; i < n; i++) {
+		count += getRidCount(i);
 	}
-	eid = entry;
 	return 0;
 }
 
 /*
- * Read the (key, rid) pair from the eid entry.
+ * Read the key and its first rid from the eid entry.
  * @param eid[IN] the entry number to read the (key, rid) pair from
  * @param key[OUT] the key from the entry
- * @param rid[OUT] the RecordId from the entry
+ * @param rid[OUT] the first RecordId of the key
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
+template <class Traits>
+RC BTLeafNodeT<Traits>::readEntry(int eid, Key& key, RecordId& rid)
 {
-	char *tbuffer;
-	if (eid >= MAX_LEAF_KEY_COUNT)
+	if (eid < 0 || eid >= getKeyCount())
 		return RC_INVALID_ATTRIBUTE;
 
-	tbuffer = this->buffer + (BTNonLeafNode::KEY_SIZE + BTLeafNode::RECORD_ID_SIZE) * eid;
+	key = keys()[eid];
+	rid = refs()[eid];
+	if (rid.pid == -1) {
+		BTPostingList::decode((char*) (list(rid.sid) + 2), 1, &rid);
+	} else if (rid.pid < -1) {
+		return RC_INVALID_ATTRIBUTE;
+	}
+	return 0;
+}
+
+/*
+ * Read the (key, rid) pairs of the eid entry from (postingPid, pos) on.
+ * @param eid[IN] the entry number to read
+ * @param postingPid[IN/OUT] the posting page to read from, if any
+ * @param pos[IN/OUT] the rid to read from. -1 after the last one
+ * @param entries[OUT] the (key, rid) pairs read, in rid order
+ * @param maxCount[IN] the capacity of entries
+ * @param count[OUT] the number of pairs read
+ * @param pf[IN] PageFile of the posting pages of the node
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class Traits>
+RC BTLeafNodeT<Traits>::readEntries(int eid, PageId& postingPid, int& pos,
+				    Entry* entries, int maxCount, int& count,
+				    const PageFile& pf)
+{
+	RecordId ref;
+	Key key;
+	int total;
+	PageId next;
+	RC rc;
+
+	count = 0;
+	if (eid < 0 || eid >= getKeyCount() || pos < 0)
+		return RC_INVALID_ATTRIBUTE;
 
-	memcpy(&rid, tbuffer, BTLeafNode::RECORD_ID_SIZE);
-	memcpy(&key, tbuffer + BTLeafNode::RECORD_ID_SIZE, BTNonLeafNode::KEY_SIZE);
+	key = keys()[eid];
+	ref = refs()[eid];
+	if (ref.pid >= -1) {
+		RecordId rids[MAX_INLINE_SIZE];
+		Item item;
+
+		getItem(eid, item);
+		total = readRids(item, rids);
+		while (count < maxCount && pos < total) {
+			entries[count].key = key;
+			entries[count++].rid = rids[pos++];
+		}
+		if (pos == total) {
+			pos = -1;
+		}
+		return 0;
+	}
 
+	// a page of the posting list at a time. pos is left short of the end
+	// of a page only when entries is full
+	RecordId rids[BTPostingList::MAX_PAGE_RIDS];
+	if (postingPid < 0) {
+		postingPid = -2 - ref.pid;
+		pos = 0;
+	}
+	for (;;) {
+		if ((rc = BTPostingList::readPage(pf, postingPid, rids, total, next)) < 0) {
+			return rc;
+		}
+		while (count < maxCount && pos < total) {
+			entries[count].key = key;
+			entries[count++].rid = rids[pos++];
+		}
+		if (pos < total) {
+			break;
+		}
+		if (next < 0) {
+			pos = -1;
+			break;
+		}
+		postingPid = next;
+		pos = 0;
+		if (count == maxCount) {
+			break;
+		}
+	}
 	return 0;
 }
 
 /*
- * Return the pid of the next sibling node.
- * @return the PageId of the next sibling node 
+ * Return the # of rids of the eid entry.
+ * @param eid[IN] the entry number
+ * @return the # of rids
  */
-PageId BTLeafNode::getNextNodePtr()
+template <class Traits>
+int BTLeafNodeT<Traits>::getRidCount(int eid)
 {
-	PageId pid;
+	RecordId ref = refs()[eid];
 
-	memcpy(&pid, this->buffer + PageFile::PAGE_SIZE - BTNonLeafNode::PAGE_ID_SIZE,
-	       BTNonLeafNode::PAGE_ID_SIZE);
-	// return *(int *) (this->buffer + PageFile::PAGE_SIZE -
-	// 		 BTNonLeafNode::PAGE_ID_SIZE);
-	return pid;
+	if (ref.pid >= 0) {
+		return 1;
+	}
+	return ref.pid == -1 ? list(ref.sid)[0] : ref.sid;
+}
+
+/*
+ * Return the # of rids of the node, over all its keys.
+ * @return the # of rids
+ */
+template <class Traits>
+int BTLeafNodeT<Traits>::getEntryCount()
+{
+	int keyCount = getKeyCount();
+	int count = 0;
+
+	for (int i = 0; i < keyCount; i++) {
+		count += getRidCount(i);
+	}
+	return count;
+}
+
+/*
+ * Make item.list the list in the node of count rids.
+ */
+template <class Traits>
+void BTLeafNodeT<Traits>::makeList(Item& item, const RecordId* rids, int count)
+{
+	int bytes;
+
+	if (count == 1) {
+		item.ref = rids[0];
+		item.list.clear();
+		return;
+	}
+
+	// the count and length, the rids, and a byte to keep the next
+	// list aligned
+	bytes = BTPostingList::encode(rids, count, NULL);
+	item.list.assign((2 * sizeof(unsigned short) + bytes + 1) & ~1, 0);
+	((unsigned short*) &item.list[0])[0] = count;
+	((unsigned short*) &item.list[0])[1] = bytes;
+	BTPostingList::encode(rids, count, &item.list[2 * sizeof(unsigned short)]);
+	item.ref.pid = -1;
+	item.ref.sid = 0;
+}
+
+/*
+ * Add a rid to the rids of item. A list that grows longer than
+ * MAX_INLINE_SIZE is written to posting pages.
+ */
+template <class Traits>
+RC BTLeafNodeT<Traits>::addRid(Item& item, const RecordId& rid, PageFile& pf)
+{
+	RecordId rids[MAX_INLINE_SIZE + 1];
+	int count, n;
+	PageId head;
+	RC rc;
+
+	if (item.ref.pid < -1) {
+		if ((rc = BTPostingList::insert(pf, -2 - item.ref.pid, rid)) < 0) {
+			return rc;
+		}
+		item.ref.sid++;
+		return 0;
+	}
+
+	count = readRids(item, rids);
+	n = upper_bound(rids, rids + count, rid) - rids;
+	memmove(rids + n + 1, rids + n, (count - n) * sizeof(RecordId));
+	rids[n] = rid;
+	count++;
+
+	makeList(item, rids, count);
+	if ((int) item.list.size() > MAX_INLINE_SIZE) {
+		if ((rc = BTPostingList::write(pf, rids, count, head)) < 0) {
+			return rc;
+		}
+		item.ref.pid = -2 - head;
+		item.ref.sid = count;
+		item.list.clear();
+	}
+	return 0;
+}
+
+/*
+ * Read the rids of an item with no posting pages. Return their #.
+ */
+template <class Traits>
+int BTLeafNodeT<Traits>::readRids(const Item& item, RecordId* rids)
+{
+	const unsigned short* head = (const unsigned short*) item.list.data();
+
+	if (item.ref.pid >= 0) {
+		rids[0] = item.ref;
+		return 1;
+	}
+	BTPostingList::decode(item.list.data() + 2 * sizeof(unsigned short), head[0], rids);
+	return head[0];
+}
+
+template <class Traits>
+void BTLeafNodeT<Traits>::getItem(int eid, Item& item)
+{
+	item.key = keys()[eid];
+	item.ref = refs()[eid];
+	item.list.clear();
+	if (item.ref.pid == -1) {
+		unsigned short* head = list(item.ref.sid);
+		item.list.assign(buffer + item.ref.sid,
+				 (2 * sizeof(unsigned short) + head[1] + 1) & ~1);
+	}
+}
+
+template <class Traits>
+void BTLeafNodeT<Traits>::getItems(vector<Item>& items)
+{
+	int keyCount = getKeyCount();
+
+	items.resize(keyCount);
+	for (int i = 0; i < keyCount; i++) {
+		getItem(i, items[i]);
+	}
+}
+
+/*
+ * Make the node hold count items, in place of its entries.
+ */
+template <class Traits>
+void BTLeafNodeT<Traits>::setItems(const Item* items, int count)
+{
+	header()->keyCount = count;
+	listStart() = LIST_END;
+	listBytes() = 0;
+	for (int i = 0; i < count; i++) {
+		keys()[i] = items[i].key;
+		refs()[i].pid = 0;
+	}
+	for (int i = 0; i < count; i++) {
+		setItem(i, items[i]);
+	}
+}
+
+/*
+ * Set the ref of the eid entry, and its list in the node if any. The old
+ * list of the entry is left to compact().
+ */
+template <class Traits>
+void BTLeafNodeT<Traits>::setItem(int eid, const Item& item)
+{
+	RecordId& ref = refs()[eid];
+	int size = item.list.size();
+
+	if (ref.pid == -1) {
+		listBytes() -= (2 * sizeof(unsigned short) + list(ref.sid)[1] + 1) & ~1;
+	}
+	ref = item.ref;
+	if (size > 0) {
+		// no list of the entry while allocate() may compact the lists
+		ref.pid = 0;
+		ref.sid = allocate(size);
+		memcpy(buffer + ref.sid, item.list.data(), size);
+		ref.pid = -1;
+		listBytes() += size;
+	}
+}
+
+/*
+ * Insert key at pos with an empty ref. The caller has checked that the
+ * node has room for the entry.
+ */
+template <class Traits>
+void BTLeafNodeT<Traits>::insertKey(int pos, const Key& key)
+{
+	int keyCount = getKeyCount();
+	char* oldRefs;
+	char* newRefs;
+
+	if (listStart() - (int) (sizeof(BTNodeHeader) + keyCount * ENTRY_SIZE) < ENTRY_SIZE) {
+		compact();
+	}
+
+	// the refs move up by a key, and those from pos on by a ref more
+	oldRefs = (char*) refs();
+	newRefs = oldRefs + sizeof(Key);
+	memmove(newRefs + (pos + 1) * sizeof(RecordId), oldRefs + pos * sizeof(RecordId),
+		(keyCount - pos) * sizeof(RecordId));
+	memmove(newRefs, oldRefs, pos * sizeof(RecordId));
+	memmove(keys() + pos + 1, keys() + pos, (keyCount - pos) * sizeof(Key));
+	keys()[pos] = key;
+	header()->keyCount++;
+	refs()[pos].pid = 0;
+	refs()[pos].sid = 0;
+}
+
+/*
+ * Return the offset of bytes of room for a list. The caller has checked
+ * that the node has room for the list.
+ */
+template <class Traits>
+int BTLeafNodeT<Traits>::allocate(int bytes)
+{
+	if (listStart() - (int) (sizeof(BTNodeHeader) + getKeyCount() * ENTRY_SIZE) < bytes) {
+		compact();
+	}
+	listStart() -= bytes;
+	return listStart();
+}
+
+/*
+ * Move the lists in use to the end of the node, over the space left by
+ * the lists that are not.
+ */
+template <class Traits>
+void BTLeafNodeT<Traits>::compact()
+{
+	char copy[PageFile::PAGE_SIZE];
+	int keyCount = getKeyCount();
+	int size;
+
+	memcpy(copy, buffer, PageFile::PAGE_SIZE);
+	listStart() = LIST_END;
+	for (int i = 0; i < keyCount; i++) {
+		RecordId& ref = refs()[i];
+		if (ref.pid == -1) {
+			size = (2 * sizeof(unsigned short) +
+				((unsigned short*) (copy + ref.sid))[1] + 1) & ~1;
+			listStart() -= size;
+			memcpy(buffer + listStart(), copy + ref.sid, size);
+			ref.sid = listStart();
+		}
+	}
+}
+
+/*
+ * Return the pid of the next sibling node.
+ * @return the PageId of the next sibling node
+ */
+template <class Traits>
+PageId BTLeafNodeT<Traits>::getNextNodePtr()
+{
+	return header()->nextPid;
 }
 
 /*
  * Set the pid of the next sibling node.
- * @param pid[IN] the PageId of the next sibling node 
+ * @param pid[IN] the PageId of the next sibling node
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::setNextNodePtr(PageId pid)
+template <class Traits>
+RC BTLeafNodeT<Traits>::setNextNodePtr(PageId pid)
 {
-	memset(this->buffer + PageFile::PAGE_SIZE - BTNonLeafNode::PAGE_ID_SIZE, 0,
-	       BTNonLeafNode::PAGE_ID_SIZE);
-	memcpy(this->buffer + PageFile::PAGE_SIZE - BTNonLeafNode::PAGE_ID_SIZE, &pid,
-	       BTNonLeafNode::PAGE_ID_SIZE);
-
-	// *(int *) (this->buffer + PageFile::PAGE_SIZE -
-	// 	  BTNonLeafNode::PAGE_ID_SIZE) = pid;
+	header()->nextPid = pid;
 	return 0;
 }
 
-void BTLeafNode::printBuffer() {
-	RecordId currRid = {0, 0};
-	int currKey = 0;
-	int buffInd = 0;
+/*
+ * Return the pid of the previous sibling node.
+ * @return the PageId of the previous sibling node
+ */
+template <class Traits>
+PageId BTLeafNodeT<Traits>::getPrevNodePtr()
+{
+	return header()->prevPid;
+}
+
+/*
+ * Set the pid of the previous sibling node.
+ * @param pid[IN] the PageId of the previous sibling node
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class Traits>
+RC BTLeafNodeT<Traits>::setPrevNodePtr(PageId pid)
+{
+	header()->prevPid = pid;
+	return 0;
+}
 
-	while (buffInd < PageFile::PAGE_SIZE && currRid.pid != -1) {
-		// Parse the pid first and increment the index
-		memcpy(&currRid, this->buffer + buffInd, BTLeafNode::RECORD_ID_SIZE);
-		buffInd += BTLeafNode::RECORD_ID_SIZE;
+template <class Traits>
+void BTLeafNodeT<Traits>::printBuffer() {
+	int keyCount = getKeyCount();
 
-		// Parse the key next and increment the index
-		memcpy(&currKey, this->buffer + buffInd, BTNonLeafNode::KEY_SIZE);
-		buffInd += BTNonLeafNode::KEY_SIZE;
-		cout << " " << currKey;
+	for (int i = 0; i < keyCount; i++) {
+		cout << " ";
+		Traits::print(cout, keys()[i]);
+		if (getRidCount(i) > 1) {
+			cout << "x" << getRidCount(i);
+		}
 	}
 	cout << "/" << getNextNodePtr() << "/ ";
 	return;
@@ -324,262 +946,167 @@ void BTLeafNode::printBuffer() {
 
 /* ------------------------------------------------------------------- */
 
-BTNonLeafNode::BTNonLeafNode() {
-	memset(this->buffer, 0xff, PageFile::PAGE_SIZE);
+template <class Traits>
+BTNonLeafNodeT<Traits>::BTNonLeafNodeT(bool counted) {
+	this->buffer = this->page;
+	memset(this->buffer, 0, PageFile::PAGE_SIZE);
+	initHeader(header(), 1);
+	if (counted) {
+		header()->flags |= BTNODE_COUNTED;
+	}
+	pids()[0] = -1;
 }
 
 /*
  * Read the content of the node from the page pid in the PageFile pf.
+ * The page is pinned in the buffer pool and the node works on it in place.
  * @param pid[IN] the PageId to read
  * @param pf[IN] PageFile to read from
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
-{ 
-	return pf.read(pid, this->buffer);
+template <class Traits>
+RC BTNonLeafNodeT<Traits>::read(PageId pid, const PageFile& pf)
+{
+	RC rc;
+
+	if ((rc = pf.fetch(pid, this->handle)) < 0) {
+		return rc;
+	}
+	this->buffer = this->handle.data();
+
+	if (header()->version != BTNODE_VERSION || header()->level < 1) {
+		this->handle.unpin();
+		this->buffer = this->page;
+		return RC_INVALID_FILE_FORMAT;
+	}
+	return 0;
 }
-    
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
  * @param pf[IN] PageFile to write to
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::write(PageId pid, PageFile& pf)
+template <class Traits>
+RC BTNonLeafNodeT<Traits>::write(PageId pid, PageFile& pf)
 {
 	return pf.write(pid, this->buffer);
 }
 
 /*
- * Return the number of keys stored in the node.
- * @return the number of keys in the node
+ * Insert a (key, pid) pair after the keys equal to key. The pid is
+ * placed behind the key, and in a counted node its count is moved over
+ * from the child in front of it. Like BTLeafNodeT::_insert(), it does not
+ * check whether the node is full.
  */
-int BTNonLeafNode::getKeyCount()
+template <class Traits>
+RC BTNonLeafNodeT<Traits>::_insert(const Key& key, PageId pid, int count)
 {
-	int ind = 0;
-	int numKeys = 0;
-
-	int currKey = 0;
-	PageId currPid = -2;
-
-	// assumes buffer has been initialized to 0xff
-	while(currPid != -1) {
-		// Parse the pid first and increment the index
-		memcpy(&currPid, this->buffer + ind, BTNonLeafNode::PAGE_ID_SIZE);
-		ind += BTNonLeafNode::PAGE_ID_SIZE;
-
-		// Parse the key next and increment the index
-		memcpy(&currKey, this->buffer + ind, BTNonLeafNode::KEY_SIZE);
-		ind += BTNonLeafNode::KEY_SIZE;
-
-		// Assumes pid is not -1 until the final loop
-		// Corrects for this at the end
-		numKeys++;
+	int keyCount = getKeyCount();
+	int pos = Traits::upperBound(keys(), keyCount, key);
+
+	memmove(keys() + pos + 1, keys() + pos, (keyCount - pos) * KEY_SIZE);
+	memmove(pids() + pos + 2, pids() + pos + 1,
+		(keyCount - pos) * PAGE_ID_SIZE);
+	keys()[pos] = key;
+	pids()[pos + 1] = pid;
+	if (isCounted()) {
+		memmove(counts() + pos + 2, counts() + pos + 1,
+			(keyCount - pos) * sizeof(int));
+		counts()[pos] -= count;
+		counts()[pos + 1] = count;
 	}
-
-	// Need to offset the final two loops
-	if (numKeys != 1)
-		numKeys -= 2;
-	else
-		numKeys = 0;
-	return numKeys;
+	header()->keyCount++;
+	return 0;
 }
 
-RC BTNonLeafNode::_insert(int key, PageId pid)
-{ 
-	int keyCount = this->getKeyCount();
-	PageId currPid = -2;
-	int currKey = 0;
-	int ind = 0;
+/*
+ * Append the (key, pid) pair after the last pointer of the node.
+ * @param key[IN] the key to append
+ * @param pid[IN] the PageId to append
+ * @param count[IN] the # of entries under pid, for a counted node
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+template <class Traits>
+RC BTNonLeafNodeT<Traits>::append(const Key& key, PageId pid, int count)
+{
+	int keyCount = getKeyCount();
 
-	if (keyCount == 0) {
-		memcpy(this->buffer, &pid, BTNonLeafNode::PAGE_ID_SIZE);
-		memcpy(this->buffer + BTNonLeafNode::PAGE_ID_SIZE, &key, BTNonLeafNode::KEY_SIZE);
-		return 0;
-	} else {
-		ind = BTNonLeafNode::PAGE_ID_SIZE;
-
-		// assumes buffer has been initialized to 0xff
-		while(currPid != -1) {
-			// Parse the pid first and increment the index
-			memcpy(&currKey, this->buffer + ind,
-			       BTNonLeafNode::KEY_SIZE);
-			ind += BTNonLeafNode::KEY_SIZE;
-
-			memcpy(&currPid, this->buffer + ind,
-			       BTNonLeafNode::PAGE_ID_SIZE);
-			ind += BTNonLeafNode::PAGE_ID_SIZE;
-
-			// Parse the key next and increment the index
-			if (key < currKey) {
-				// Move the index back to be before this current key
-				ind -= (BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE);
-
-				// Move the memory block over by one pid and one key size
-				memmove(this->buffer + ind + BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE,
-					this->buffer + ind,
-					PageFile::PAGE_SIZE - (ind + BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE));
-
-				// Copy PID and key into the buffer
-				memcpy(this->buffer + ind, &key,
-				       BTNonLeafNode::KEY_SIZE);
-				ind += BTNonLeafNode::KEY_SIZE;
-
-				memcpy(this->buffer + ind, &pid,
-				       BTNonLeafNode::PAGE_ID_SIZE);
-				ind += BTNonLeafNode::PAGE_ID_SIZE;
-
-				return 0;
-			} else if (currKey == -1) {
-				// Move the index back to be before this current key
-				ind -= (BTNonLeafNode::KEY_SIZE +
-					BTNonLeafNode::PAGE_ID_SIZE);
-
-				// Copy PID and key into the buffer
-				memcpy(this->buffer + ind, &key,
-				       BTNonLeafNode::KEY_SIZE);
-				ind += BTNonLeafNode::KEY_SIZE;
-
-				memcpy(this->buffer + ind, &pid,
-				       BTNonLeafNode::PAGE_ID_SIZE);
-				ind += BTNonLeafNode::PAGE_ID_SIZE;
-				return 0;
-			}
-		}
-		// If the end of the array has been reached
-		// append key and pid to end
-		memcpy(this->buffer + ind, &pid, BTNonLeafNode::PAGE_ID_SIZE);
-		ind += BTNonLeafNode::PAGE_ID_SIZE;
+	if (keyCount == maxKeyCount()) {
+		return RC_NODE_FULL;
+	}
 
-		// Parse the key next and increment the index
-		memcpy(this->buffer + ind, &key, BTNonLeafNode::KEY_SIZE);
-		return 0;
+	keys()[keyCount] = key;
+	pids()[keyCount + 1] = pid;
+	if (isCounted()) {
+		counts()[keyCount + 1] = count;
 	}
-	// Should never reach this point
-	return RC_INVALID_ATTRIBUTE; 
+	header()->keyCount++;
+	return 0;
 }
 
 /*
  * Insert a (key, pid) pair to the node.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param count[IN] the # of entries under pid, taken from the child before it
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTNonLeafNode::insert(int key, PageId pid)
-{ 
-	int keyCount = this->getKeyCount();
-	PageId currPid = -2;
-	int currKey = 0;
-	int ind = 0;
-
-	if (keyCount == MAX_NONLEAF_KEY_COUNT) {
+template <class Traits>
+RC BTNonLeafNodeT<Traits>::insert(const Key& key, PageId pid, int count)
+{
+	if (getKeyCount() == maxKeyCount()) {
 		return RC_NODE_FULL;
 	}
-	else if (keyCount == 0) {
-		memcpy(this->buffer, &pid, BTNonLeafNode::PAGE_ID_SIZE);
-		memcpy(this->buffer + BTNonLeafNode::PAGE_ID_SIZE, &key, BTNonLeafNode::KEY_SIZE);
-		return 0;
-	}
-	else {
-		ind = BTNonLeafNode::PAGE_ID_SIZE;
-
-		// assumes buffer has been initialized to 0xff
-		while(currPid != -1) {
-			// Parse the pid first and increment the index
-			memcpy(&currKey, this->buffer + ind,
-			       BTNonLeafNode::KEY_SIZE);
-			ind += BTNonLeafNode::KEY_SIZE;
-
-			memcpy(&currPid, this->buffer + ind,
-			       BTNonLeafNode::PAGE_ID_SIZE);
-			ind += BTNonLeafNode::PAGE_ID_SIZE;
-
-			// Parse the key next and increment the index
-			if (key < currKey) {
-				// Move the index back to be before this current key
-				ind -= (BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE);
-
-				// Move the memory block over by one pid and one key size
-				memmove(this->buffer + ind + BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE,
-					this->buffer + ind,
-					PageFile::PAGE_SIZE - (ind + BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE));
-
-				// Copy PID and key into the buffer
-				memcpy(this->buffer + ind, &key,
-				       BTNonLeafNode::KEY_SIZE);
-				ind += BTNonLeafNode::KEY_SIZE;
-
-				memcpy(this->buffer + ind, &pid,
-				       BTNonLeafNode::PAGE_ID_SIZE);
-				ind += BTNonLeafNode::PAGE_ID_SIZE;
-
-				return 0;
-			} else if (currKey == -1) {
-				// Move the index back to be before this current key
-				ind -= (BTNonLeafNode::KEY_SIZE +
-					BTNonLeafNode::PAGE_ID_SIZE);
-
-				// Copy PID and key into the buffer
-				memcpy(this->buffer + ind, &key,
-				       BTNonLeafNode::KEY_SIZE);
-				ind += BTNonLeafNode::KEY_SIZE;
-
-				memcpy(this->buffer + ind, &pid,
-				       BTNonLeafNode::PAGE_ID_SIZE);
-				ind += BTNonLeafNode::PAGE_ID_SIZE;
-				return 0;
-			}
-		}
-		// If the end of the array has been reached
-		// append key and pid to end
-		memcpy(this->buffer + ind, &pid, BTNonLeafNode::PAGE_ID_SIZE);
-		ind += BTNonLeafNode::PAGE_ID_SIZE;
-
-		// Parse the key next and increment the index
-		memcpy(this->buffer + ind, &key, BTNonLeafNode::KEY_SIZE);
-		return 0;
-	}
-	// Should never reach this point
-	return RC_INVALID_ATTRIBUTE; 
+	return _insert(key, pid, count);
 }
 
 /*
  * Insert the (key, pid) pair to the node
  * and split the node half and half with sibling.
  * The middle key after the split is returned in midKey.
+ * The sibling gets the level of the node. Sibling pointers are left to
+ * the caller.
+ * The sibling also gets the counted flag of the node.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
  * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
  * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+ * @param count[IN] the # of entries under pid (see insert())
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
-{ 
+template <class Traits>
+RC BTNonLeafNodeT<Traits>::insertAndSplit(const Key& key, PageId pid,
+					     BTNonLeafNodeT& sibling,
+					     Key& midKey, int count)
+{
 	if (sibling.getKeyCount() != 0) {
 		return RC_INVALID_ATTRIBUTE;
 	}
-	else {
-		// Insert the (key, pid) pair into the node first
-		this->_insert(key, pid);
-
-		// Calculate the keyCount
-		int keyCount = this->getKeyCount();
-		int origBufferSize = keyCount * (BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE) + PAGE_ID_SIZE;
-		
-		// Reach the middle of the node
-		int ind = (keyCount / 2) * (BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE);
-
-		// New start of the sibling node
-		int newStart = ind + BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE;
-
-		// Copy the midKey and copy contents into new buffer
-		memcpy(&midKey, this->buffer + ind + BTNonLeafNode::PAGE_ID_SIZE, BTNonLeafNode::KEY_SIZE);
-		memcpy(&sibling.buffer, this->buffer + newStart, origBufferSize - newStart);
 
-		// Clear everything in the buffer starting from the midKey
-		memset(this->buffer + ind + BTNonLeafNode::PAGE_ID_SIZE, 0xff, origBufferSize - (ind + BTNonLeafNode::PAGE_ID_SIZE));
+	// Insert the (key, pid) pair into the node first
+	this->_insert(key, pid, count);
+
+	// The middle key moves up. The sibling takes the pids after it
+	// together with the keys between them
+	int keyCount = getKeyCount();
+	int half = keyCount / 2;
+
+	sibling.header()->flags = header()->flags;
+	midKey = keys()[half];
+	memcpy(sibling.keys(), keys() + half + 1,
+	       (keyCount - half - 1) * KEY_SIZE);
+	memcpy(sibling.pids(), pids() + half + 1,
+	       (keyCount - half) * PAGE_ID_SIZE);
+	if (isCounted()) {
+		memcpy(sibling.counts(), counts() + half + 1,
+		       (keyCount - half) * sizeof(int));
 	}
-	return 0; 
+	sibling.header()->keyCount = keyCount - half - 1;
+	sibling.setLevel(getLevel());
+	header()->keyCount = half;
+	return 0;
 }
 
 /*
@@ -589,91 +1116,183 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
  * @param pid[OUT] the pointer to the child node to follow.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
-{ 
-	PageId currPid = -2;
-	int currKey = 0;
-	int ind = 0;
-
-	while(currPid != -1) {
-		// Parse the pid first and increment the index
-		memcpy(&currPid, this->buffer + ind, BTNonLeafNode::PAGE_ID_SIZE);
-		ind += BTNonLeafNode::PAGE_ID_SIZE;
-
-		// Parse the key next and increment the index
-		memcpy(&currKey, this->buffer + ind, BTNonLeafNode::KEY_SIZE);
-		ind += BTNonLeafNode::KEY_SIZE;
-
-		// If currKey is -1, we have passed the end of valid keys
-		if ((searchKey < currKey) || (currKey == -1)) {
-			pid = currPid;
-			return 0;
+template <class Traits>
+RC BTNonLeafNodeT<Traits>::locateChildPtr(const Key& searchKey, PageId& pid)
+{
+	pid = pids()[Traits::upperBound(keys(), getKeyCount(), searchKey)];
+	if (pid < 0) {
+		return RC_INVALID_PID;
+	}
+	return 0;
+}
+
+/*
+ * Given the searchKey, find the child-node pointer to follow and
+ * output it in pids[0], followed by the pointers to the next children
+ * that may hold keys up to endKey.
+ * @param searchKey[IN] the searchKey that is being looked up.
+ * @param endKey[IN] the largest key of interest.
+ * @param pids[OUT] the pointers to the child nodes.
+ * @param maxCount[IN] the capacity of pids.
+ * @param count[OUT] the number of pointers output in pids.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class Traits>
+RC BTNonLeafNodeT<Traits>::locateChildPtrs(const Key& searchKey, const Key& endKey,
+					      PageId* pids, int maxCount, int& count)
+{
+	int keyCount = getKeyCount();
+	int i = Traits::upperBound(keys(), keyCount, searchKey);
+
+	count = 0;
+	if (this->pids()[i] < 0) {
+		return RC_INVALID_PID;
+	}
+
+	// keys()[i] is the smallest key of the child after pids()[i]
+	while (count < maxCount) {
+		pids[count++] = this->pids()[i];
+		if (i == keyCount || Traits::less(endKey, keys()[i])) {
+			break;
 		}
+		i++;
+	}
+	return 0;
+}
+
+/*
+ * Find the child-node pointer to follow to count the entries with keys
+ * smaller than searchKey (not larger than searchKey if inclusive).
+ * The children in front of it hold only such keys, and the children
+ * after it none, so count is the sum of the counts in front of it.
+ * @param searchKey[IN] the key to count up to.
+ * @param inclusive[IN] true to count the entries with searchKey as well.
+ * @param pid[OUT] the pointer to the child node to follow.
+ * @param count[OUT] the # of entries in the children before pid.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class Traits>
+RC BTNonLeafNodeT<Traits>::locateChildRank(const Key& searchKey, bool inclusive,
+					      PageId& pid, int& count)
+{
+	int keyCount = getKeyCount();
+	int i;
+
+	if (!isCounted()) {
+		return RC_INVALID_ATTRIBUTE;
+	}
+
+	// keys()[j] is not smaller than every key of the child pids()[j]
+	i = inclusive ? Traits::upperBound(keys(), keyCount, searchKey)
+		      : Traits::lowerBound(keys(), keyCount, searchKey);
+	pid = pids()[i];
+	if (pid < 0) {
+		return RC_INVALID_PID;
 	}
 
-	// Should send an error code if loop breaks before returning
-	return RC_INVALID_PID;
+	count = 0;
+	for (int j = 0; j < i; j++) {
+		count += counts()[j];
+	}
+	return 0;
+}
+
+/*
+ * Count one more entry in the child for searchKey.
+ * @param searchKey[IN] the key of the entry inserted under the child
+ */
+template <class Traits>
+void BTNonLeafNodeT<Traits>::countInsert(const Key& searchKey)
+{
+	if (isCounted()) {
+		counts()[Traits::upperBound(keys(), getKeyCount(), searchKey)]++;
+	}
+}
+
+/*
+ * Return the number of entries in the subtrees of the node.
+ * @return the sum of the counts of the children
+ */
+template <class Traits>
+int BTNonLeafNodeT<Traits>::getEntryCount()
+{
+	int keyCount = getKeyCount();
+	int count = 0;
+
+	for (int i = 0; i <= keyCount; i++) {
+		count += counts()[i];
+	}
+	return count;
 }
 
 /*
  * Initialize the root node with (pid1, key, pid2).
+ * The level, the counted flag and the sibling pointers of the node are kept.
  * @param pid1[IN] the first PageId to insert
  * @param key[IN] the key that should be inserted between the two PageIds
  * @param pid2[IN] the PageId to insert behind the key
+ * @param count1[IN] the # of entries under pid1, for a counted node
+ * @param count2[IN] the # of entries under pid2, for a counted node
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
+template <class Traits>
+RC BTNonLeafNodeT<Traits>::initializeRoot(PageId pid1, const Key& key, PageId pid2,
+					     int count1, int count2)
 {
-	// initialize the buffer to 0xff
-	memset(this->buffer, 0xff, PageFile::PAGE_SIZE);
-
-	// copy the inputs into the buffer
-	memcpy(this->buffer, &pid1, BTNonLeafNode::PAGE_ID_SIZE);
-	memcpy(this->buffer + BTNonLeafNode::PAGE_ID_SIZE, &key, BTNonLeafNode::KEY_SIZE);
-	memcpy(this->buffer + BTNonLeafNode::PAGE_ID_SIZE + BTNonLeafNode::KEY_SIZE, &pid2, BTNonLeafNode::PAGE_ID_SIZE);
+	pids()[0] = pid1;
+	keys()[0] = key;
+	pids()[1] = pid2;
+	if (isCounted()) {
+		counts()[0] = count1;
+		counts()[1] = count2;
+	}
+	header()->keyCount = 1;
 
-	return 0; 
+	return 0;
 }
 
-void BTNonLeafNode::printBuffer() {
-	PageId currPid = 0;
-	int currKey = 0;
-	int buffInd = 0;
-
-	while (buffInd < PageFile::PAGE_SIZE && currPid != -1) {
-		// Parse the pid first and increment the index
-		memcpy(&currPid, this->buffer + buffInd, BTNonLeafNode::PAGE_ID_SIZE);
-		buffInd += BTNonLeafNode::PAGE_ID_SIZE;
-		cout << "PID is " << currPid << endl;
+template <class Traits>
+void BTNonLeafNodeT<Traits>::printBuffer() {
+	int keyCount = getKeyCount();
 
-		// Parse the key next and increment the index
-		memcpy(&currKey, this->buffer + buffInd, BTNonLeafNode::KEY_SIZE);
-		buffInd += BTNonLeafNode::KEY_SIZE;
-		cout << "Key is " << currKey << endl;
+	cout << "PID is " << pids()[0] << endl;
+	for (int i = 0; i < keyCount; i++) {
+		cout << "Key is ";
+		Traits::print(cout, keys()[i]);
+		cout << endl;
+		cout << "PID is " << pids()[i + 1] << endl;
 	}
 
 	return;
 }
 
-void BTNonLeafNode::printBuffer(queue<PageId>& pidQueue) {
-	PageId currPid = 0;
-	int currKey = 0;
-	int buffInd = 0;
-
-	while (buffInd < PageFile::PAGE_SIZE && currPid != -1) {
-		// Parse the pid first and increment the index
-		memcpy(&currPid, this->buffer + buffInd, BTNonLeafNode::PAGE_ID_SIZE);
-		buffInd += BTNonLeafNode::PAGE_ID_SIZE;
-		cout << " " << currPid;
-		if (currPid != -1)
-			pidQueue.push(currPid);
-
-		// Parse the key next and increment the index
-		memcpy(&currKey, this->buffer + buffInd, BTNonLeafNode::KEY_SIZE);
-		buffInd += BTNonLeafNode::KEY_SIZE;
-		cout << " " << currKey;
+template <class Traits>
+void BTNonLeafNodeT<Traits>::printBuffer(queue<PageId>& pidQueue) {
+	int keyCount = getKeyCount();
+
+	cout << " " << pids()[0];
+	pidQueue.push(pids()[0]);
+	for (int i = 0; i < keyCount; i++) {
+		cout << " ";
+		Traits::print(cout, keys()[i]);
+		cout << " " << pids()[i + 1];
+		pidQueue.push(pids()[i + 1]);
 	}
 
 	return;
 }
 
+// the key types the B+tree is built for (see KeyTraits.h)
+template class BTLeafNodeT<IntKey>;
+template class BTLeafNodeT<Int64Key>;
+template class BTLeafNodeT<FixedStringKey<16> >;
+template class BTLeafNodeT<FixedStringKey<32> >;
+template class BTLeafNodeT<PairKey<IntKey, IntKey> >;
+template class BTLeafNodeT<PairKey<IntKey, FixedStringKey<16> > >;
+
+template class BTNonLeafNodeT<IntKey>;
+template class BTNonLeafNodeT<Int64Key>;
+template class BTNonLeafNodeT<FixedStringKey<16> >;
+template class BTNonLeafNodeT<FixedStringKey<32> >;
+template class BTNonLeafNodeT<PairKey<IntKey, IntKey> >;
+template class BTNonLeafNodeT<PairKey<IntKey, FixedStringKey<16> > >;
@@ -12,54 +12,226 @@
 
 #include "RecordFile.h"
 #include "PageFile.h"
+#include "KeyTraits.h"
+#include <cstring>
 #include <queue>
+#include <string>
+#include <vector>
 
-#define foreach(buf, p1, p2, condition)					\
-	for (memcpy(&p1, buf, sizeof(p1)),				\
-		     memcpy(&p2, buf + sizeof(p1), sizeof(p2));		\
-	     condition;							\
-	     buf += (sizeof(p1) + sizeof(p2)),				\
-		     memcpy(&p1, buf, sizeof(p1)),                      \
-                     memcpy(&p2, buf + sizeof(p1), sizeof(p2)))
+#define BTNODE_VERSION 5   // the version of the node page format
+
+#define BTNODE_COUNTED 0x01  // the nonleaf node keeps subtree counts
+
+#define BTPOSTING_LEVEL 127  // the level of a posting page (see BTPostingList)
+
+/**
+ * The header at the beginning of every B+tree node page.
+ * The level of a node is 0 for a leaf node and grows by one per level
+ * toward the root. The sibling pointers link the nodes of the same level
+ * in key order.
+ */
+typedef struct {
+  short   version;   // BTNODE_VERSION
+  char    level;     // 0 for a leaf node
+  char    flags;     // BTNODE_COUNTED or 0
+  int     keyCount;  // # of keys stored in the node
+  PageId  nextPid;   // the next node on the same level. -1 if none
+  PageId  prevPid;   // the previous node on the same level. -1 if none
+} BTNodeHeader;
+
+/**
+ * A (key, RecordId) pair stored in a b+tree leaf node.
+ */
+template <class Traits>
+struct IndexEntryT {
+  typename Traits::Key key;
+  RecordId             rid;
+};
+
+typedef IndexEntryT<IntKey> IndexEntry;
 
 /**
- * BTLeafNode: The class representing a B+tree leaf node.
+ * BTPostingList: the rids of a key with too many of them to keep in its
+ * leaf node, in a chain of posting pages of the index file.
  *
  *******************************************************************
- * BTLeafNode page format                                          *
+ * BTPostingList page format                                       *
  * ----------------------------------------------------------      *
- * |   key   |   rid   |   key   |   rid   | ... | nextPage |      *
+ * | header | bytes | last rid | rid | rid | ...              |      *
  * ----------------------------------------------------------      *
- * |    4    |    8    |    4    |    8    | ... |    4     |      *
+ * |   16   |   4   |    8     |  1 to 10 bytes each ...     |      *
  * ----------------------------------------------------------      *
  *******************************************************************
  *
+ * The rids of a posting list are sorted, and each is stored as the
+ * difference from the rid before it (the first one of a page from rid
+ * {0, 0}) in 7-bit groups, so the rids of a table page take a byte or
+ * two each. header.level is BTPOSTING_LEVEL, header.keyCount the # of
+ * rids in the page and header.nextPid the next page of the list.
+ * header.prevPid of the first page is the last page of the list, so that
+ * the rids LOAD appends in rid order go to the end without a walk down
+ * the chain. bytes is the # of bytes of rids in the page, and last rid
+ * its last rid. The same encoding holds the short posting lists kept
+ * in the leaf nodes (see BTLeafNodeT).
+ */
+class BTPostingList {
+  public:
+   /**
+    * Write a posting list to new pages at the end of the file.
+    * @param pf[IN] PageFile to write to
+    * @param rids[IN] the rids, sorted
+    * @param count[IN] the # of rids
+    * @param head[OUT] the first page of the list
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    static RC write(PageFile& pf, const RecordId* rids, int count, PageId& head);
+
+   /**
+    * Insert a rid into the posting list that starts at page head.
+    * The first page of the list stays where it is.
+    * @param pf[IN] PageFile of the list
+    * @param head[IN] the first page of the list
+    * @param rid[IN] the rid to insert
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    static RC insert(PageFile& pf, PageId head, const RecordId& rid);
+
+   /**
+    * Read the rids of a posting page.
+    * @param pf[IN] PageFile of the list
+    * @param pid[IN] the page to read
+    * @param rids[OUT] the rids of the page. room for MAX_PAGE_RIDS
+    * @param count[OUT] the # of rids read
+    * @param next[OUT] the next page of the list. -1 if none
+    * @return 0 if successful. Return an error code if there is an error.
+    *    RC_INVALID_FILE_FORMAT - when the page is not a posting page
+    */
+    static RC readPage(const PageFile& pf, PageId pid, RecordId* rids,
+                       int& count, PageId& next);
+
+   /**
+    * Encode sorted rids, each as the difference from the one before.
+    * @param rids[IN] the rids, sorted
+    * @param count[IN] the # of rids
+    * @param out[OUT] the bytes. NULL to compute their length only
+    * @return the # of bytes
+    */
+    static int encode(const RecordId* rids, int count, char* out);
+
+   /**
+    * Decode count rids encoded by encode().
+    * @param in[IN] the bytes
+    * @param count[IN] the # of rids
+    * @param rids[OUT] the rids
+    */
+    static void decode(const char* in, int count, RecordId* rids);
+
+    // header, byte count and last rid of a posting page
+    const static int PAGE_HEADER =
+      sizeof(BTNodeHeader) + sizeof(int) + sizeof(RecordId);
+    // the room for rids in a posting page
+    const static int CAPACITY = PageFile::PAGE_SIZE - PAGE_HEADER;
+    // the most rids a posting page holds, at a byte each
+    const static int MAX_PAGE_RIDS = CAPACITY;
+    // the most bytes a rid takes
+    const static int MAX_RID_SIZE = 10;
+};
+
+/**
+ * BTLeafNodeT: The class representing a B+tree leaf node, whose keys
+ * are of the type of the key-traits policy Traits (see KeyTraits.h).
+ *
+ *******************************************************************
+ * BTLeafNode page format                                          *
+ * ---------------------------------------------------------------------- *
+ * | header |  key  | ... |  ref  | ... | lists | listStart | listBytes |  *
+ * ---------------------------------------------------------------------- *
+ * |   16   |   k   | ... |   8   | ... |       |     4     |     4     |  *
+ * ---------------------------------------------------------------------- *
+ *******************************************************************
+ *
+ * A key takes k = sizeof(Key) bytes. The keys are stored together, ahead
+ * of their refs, so that a search only touches the keys and can compare
+ * several of them at once (see KeySearch). The refs follow the
+ * header.keyCount keys of the node, and the free space follows the refs.
+ *
+ * Each key is stored once, whatever the # of its rids, so the entries of
+ * a key are never split over two nodes. The ref of a key is a RecordId:
+ *   pid >= 0   the only rid of the key
+ *   pid == -1  the rids are a posting list in the node, at offset sid:
+ *              the # of rids and the # of bytes (an unsigned short each)
+ *              and the rids as BTPostingList::encode() stores them.
+ *              the lists grow down from listStart. listBytes is the
+ *              # of bytes of the lists in use, the rest being left by
+ *              lists that grew or moved to posting pages
+ *   pid < -1   the rids are in the BTPostingList from page -2 - pid on,
+ *              and sid is their #
+ * A list in the node grows up to MAX_INLINE_SIZE bytes, and moves to
+ * posting pages beyond that. The keys, refs and lists of a node take up
+ * to CAPACITY bytes, so the node holds as many keys with a single rid as
+ * in the page format without posting lists.
  */
 
-class BTLeafNode {
+template <class Traits>
+class BTLeafNodeT {
   public:
-    BTLeafNode();
+    typedef typename Traits::Key Key;
+    typedef IndexEntryT<Traits>  Entry;
+
+    BTLeafNodeT();
    /**
     * Insert the (key, rid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
+    * The rid joins the rids of the key if the node has the key already.
     * @param key[IN] the key to insert
     * @param rid[IN] the RecordId to insert
+    * @param pf[IN] PageFile of the posting pages of the node
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, const RecordId& rid);
+    RC insert(const Key& key, const RecordId& rid, PageFile& pf);
+
+   /**
+    * Append a key with its rids after the last entry of the node.
+    * The key must be larger than any key in the node.
+    * Used to fill nodes in key order when an index is bulk loaded.
+    * @param key[IN] the key to append
+    * @param rids[IN] the rids of the key, sorted. not read if posting >= 0
+    * @param count[IN] the # of rids
+    * @param posting[IN] the first page of the posting list of the rids
+    *    (see BTPostingList), or -1 to keep them in the node
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC append(const Key& key, const RecordId* rids, int count,
+              PageId posting = -1);
+
+    RC append(const Key& key, const RecordId& rid)
+      { return append(key, &rid, 1); }
+
+   /**
+    * Return the # of bytes a key with the rids takes in a node.
+    * @param rids[IN] the rids of the key, sorted
+    * @param count[IN] the # of rids
+    * @return the # of bytes. larger than MAX_INLINE_SIZE + ENTRY_SIZE if
+    *    the rids belong in posting pages
+    */
+    static int entrySize(const RecordId* rids, int count);
 
    /**
     * Insert the (key, rid) pair to the node
-    * and split the node half and half with sibling.
-    * The first key of the sibling node is returned in siblingKey.
+    * and split the node half and half, by bytes, with sibling.
+    * The key that separates the node from the sibling is returned in
+    * siblingKey: the first key of the sibling, cut short by
+    * Traits::separator().
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert.
     * @param rid[IN] the RecordId to insert.
     * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
-    * @param siblingKey[OUT] the first key in the sibling node after split.
+    * @param siblingKey[OUT] the key to insert into the parent node.
+    * @param pf[IN] PageFile of the posting pages of the node
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
+    RC insertAndSplit(const Key& key, const RecordId& rid, BTLeafNodeT& sibling,
+                      Key& siblingKey, PageFile& pf);
 
    /**
     * Find the index entry whose key value is larger than or equal to searchKey
@@ -70,16 +242,66 @@ class BTLeafNode {
     *                 than or equalty to searchKey.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC locate(int searchKey, int& eid);
+    RC locate(const Key& searchKey, int& eid);
 
    /**
-    * Read the (key, rid) pair from the eid entry.
+    * Count the rids of the keys smaller than searchKey
+    * (not larger than searchKey if inclusive).
+    * @param searchKey[IN] the key to count up to.
+    * @param inclusive[IN] true to count the rids of searchKey as well.
+    * @param count[OUT] the # of such rids.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC locateRank(const Key& searchKey, bool inclusive, int& count);
+
+   /**
+    * Read the key and its first rid from the eid entry.
     * @param eid[IN] the entry number to read the (key, rid) pair from
     * @param key[OUT] the key from the slot
-    * @param rid[OUT] the RecordId from the slot
+    * @param rid[OUT] the first RecordId of the key
+    * @return 0 if successful. Return an error code if there is an error.
+    *    RC_INVALID_ATTRIBUTE - also when the rids of the key are in
+    *    posting pages (see readEntries())
+    */
+    RC readEntry(int eid, Key& key, RecordId& rid);
+
+   /**
+    * Return the key of the eid entry.
+    * @param eid[IN] the entry number, from 0 to getKeyCount() - 1
+    * @return the key
+    */
+    const Key& getKey(int eid) { return keys()[eid]; }
+
+   /**
+    * Read the (key, rid) pairs of the eid entry, from the rid at
+    * (postingPid, pos) on. pos counts the rids of the list in the node,
+    * or of the posting page postingPid. Start a key at (-1, 0).
+    * (postingPid, pos) is moved past the rids read, and pos becomes -1
+    * once the last rid of the key is read.
+    * @param eid[IN] the entry number to read
+    * @param postingPid[IN/OUT] the posting page to read from, if any
+    * @param pos[IN/OUT] the rid to read from
+    * @param entries[OUT] the (key, rid) pairs read, in rid order
+    * @param maxCount[IN] the capacity of entries
+    * @param count[OUT] the number of pairs read
+    * @param pf[IN] PageFile of the posting pages of the node
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC readEntry(int eid, int& key, RecordId& rid);
+    RC readEntries(int eid, PageId& postingPid, int& pos, Entry* entries,
+                   int maxCount, int& count, const PageFile& pf);
+
+   /**
+    * Return the # of rids of the eid entry.
+    * @param eid[IN] the entry number
+    * @return the # of rids
+    */
+    int getRidCount(int eid);
+
+   /**
+    * Return the # of rids of the node, over all its keys.
+    * @return the # of rids
+    */
+    int getEntryCount();
 
    /**
     * Return the pid of the next slibling node.
@@ -95,17 +317,34 @@ class BTLeafNode {
     */
     RC setNextNodePtr(PageId pid);
 
+   /**
+    * Return the pid of the previous slibling node.
+    * @return the PageId of the previous sibling node
+    */
+    PageId getPrevNodePtr();
+
+   /**
+    * Set the previous slibling node PageId.
+    * @param pid[IN] the PageId of the previous sibling node
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setPrevNodePtr(PageId pid);
+
    /**
     * Return the number of keys stored in the node.
     * @return the number of keys in the node
     */
-    int getKeyCount();
+    int getKeyCount() { return header()->keyCount; }
  
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The node works on the page pinned in the buffer pool, so a node
+    * modified after read() has to be written back to the same pid.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
+    *    RC_INVALID_FILE_FORMAT - when the page is not a leaf node of
+    *    the current page format
     */
     RC read(PageId pid, const PageFile& pf);
     
@@ -119,33 +358,116 @@ class BTLeafNode {
 
     void printBuffer();
 
+    // the bytes of a key with a single rid
+    const static int ENTRY_SIZE = sizeof(Key) + sizeof(RecordId);
+    // the most keys with a single rid a node holds. a page has room for
+    // one more, as in the page format without posting lists
+    const static int MAX_LEAF_KEY_COUNT =
+      (PageFile::PAGE_SIZE - sizeof(BTNodeHeader)) / ENTRY_SIZE - 1;
+    // the bytes of keys, refs and lists a node holds
+    const static int CAPACITY = MAX_LEAF_KEY_COUNT * ENTRY_SIZE;
+    // the largest posting list kept in a node, its count and length
+    // included
+    const static int MAX_INLINE_SIZE = CAPACITY / 8;
+
  private:
-    RC _insert(int key, const RecordId& rid);
+    // a key with its ref and, for a list in the node, the list bytes
+    typedef struct {
+      Key         key;
+      RecordId    ref;
+      std::string list;
+    } Item;
+
+    static void makeList(Item& item, const RecordId* rids, int count);
+    static RC addRid(Item& item, const RecordId& rid, PageFile& pf);
+    static int readRids(const Item& item, RecordId* rids);
+    void getItem(int eid, Item& item);
+    void getItems(std::vector<Item>& items);
+    void setItems(const Item* items, int count);
+    void setItem(int eid, const Item& item);
+    void insertKey(int pos, const Key& key);
+    int allocate(int bytes);
+    void compact();
+    int usedSpace() { return getKeyCount() * ENTRY_SIZE + listBytes(); }
+    BTNodeHeader* header() { return (BTNodeHeader*) buffer; }
+    Key* keys() { return (Key*) (buffer + sizeof(BTNodeHeader)); }
+    RecordId* refs() { return (RecordId*) (keys() + getKeyCount()); }
+    unsigned short* list(int offset) { return (unsigned short*) (buffer + offset); }
+    int& listStart() { return *(int*) (buffer + LIST_END); }
+    int& listBytes() { return *(int*) (buffer + LIST_END + sizeof(int)); }
+    // the end of the lists, where listStart and listBytes are
+    const static int LIST_END = PageFile::PAGE_SIZE - 2 * sizeof(int);
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The content of the node. It points to the page pinned by handle
+    * after read(), and to the private page of the node otherwise.
     */
-    char buffer[PageFile::PAGE_SIZE];
-    const static int RECORD_ID_SIZE = sizeof(RecordId);
-    const static int MAX_LEAF_KEY_COUNT = 70;
+    char *buffer;
+    char page[PageFile::PAGE_SIZE];
+    PageHandle handle;
 }; 
 
+typedef BTLeafNodeT<IntKey> BTLeafNode;
+
 
 /**
- * BTNonLeafNode: The class representing a B+tree nonleaf node.
+ * BTNonLeafNodeT: The class representing a B+tree nonleaf node, whose
+ * keys are of the type of the key-traits policy Traits.
+ *
+ *******************************************************************
+ * BTNonLeafNode page format                                       *
+ * ----------------------------------------------------------      *
+ * | header |  key  |  key  | ... |  pid  |  pid  |  pid  | ...     *
+ * ----------------------------------------------------------      *
+ * |   16   |   k   |   k   | ... |   4   |   4   |   4   | ...     *
+ * ----------------------------------------------------------      *
+ *******************************************************************
+ *
+ * As in BTLeafNodeT, the keys are stored apart from the pids, with
+ * room for MAX_NONLEAF_KEY_COUNT + 1 keys and one pid more.
+ * A node with header.keyCount keys holds keyCount + 1 pids. The child
+ * pids[i + 1] holds the keys larger than or equal to keys[i].
+ *
+ * A counted node (header.flags has BTNODE_COUNTED) stores after the pids
+ * the number of index entries in the subtree of each pid:
+ *
+ * | header |  key  | ... |  pid  | ... | count | count | ...     *
+ *
+ * With the counts the node has room for MAX_COUNTED_KEY_COUNT keys only.
  */
-class BTNonLeafNode {
+template <class Traits>
+class BTNonLeafNodeT {
   public:
-    BTNonLeafNode();
+    typedef typename Traits::Key Key;
+
+   /**
+    * Create an empty node.
+    * @param counted[IN] true to keep the entry count of each subtree
+    */
+    BTNonLeafNodeT(bool counted = false);
 
    /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
+    * In a counted node, the count entries under pid are taken from the
+    * child in front of it, which was split into the two.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param count[IN] the # of entries under pid
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC insert(const Key& key, PageId pid, int count = 0);
+
+   /**
+    * Append the (key, pid) pair after the last pointer of the node.
+    * The node must hold at least one pointer (see initializeRoot())
+    * and the key must not be smaller than any key in the node.
+    * Used to fill nodes in key order when an index is bulk loaded.
+    * @param key[IN] the key to append
+    * @param pid[IN] the PageId to append
+    * @param count[IN] the # of entries under pid, for a counted node
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, PageId pid);
+    RC append(const Key& key, PageId pid, int count = 0);
 
    /**
     * Insert the (key, pid) pair to the node
@@ -157,9 +479,11 @@ class BTNonLeafNode {
     * @param pid[IN] the PageId to insert
     * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+    * @param count[IN] the # of entries under pid (see insert())
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(const Key& key, PageId pid, BTNonLeafNodeT& sibling,
+                      Key& midKey, int count = 0);
 
    /**
     * Given the searchKey, find the child-node pointer to follow and
@@ -169,28 +493,121 @@ class BTNonLeafNode {
     * @param pid[OUT] the pointer to the child node to follow.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC locateChildPtr(int searchKey, PageId& pid);
+    RC locateChildPtr(const Key& searchKey, PageId& pid);
+
+   /**
+    * Find the child-node pointer to follow for searchKey, as
+    * locateChildPtr() does, together with the pointers to the children
+    * right after it, as long as they may hold keys up to endKey.
+    * The pointers are output in key order, the one for searchKey first.
+    * @param searchKey[IN] the searchKey that is being looked up.
+    * @param endKey[IN] the largest key of interest.
+    * @param pids[OUT] the pointers to the child nodes.
+    * @param maxCount[IN] the capacity of pids.
+    * @param count[OUT] the number of pointers output in pids.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC locateChildPtrs(const Key& searchKey, const Key& endKey, PageId* pids,
+		       int maxCount, int& count);
+
+   /**
+    * Find the child-node pointer to follow to count the entries with
+    * keys smaller than searchKey (not larger than searchKey if inclusive),
+    * and the number of entries in the children in front of it.
+    * The node must be counted.
+    * @param searchKey[IN] the key to count up to.
+    * @param inclusive[IN] true to count the entries with searchKey as well.
+    * @param pid[OUT] the pointer to the child node to follow.
+    * @param count[OUT] the # of entries in the children before pid.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC locateChildRank(const Key& searchKey, bool inclusive, PageId& pid,
+                       int& count);
+
+   /**
+    * Count one more entry in the child for searchKey, the child
+    * locateChildPtr() returns. Does nothing in a node without counts.
+    * @param searchKey[IN] the key of the entry inserted under the child
+    */
+    void countInsert(const Key& searchKey);
 
    /**
     * Initialize the root node with (pid1, key, pid2).
     * @param pid1[IN] the first PageId to insert
     * @param key[IN] the key that should be inserted between the two PageIds
     * @param pid2[IN] the PageId to insert behind the key
+    * @param count1[IN] the # of entries under pid1, for a counted node
+    * @param count2[IN] the # of entries under pid2, for a counted node
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC initializeRoot(PageId pid1, int key, PageId pid2);
+    RC initializeRoot(PageId pid1, const Key& key, PageId pid2,
+                      int count1 = 0, int count2 = 0);
 
    /**
     * Return the number of keys stored in the node.
     * @return the number of keys in the node
     */
-    int getKeyCount();
+    int getKeyCount() { return header()->keyCount; }
+
+   /**
+    * Return the level of the node: 1 for the parents of leaf nodes,
+    * 2 for their parents, and so on.
+    * @return the level of the node
+    */
+    int getLevel() { return header()->level; }
+
+   /**
+    * Set the level of the node (see getLevel()).
+    * @param level[IN] the level of the node
+    */
+    void setLevel(int level) { header()->level = level; }
+
+   /**
+    * Return whether the node keeps the entry count of each subtree.
+    * @return true for a counted node
+    */
+    bool isCounted() { return header()->flags & BTNODE_COUNTED; }
+
+   /**
+    * Return the number of entries in the subtrees of the node.
+    * The node must be counted.
+    * @return the sum of the counts of the children
+    */
+    int getEntryCount();
+
+   /**
+    * Return the pid of the next node on the same level.
+    * @return the PageId of the next sibling node. -1 if none
+    */
+    PageId getNextNodePtr() { return header()->nextPid; }
+
+   /**
+    * Set the pid of the next node on the same level.
+    * @param pid[IN] the PageId of the next sibling node
+    */
+    void setNextNodePtr(PageId pid) { header()->nextPid = pid; }
+
+   /**
+    * Return the pid of the previous node on the same level.
+    * @return the PageId of the previous sibling node. -1 if none
+    */
+    PageId getPrevNodePtr() { return header()->prevPid; }
+
+   /**
+    * Set the pid of the previous node on the same level.
+    * @param pid[IN] the PageId of the previous sibling node
+    */
+    void setPrevNodePtr(PageId pid) { header()->prevPid = pid; }
 
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The node works on the page pinned in the buffer pool, so a node
+    * modified after read() has to be written back to the same pid.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
+    *    RC_INVALID_FILE_FORMAT - when the page is not a nonleaf node of
+    *    the current page format
     */
     RC read(PageId pid, const PageFile& pf);
     
@@ -205,18 +622,36 @@ class BTNonLeafNode {
     void printBuffer();
     void printBuffer(std::queue<PageId>&);
 
-    const static int KEY_SIZE = sizeof(int);
+    const static int KEY_SIZE = sizeof(Key);
     const static int PAGE_ID_SIZE = sizeof(PageId);
+    // the most keys that fit in a page with their pids, less the room
+    // insertAndSplit() needs for one more (key, pid) pair
+    const static int MAX_NONLEAF_KEY_COUNT =
+      (PageFile::PAGE_SIZE - sizeof(BTNodeHeader) - KEY_SIZE - 2 * PAGE_ID_SIZE) /
+      (KEY_SIZE + PAGE_ID_SIZE);
+    // the same for a counted node, whose pids take a count each
+    const static int MAX_COUNTED_KEY_COUNT =
+      (PageFile::PAGE_SIZE - sizeof(BTNodeHeader) - KEY_SIZE - 4 * PAGE_ID_SIZE) /
+      (KEY_SIZE + 2 * PAGE_ID_SIZE);
 
   private:
-    RC _insert(int key, PageId pid);
+    RC _insert(const Key& key, PageId pid, int count);
+    int maxKeyCount()
+      { return isCounted() ? MAX_COUNTED_KEY_COUNT : MAX_NONLEAF_KEY_COUNT; }
+    BTNodeHeader* header() { return (BTNodeHeader*) buffer; }
+    Key* keys() { return (Key*) (buffer + sizeof(BTNodeHeader)); }
+    PageId* pids() { return (PageId*) (keys() + maxKeyCount() + 1); }
+    int* counts() { return (int*) (pids() + maxKeyCount() + 2); }
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The content of the node. It points to the page pinned by handle
+    * after read(), and to the private page of the node otherwise.
     */
-    char buffer[PageFile::PAGE_SIZE];
-    const static int MAX_NONLEAF_KEY_COUNT = 70;
+    char *buffer;
+    char page[PageFile::PAGE_SIZE];
+    PageHandle handle;
 
 }; 
 
+typedef BTNonLeafNodeT<IntKey> BTNonLeafNode;
+
 #endif /* BTNODE_H */
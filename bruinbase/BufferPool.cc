@@ -0,0 +1,626 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "BufferPool.h"
+
+using std::pair;
+using std::vector;
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+int        BufferPool::frameCount = 0;
+int        BufferPool::shardCount = 0;
+BufferPool::Frame* BufferPool::frames = NULL;
+BufferPool::Shard* BufferPool::shards = NULL;
+char*      BufferPool::data = NULL;
+BufferPool::Policy BufferPool::policyType = BufferPool::CLOCK;
+bool       BufferPool::writeBack = true;
+pthread_mutex_t  BufferPool::fileLock = PTHREAD_MUTEX_INITIALIZER;
+BufferPool::File BufferPool::files[BufferPool::MAX_FILE_COUNT];
+int        BufferPool::hitCount = 0;
+int        BufferPool::missCount = 0;
+int        BufferPool::flushCount = 0;
+
+RC BufferPool::configure(int count, Policy type)
+{
+  if (count <= 0) return RC_INVALID_ATTRIBUTE;
+
+  // write out dirty pages and release the current pool.
+  // it is rebuilt lazily on the next access
+  RC rc = flushAll();
+  if (shards != NULL) {
+    for (int s = 0; s < shardCount; s++) {
+      pthread_mutex_destroy(&shards[s].lock);
+      pthread_cond_destroy(&shards[s].loaded);
+      delete shards[s].policy;
+      free(shards[s].buckets);
+    }
+  }
+  free(shards);
+  free(frames);
+  free(data);
+  shards = NULL;
+  frames = NULL;
+  data = NULL;
+
+  frameCount = count;
+  policyType = type;
+  return rc;
+}
+
+RC BufferPool::setWriteBack(bool on)
+{
+  RC rc = 0;
+
+  if (!on) rc = flushAll();
+  writeBack = on;
+  return rc;
+}
+
+int BufferPool::getFrameCount()
+{
+  return (frameCount > 0) ? frameCount : DEFAULT_FRAME_COUNT;
+}
+
+void BufferPool::init()
+{
+  if (frameCount <= 0) frameCount = DEFAULT_FRAME_COUNT;
+
+  // one shard per 64 frames, up to MAX_SHARD_COUNT shards
+  shardCount = frameCount / 64;
+  if (shardCount > MAX_SHARD_COUNT) shardCount = MAX_SHARD_COUNT;
+  if (shardCount < 1) shardCount = 1;
+
+  frames = (Frame*) malloc(sizeof(Frame) * frameCount);
+  shards = (Shard*) malloc(sizeof(Shard) * shardCount);
+  data   = (char*) malloc((size_t) frameCount * PageFile::PAGE_SIZE);
+
+  for (int i = 0; i < frameCount; i++) {
+    frames[i].file = -1;
+    frames[i].pid = -1;
+    frames[i].pinCount = 0;
+    frames[i].dirty = false;
+    frames[i].loading = false;
+  }
+
+  for (int s = 0; s < shardCount; s++) {
+    Shard& sh = shards[s];
+    sh.base = (int) ((long long) s * frameCount / shardCount);
+    sh.count = (int) ((long long) (s + 1) * frameCount / shardCount) - sh.base;
+
+    pthread_mutex_init(&sh.lock, NULL);
+    pthread_cond_init(&sh.loaded, NULL);
+
+    // all frames of the shard start on its free list
+    for (int i = sh.base; i < sh.base + sh.count; i++) frames[i].next = i + 1;
+    frames[sh.base + sh.count - 1].next = -1;
+    sh.freeHead = sh.base;
+    sh.loadingCount = 0;
+
+    // use about two buckets per frame to keep the chains short
+    sh.bucketCount = 2 * sh.count + 1;
+    sh.buckets = (int*) malloc(sizeof(int) * sh.bucketCount);
+    for (int i = 0; i < sh.bucketCount; i++) sh.buckets[i] = -1;
+
+    switch (policyType) {
+    case LRU_K:
+      sh.policy = new LRUKPolicy(sh.base, sh.count);
+      break;
+    default:
+      sh.policy = new ClockPolicy(sh.base, sh.count);
+      break;
+    }
+  }
+}
+
+BufferPool::Shard& BufferPool::shardOf(int file, PageId pid)
+{
+  unsigned int h = (unsigned int) file * 2654435761u ^
+                   (unsigned int) (pid / SHARD_EXTENT) * 40503u;
+  return shards[h % (unsigned int) shardCount];
+}
+
+BufferPool::Shard& BufferPool::shardOfFrame(int frame)
+{
+  int s = (int) ((long long) frame * shardCount / frameCount);
+
+  // the shard sizes differ by at most one frame, so the guess is close
+  while (frame < shards[s].base) s--;
+  while (frame >= shards[s].base + shards[s].count) s++;
+  return shards[s];
+}
+
+int BufferPool::hash(const Shard& s, int file, PageId pid)
+{
+  unsigned int h = (unsigned int) file * 2654435761u ^ (unsigned int) pid * 40503u;
+  return (int) (h % (unsigned int) s.bucketCount);
+}
+
+int BufferPool::find(Shard& s, int file, PageId pid)
+{
+  for (int i = s.buckets[hash(s, file, pid)]; i >= 0; i = frames[i].next) {
+    if (frames[i].file == file && frames[i].pid == pid) return i;
+  }
+  return -1;
+}
+
+void BufferPool::unlink(Shard& s, int frame)
+{
+  int* link = &s.buckets[hash(s, frames[frame].file, frames[frame].pid)];
+
+  // remove the frame from its hash chain
+  while (*link != frame) link = &frames[*link].next;
+  *link = frames[frame].next;
+
+  // and put it on the free list. a pinned frame goes there
+  // when its last pin is released
+  s.policy->remove(frame);
+  frames[frame].dirty = false;
+  frames[frame].file = -1;
+  frames[frame].pid = -1;
+  frames[frame].next = -1;
+  if (frames[frame].pinCount == 0) {
+    frames[frame].next = s.freeHead;
+    s.freeHead = frame;
+  }
+}
+
+void BufferPool::release(Shard& s, int frame)
+{
+  if (--frames[frame].pinCount > 0) return;
+
+  // a frame detached while pinned is freed now
+  if (frames[frame].file < 0) {
+    frames[frame].next = s.freeHead;
+    s.freeHead = frame;
+  }
+}
+
+bool BufferPool::isEvictable(int frame)
+{
+  return frames[frame].file >= 0 && frames[frame].pinCount == 0;
+}
+
+int BufferPool::assign(Shard& s, int file, PageId pid)
+{
+  // take a free frame, evicting a page if there is none.
+  // a dirty victim is written out (with its dirty neighbors) first
+  if (s.freeHead < 0) {
+    int v = s.policy->victim();
+    if (v < 0) return -1;
+    if (frames[v].dirty && flushFrame(s, v) < 0) return -1;
+    unlink(s, v);
+  }
+  int i = s.freeHead;
+  s.freeHead = frames[i].next;
+
+  // link the frame into its hash chain
+  int b = hash(s, file, pid);
+  frames[i].file = file;
+  frames[i].pid = pid;
+  frames[i].next = s.buckets[b];
+  frames[i].pinCount = 0;
+  frames[i].dirty = false;
+  frames[i].loading = false;
+  s.buckets[b] = i;
+
+  return i;
+}
+
+int BufferPool::pinFrame(int file, PageId pid, bool forWrite, bool& cached)
+{
+  Shard& s = shardOf(file, pid);
+  int i;
+
+  pthread_mutex_lock(&s.lock);
+
+  while ((i = find(s, file, pid)) >= 0 && frames[i].loading) {
+    // another thread is reading the page. wait for it with a pin
+    // on the frame, so that it is not reused, and look it up again
+    frames[i].pinCount++;
+    while (frames[i].loading) pthread_cond_wait(&s.loaded, &s.lock);
+    release(s, i);
+  }
+
+  cached = (i >= 0);
+  if (!cached) {
+    if ((i = assign(s, file, pid)) < 0) {
+      pthread_mutex_unlock(&s.lock);
+      return -1;
+    }
+    // the page is not valid until the caller fills the frame
+    frames[i].loading = true;
+    s.loadingCount++;
+  }
+  frames[i].pinCount++;
+  s.policy->touch(i);
+
+  pthread_mutex_unlock(&s.lock);
+
+  if (!forWrite) __sync_fetch_and_add(cached ? &hitCount : &missCount, 1);
+  return i;
+}
+
+int BufferPool::pin(int file, PageId pid, bool& cached)
+{
+  return pinFrame(file, pid, false, cached);
+}
+
+int BufferPool::pinForWrite(int file, PageId pid)
+{
+  bool cached;
+  int i = pinFrame(file, pid, true, cached);
+
+  // the caller overwrites the whole page, so there is nothing to load
+  if (i >= 0 && !cached) loaded(i);
+  return i;
+}
+
+int BufferPool::reserve(int file, PageId pid)
+{
+  Shard& s = shardOf(file, pid);
+  int i;
+
+  pthread_mutex_lock(&s.lock);
+
+  if (s.loadingCount >= s.count / 4 || find(s, file, pid) >= 0 ||
+      (i = assign(s, file, pid)) < 0) {
+    pthread_mutex_unlock(&s.lock);
+    return -1;
+  }
+  frames[i].loading = true;
+  s.loadingCount++;
+  frames[i].pinCount++;
+  s.policy->touch(i);
+
+  pthread_mutex_unlock(&s.lock);
+
+  __sync_fetch_and_add(&missCount, 1);
+  return i;
+}
+
+void BufferPool::loaded(int frame)
+{
+  Shard& s = shardOfFrame(frame);
+
+  pthread_mutex_lock(&s.lock);
+  if (frames[frame].loading) {
+    frames[frame].loading = false;
+    s.loadingCount--;
+  }
+  pthread_cond_broadcast(&s.loaded);
+  pthread_mutex_unlock(&s.lock);
+}
+
+void BufferPool::unpin(int frame)
+{
+  Shard& s = shardOfFrame(frame);
+
+  pthread_mutex_lock(&s.lock);
+  release(s, frame);
+  pthread_mutex_unlock(&s.lock);
+}
+
+void BufferPool::discard(int frame)
+{
+  Shard& s = shardOfFrame(frame);
+
+  pthread_mutex_lock(&s.lock);
+  if (frames[frame].file >= 0) unlink(s, frame);
+  release(s, frame);
+
+  // wake up the threads waiting for the page. they will find it missing
+  if (frames[frame].loading) {
+    frames[frame].loading = false;
+    s.loadingCount--;
+  }
+  pthread_cond_broadcast(&s.loaded);
+  pthread_mutex_unlock(&s.lock);
+}
+
+void BufferPool::markDirty(int frame)
+{
+  Shard& s = shardOfFrame(frame);
+
+  pthread_mutex_lock(&s.lock);
+  frames[frame].dirty = true;
+  pthread_mutex_unlock(&s.lock);
+}
+
+int BufferPool::openFile(int fd, bool writable)
+{
+  struct stat st;
+  int id = -1;
+
+  if (::fstat(fd, &st) < 0) return -1;
+
+  pthread_mutex_lock(&fileLock);
+
+  if (frames == NULL) init();
+
+  // share the entry of a file that is already open
+  for (int i = 0; i < MAX_FILE_COUNT; i++) {
+    if (files[i].refs > 0 && files[i].dev == st.st_dev && files[i].ino == st.st_ino) {
+      id = i;
+      break;
+    }
+  }
+
+  if (id >= 0) {
+    // keep a writable descriptor once the file is opened for writing
+    if (writable && !files[id].writable) {
+      int wfd = ::dup(fd);
+      if (wfd < 0) {
+        id = -1;
+      } else {
+        ::close(files[id].fd);
+        files[id].fd = wfd;
+        files[id].writable = true;
+      }
+    }
+  } else {
+    for (int i = 0; i < MAX_FILE_COUNT; i++) {
+      if (files[i].refs == 0) {
+        id = i;
+        break;
+      }
+    }
+    if (id >= 0 && (files[id].fd = ::dup(fd)) >= 0) {
+      files[id].dev = st.st_dev;
+      files[id].ino = st.st_ino;
+      files[id].writable = writable;
+    } else {
+      id = -1;
+    }
+  }
+  if (id >= 0) files[id].refs++;
+
+  pthread_mutex_unlock(&fileLock);
+  return id;
+}
+
+RC BufferPool::closeFile(int file)
+{
+  RC rc = 0;
+
+  pthread_mutex_lock(&fileLock);
+
+  // the last close writes the dirty pages and drops the cached ones
+  if (--files[file].refs == 0) {
+    rc = flushFile(file);
+    dropFile(file);
+    ::close(files[file].fd);
+    files[file].fd = -1;
+  }
+
+  pthread_mutex_unlock(&fileLock);
+  return rc;
+}
+
+void BufferPool::dropFile(int file)
+{
+  for (int s = 0; s < shardCount; s++) {
+    Shard& sh = shards[s];
+
+    pthread_mutex_lock(&sh.lock);
+    for (int i = sh.base; i < sh.base + sh.count; i++) {
+      if (frames[i].file == file) unlink(sh, i);
+    }
+    pthread_mutex_unlock(&sh.lock);
+  }
+}
+
+RC BufferPool::flushRun(int file, const int* run, int n)
+{
+  struct iovec iov[IOV_MAX];
+  PageId pid = frames[run[0]].pid;
+
+  // run[] holds the frames of n dirty pages with consecutive page ids
+  for (int i = 0; i < n; i++) {
+    iov[i].iov_base = frameData(run[i]);
+    iov[i].iov_len = PageFile::PAGE_SIZE;
+  }
+
+  ssize_t len = (ssize_t) n * PageFile::PAGE_SIZE;
+  if (::pwritev(files[file].fd, iov, n, (off_t) pid * PageFile::PAGE_SIZE) != len) {
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  __sync_fetch_and_add(&flushCount, n);
+  return 0;
+}
+
+RC BufferPool::flushFrame(Shard& s, int frame)
+{
+  int file = frames[frame].file;
+  PageId first = frames[frame].pid;
+  PageId last = first;
+  PageId extent = first / SHARD_EXTENT;
+  int run[SHARD_EXTENT] = { frame };  // the run holds the frame at least
+  int i, n = 0;
+
+  // extend the run to the dirty pages right before and after the page.
+  // the pages of the same extent are all in this shard
+  while (first % SHARD_EXTENT > 0 &&
+         (i = find(s, file, first - 1)) >= 0 && frames[i].dirty) first--;
+  while ((last + 1) / SHARD_EXTENT == extent &&
+         (i = find(s, file, last + 1)) >= 0 && frames[i].dirty) last++;
+
+  for (PageId pid = first; pid <= last; pid++) run[n++] = find(s, file, pid);
+  if (flushRun(file, run, n) < 0) return RC_FILE_WRITE_FAILED;
+
+  for (i = 0; i < n; i++) frames[run[i]].dirty = false;
+  return 0;
+}
+
+RC BufferPool::flushFile(int file)
+{
+  vector< pair<PageId, int> > dirty;
+  int run[IOV_MAX];
+  RC rc = 0;
+
+  if (frames == NULL) return 0;
+
+  // collect the dirty pages of the file. they are pinned so that they
+  // stay in place while they are written outside of the shard locks
+  for (int s = 0; s < shardCount; s++) {
+    Shard& sh = shards[s];
+
+    pthread_mutex_lock(&sh.lock);
+    for (int i = sh.base; i < sh.base + sh.count; i++) {
+      if (frames[i].file == file && frames[i].dirty) {
+        frames[i].dirty = false;
+        frames[i].pinCount++;
+        dirty.push_back(pair<PageId, int>(frames[i].pid, i));
+      }
+    }
+    pthread_mutex_unlock(&sh.lock);
+  }
+  std::sort(dirty.begin(), dirty.end());
+
+  // write each run of consecutive pages with one system call
+  for (unsigned j = 0; j < dirty.size(); ) {
+    int n = 0;
+    do {
+      run[n++] = dirty[j++].second;
+    } while (j < dirty.size() && n < IOV_MAX &&
+             dirty[j].first == dirty[j-1].first + 1);
+
+    if (flushRun(file, run, n) < 0) {
+      // the pages have to be written again later
+      for (int k = 0; k < n; k++) markDirty(run[k]);
+      rc = RC_FILE_WRITE_FAILED;
+    }
+  }
+
+  for (unsigned j = 0; j < dirty.size(); j++) unpin(dirty[j].second);
+  return rc;
+}
+
+RC BufferPool::flushAll()
+{
+  RC rc = 0;
+
+  pthread_mutex_lock(&fileLock);
+  for (int i = 0; i < MAX_FILE_COUNT; i++) {
+    if (files[i].refs > 0 && flushFile(i) < 0) rc = RC_FILE_WRITE_FAILED;
+  }
+  pthread_mutex_unlock(&fileLock);
+
+  return rc;
+}
+
+
+//
+// CLOCK replacement
+//
+
+ClockPolicy::ClockPolicy(int first, int frameCount)
+{
+  base = first;
+  count = frameCount;
+  hand = 0;
+  ref = (char*) calloc(count, 1);
+}
+
+ClockPolicy::~ClockPolicy()
+{
+  free(ref);
+}
+
+void ClockPolicy::touch(int frame)
+{
+  ref[frame - base] = 1;
+}
+
+void ClockPolicy::remove(int frame)
+{
+  ref[frame - base] = 0;
+}
+
+int ClockPolicy::victim()
+{
+  // two full sweeps clear every reference bit, so a third one
+  // only happens when no frame is evictable at all
+  for (int n = 0; n < 3 * count; n++) {
+    int i = hand;
+    hand = (hand + 1) % count;
+
+    if (!BufferPool::isEvictable(base + i)) continue;
+    if (ref[i]) {
+      ref[i] = 0;
+      continue;
+    }
+    return base + i;
+  }
+  return -1;
+}
+
+
+//
+// LRU-K replacement
+//
+
+LRUKPolicy::LRUKPolicy(int first, int frameCount)
+{
+  base = first;
+  count = frameCount;
+  clock = 0;
+  history = (unsigned int*) calloc((size_t) count * K, sizeof(unsigned int));
+}
+
+LRUKPolicy::~LRUKPolicy()
+{
+  free(history);
+}
+
+void LRUKPolicy::touch(int frame)
+{
+  unsigned int* h = history + (size_t) (frame - base) * K;
+
+  // shift the older accesses back and record this one
+  memmove(h + 1, h, (K - 1) * sizeof(unsigned int));
+  h[0] = ++clock;
+}
+
+void LRUKPolicy::remove(int frame)
+{
+  memset(history + (size_t) (frame - base) * K, 0, K * sizeof(unsigned int));
+}
+
+int LRUKPolicy::victim()
+{
+  int best = -1;
+  unsigned int bestK = 0, bestLast = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (!BufferPool::isEvictable(base + i)) continue;
+
+    unsigned int* h = history + (size_t) i * K;
+    unsigned int kth = h[K - 1];   // 0 if accessed less than K times
+    unsigned int last = h[0];
+
+    // the oldest K-th access wins. ties (e.g., among frames with
+    // fewer than K accesses) are broken by the oldest last access
+    if (best < 0 || kth < bestK || (kth == bestK && last < bestLast)) {
+      best = base + i;
+      bestK = kth;
+      bestLast = last;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+class ReplacementPolicy;
+
+/**
+ * The buffer pool shared by every PageFile in the process.
+ * The pool holds a fixed number of page frames. A frame is identified by
+ * the (file, pid) pair of the page it caches and is looked up through a
+ * hash table. When the pool is full, the configured ReplacementPolicy
+ * picks the frame to evict.
+ *
+ * Files are registered with openFile(), which identifies them by their
+ * device and inode, so every PageFile opened on the same unix file
+ * shares the same cached pages.
+ *
+ * In write-back mode (the default), PageFile::write() only updates the
+ * frame and marks it dirty. Dirty pages are written to the file when they
+ * are evicted or when their file is flushed or closed. Runs of dirty pages
+ * with consecutive page ids are written together with a single pwritev().
+ *
+ * The pool is thread safe. Its frames are split into shards, each with
+ * its own lock, hash table and replacement policy. A page belongs to the
+ * shard of its extent (SHARD_EXTENT consecutive pages of a file), so
+ * a run of dirty pages can be flushed under a single lock. Disk reads
+ * of missing pages are done outside of the lock.
+ */
+class BufferPool {
+ public:
+  /**
+   * the eviction policies that can be plugged into the pool
+   */
+  enum Policy { CLOCK, LRU_K };
+
+  static const int DEFAULT_FRAME_COUNT = (16 << 20) / PageFile::PAGE_SIZE;  // 16MB
+  static const int MAX_SHARD_COUNT = 16;         // # of lock stripes
+  static const int SHARD_EXTENT = 32;            // pages per extent
+
+  /**
+   * set the size and the eviction policy of the pool.
+   * this should be called once at startup before any page is read
+   * and before any other thread is started.
+   * calling it again drops every cached page.
+   * @param frameCount[IN] the number of page frames in the pool
+   * @param policy[IN] the eviction policy
+   * @return error code. 0 if no error
+   */
+  static RC configure(int frameCount, Policy policy);
+
+  /**
+   * turn write-back caching on or off.
+   * turning it off writes out every dirty page first.
+   * @param on[IN] true for write-back, false for write-through
+   * @return error code. 0 if no error
+   */
+  static RC setWriteBack(bool on);
+
+  /**
+   * @return true if the pool is in write-back mode
+   */
+  static bool isWriteBack() { return writeBack; }
+
+  /**
+   * register an open unix file with the pool.
+   * @param fd[IN] the file descriptor of the file
+   * @param writable[IN] true if fd was opened for writing
+   * @return the id of the file in the pool. negative on error
+   */
+  static int openFile(int fd, bool writable);
+
+  /**
+   * unregister a file. when the last PageFile on the file closes it,
+   * its dirty pages are written and its cached pages are dropped.
+   * @param file[IN] the id returned by openFile()
+   * @return error code. 0 if no error
+   */
+  static RC closeFile(int file);
+
+  /**
+   * pin the page (file, pid) in the pool, assigning a frame to it (and
+   * evicting another page) if it is not cached yet. a pinned frame is
+   * never evicted until every pin on it is released by unpin().
+   * when the page was not cached, the content of the frame is undefined.
+   * the caller has to fill it and then call loaded() (or discard() on
+   * failure). other threads pinning the page wait until then.
+   * @param file[IN] the id of the file
+   * @param pid[IN] the page id
+   * @param cached[OUT] true if the page was already in the pool
+   * @return the pinned frame. -1 if no frame can be evicted
+   */
+  static int pin(int file, PageId pid, bool& cached);
+
+  /**
+   * pin the page (file, pid) to overwrite its whole content.
+   * unlike pin(), the access is not counted as a hit or a miss and
+   * the frame does not have to be loaded.
+   * @param file[IN] the id of the file
+   * @param pid[IN] the page id
+   * @return the pinned frame. -1 if no frame can be evicted
+   */
+  static int pinForWrite(int file, PageId pid);
+
+  /**
+   * pin a frame for the page (file, pid) only if the page is not cached
+   * and is not being loaded. the caller has to fill the frame and call
+   * loaded() (or discard()) as with pin(). used to read pages ahead.
+   * to leave frames for pin(), at most a quarter of the frames of a shard
+   * can be waiting for their page at the same time.
+   * @param file[IN] the id of the file
+   * @param pid[IN] the page id
+   * @return the pinned frame. -1 if the page is cached or no frame is free
+   */
+  static int reserve(int file, PageId pid);
+
+  /**
+   * note that a frame returned by pin() was filled with the page.
+   * @param frame[IN] the pinned frame
+   */
+  static void loaded(int frame);
+
+  /**
+   * release a pin obtained by pin() or pinForWrite().
+   * @param frame[IN] the pinned frame
+   */
+  static void unpin(int frame);
+
+  /**
+   * drop a pinned frame whose content could not be loaded.
+   * the pin is released as well.
+   * @param frame[IN] the pinned frame
+   */
+  static void discard(int frame);
+
+  /**
+   * note that the page in a pinned frame is newer than the disk page.
+   * @param frame[IN] the pinned frame
+   */
+  static void markDirty(int frame);
+
+  /**
+   * @param frame[IN] a frame returned by pin()
+   * @return the page buffer of the frame
+   */
+  static char* frameData(int frame)
+    { return data + (size_t) frame * PageFile::PAGE_SIZE; }
+
+  /**
+   * write every dirty page of a file in the order of page id.
+   * @param file[IN] the id of the file
+   * @return error code. 0 if no error
+   */
+  static RC flushFile(int file);
+
+  /**
+   * write every dirty page in the pool.
+   * @return error code. 0 if no error
+   */
+  static RC flushAll();
+
+  /**
+   * @return the # of lookups that found the page in the pool
+   */
+  static int getHitCount()  { return hitCount; }
+
+  /**
+   * @return the # of lookups that did not find the page in the pool
+   */
+  static int getMissCount() { return missCount; }
+
+  /**
+   * @return the # of dirty pages written to disk by the pool
+   */
+  static int getFlushCount() { return flushCount; }
+
+  /**
+   * @return the # of page frames in the pool
+   */
+  static int getFrameCount();
+
+  /**
+   * @return true if the frame may be chosen as an eviction victim.
+   * the caller must hold the lock of the shard of the frame
+   */
+  static bool isEvictable(int frame);
+
+ private:
+  /**
+   * the bookkeeping data of a page frame.
+   * the page content itself lives in BufferPool::data.
+   */
+  struct Frame {
+    int    file;     // id of the file of the cached page. -1 if free
+    PageId pid;      // page id of the cached page
+    int    next;     // next frame in the same hash bucket. -1 at the end
+    int    pinCount; // # of outstanding pins on the frame
+    bool   dirty;    // true if the page has to be written back
+    bool   loading;  // true while the page is read from the disk
+  };
+
+  /**
+   * a lock stripe of the pool. a shard owns the frames [base, base + count)
+   */
+  struct Shard {
+    pthread_mutex_t lock;     // protects everything in the shard
+    pthread_cond_t  loaded;   // signaled when a page load is finished
+    int   base;               // first frame of the shard
+    int   count;              // # of frames of the shard
+    int*  buckets;            // head frame of each hash bucket
+    int   bucketCount;        // # of hash buckets
+    int   freeHead;           // first free frame. -1 if the shard is full
+    int   loadingCount;       // # of frames whose page is being read
+    ReplacementPolicy* policy;
+  };
+
+  /**
+   * a unix file registered with the pool
+   */
+  struct File {
+    dev_t dev;        // device of the file
+    ino_t ino;        // inode of the file
+    int   fd;         // private descriptor used to write back dirty pages
+    bool  writable;   // true if fd is open for writing
+    int   refs;       // # of PageFiles that have the file open. 0 if unused
+  };
+
+  static void   init();
+  static Shard& shardOf(int file, PageId pid);
+  static Shard& shardOfFrame(int frame);
+  static int    hash(const Shard& s, int file, PageId pid);
+  static int    find(Shard& s, int file, PageId pid);
+  static int    assign(Shard& s, int file, PageId pid);
+  static int    pinFrame(int file, PageId pid, bool forWrite, bool& cached);
+  static void   release(Shard& s, int frame);
+  static void   unlink(Shard& s, int frame);
+  static RC     flushRun(int file, const int* run, int n);
+  static RC     flushFrame(Shard& s, int frame);
+  static void   dropFile(int file);
+
+  static int     frameCount;     // # of frames in the pool
+  static int     shardCount;     // # of shards
+  static Frame*  frames;         // frame descriptors
+  static Shard*  shards;         // the shards of the pool
+  static char*   data;           // frameCount * PAGE_SIZE bytes of page data
+  static Policy  policyType;
+  static bool    writeBack;      // true in write-back mode
+
+  static const int MAX_FILE_COUNT = 256;  // # of files open at the same time
+
+  static pthread_mutex_t fileLock;  // protects files and the pool setup
+  static File    files[MAX_FILE_COUNT]; // registered files, indexed by file id
+
+  static int hitCount;   // total # of pool hits
+  static int missCount;  // total # of pool misses
+  static int flushCount; // total # of dirty pages written
+};
+
+/**
+ * decides which frame to evict when a shard of the buffer pool is full.
+ * the pool reports every access to a frame through touch() and every
+ * freed frame through remove(), and asks for a victim when it needs one.
+ * a policy manages the frames [base, base + count) of one shard and is
+ * only called while the lock of the shard is held.
+ */
+class ReplacementPolicy {
+ public:
+  virtual ~ReplacementPolicy() {}
+
+  /**
+   * a frame was loaded with a page or the cached page was accessed.
+   * @param frame[IN] the accessed frame
+   */
+  virtual void touch(int frame) = 0;
+
+  /**
+   * a frame became free.
+   * @param frame[IN] the freed frame
+   */
+  virtual void remove(int frame) = 0;
+
+  /**
+   * pick the frame to evict among BufferPool::isEvictable() frames.
+   * @return the victim frame. -1 if no frame can be evicted
+   */
+  virtual int victim() = 0;
+};
+
+/**
+ * CLOCK (second chance) replacement.
+ * each frame has a reference bit that is set on access. the clock hand
+ * sweeps the frames, clearing the bits, and evicts the first frame whose
+ * bit is already clear.
+ */
+class ClockPolicy : public ReplacementPolicy {
+ public:
+  ClockPolicy(int base, int frameCount);
+  ~ClockPolicy();
+  void touch(int frame);
+  void remove(int frame);
+  int  victim();
+
+ private:
+  int   base;   // first frame managed by the policy
+  int   count;  // # of frames
+  int   hand;   // current position of the clock hand
+  char* ref;    // reference bit of each frame
+};
+
+/**
+ * LRU-K replacement (O'Neil et al., SIGMOD 1993).
+ * evicts the frame whose K-th most recent access is the oldest.
+ * frames with fewer than K accesses have an infinite backward K-distance
+ * and are evicted first, in LRU order among themselves.
+ */
+class LRUKPolicy : public ReplacementPolicy {
+ public:
+  static const int K = 2;
+
+  LRUKPolicy(int base, int frameCount);
+  ~LRUKPolicy();
+  void touch(int frame);
+  void remove(int frame);
+  int  victim();
+
+ private:
+  int           base;     // first frame managed by the policy
+  int           count;    // # of frames
+  unsigned int  clock;    // logical access time
+  unsigned int* history;  // last K access times of each frame, most recent first.
+                          //   0 means no access
+};
+
+#endif // BUFFERPOOL_H
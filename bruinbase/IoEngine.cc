@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <unistd.h>
+#include "IoEngine.h"
+
+int        IoEngine::threadCount = IoEngine::DEFAULT_THREAD_COUNT;
+bool       IoEngine::started = false;
+int        IoEngine::running = 0;
+IoRequest* IoEngine::queue[IoEngine::MAX_QUEUE_LENGTH];
+int        IoEngine::head = 0;
+int        IoEngine::length = 0;
+pthread_mutex_t IoEngine::lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  IoEngine::queued = PTHREAD_COND_INITIALIZER;
+pthread_cond_t  IoEngine::done = PTHREAD_COND_INITIALIZER;
+
+RC IoEngine::configure(int count)
+{
+  if (count <= 0 || started) return RC_INVALID_ATTRIBUTE;
+
+  threadCount = count;
+  return 0;
+}
+
+void IoEngine::start()
+{
+  pthread_t thread;
+
+  // the threads live until the process exits
+  for (int i = 0; i < threadCount; i++) {
+    if (pthread_create(&thread, NULL, run, NULL) == 0) {
+      pthread_detach(thread);
+      running++;
+    }
+  }
+  started = true;
+}
+
+RC IoEngine::submit(IoRequest* req)
+{
+  pthread_mutex_lock(&lock);
+
+  if (!started) start();
+
+  // a request nobody serves would be waited for forever
+  if (running == 0) {
+    pthread_mutex_unlock(&lock);
+    return RC_IO_NO_THREAD;
+  }
+
+  if (length == MAX_QUEUE_LENGTH) {
+    pthread_mutex_unlock(&lock);
+    return RC_IO_QUEUE_FULL;
+  }
+  queue[(head + length++) % MAX_QUEUE_LENGTH] = req;
+  if (req->pending != NULL) (*req->pending)++;
+  pthread_cond_signal(&queued);
+
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+void IoEngine::wait(int* pending)
+{
+  pthread_mutex_lock(&lock);
+  while (*pending > 0) pthread_cond_wait(&done, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+void* IoEngine::run(void*)
+{
+  for (;;) {
+    IoRequest* req;
+
+    pthread_mutex_lock(&lock);
+    while (length == 0) pthread_cond_wait(&queued, &lock);
+    req = queue[head];
+    head = (head + 1) % MAX_QUEUE_LENGTH;
+    length--;
+    pthread_mutex_unlock(&lock);
+
+    // req may be freed by done(), so keep the counter
+    int* pending = req->pending;
+    req->done(req, ::pread(req->fd, req->buffer, req->length, req->offset));
+
+    pthread_mutex_lock(&lock);
+    if (pending != NULL) (*pending)--;
+    pthread_cond_broadcast(&done);
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
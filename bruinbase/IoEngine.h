@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef IOENGINE_H
+#define IOENGINE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "Bruinbase.h"
+
+/**
+ * an asynchronous read submitted to the IoEngine
+ */
+struct IoRequest {
+  int    fd;        // the file to read from
+  char*  buffer;    // the buffer to read into
+  size_t length;    // # of bytes to read
+  off_t  offset;    // the file offset to read from
+  void*  arg;       // passed through to done()
+  int*   pending;   // decremented once done() returns. may be NULL
+
+  /**
+   * called by an I/O thread when the read is finished.
+   * @param req[IN] the finished request
+   * @param result[IN] the return value of pread()
+   */
+  void (*done)(IoRequest* req, ssize_t result);
+};
+
+/**
+ * runs page reads in the background so that the caller can keep
+ * working while the disk is busy. requests are served by a small pool
+ * of I/O threads from a bounded queue, in submission order.
+ * the threads are started at the first submit().
+ */
+class IoEngine {
+ public:
+  static const int DEFAULT_THREAD_COUNT = 4;    // # of I/O threads
+  static const int MAX_QUEUE_LENGTH = 256;      // # of queued requests
+
+  /**
+   * set the # of I/O threads.
+   * this should be called once at startup before any request is submitted.
+   * @param threadCount[IN] the # of I/O threads
+   * @return error code. 0 if no error
+   */
+  static RC configure(int threadCount);
+
+  /**
+   * queue a read. if req->pending is not NULL, it is incremented now
+   * and decremented after req->done() is called.
+   * @param req[IN] the request. it must stay valid until done() is called
+   * @return error code. 0 if no error. RC_IO_QUEUE_FULL if too many
+   *         requests are queued, and RC_IO_NO_THREAD if no I/O thread
+   *         could be started, in which cases done() is never called
+   */
+  static RC submit(IoRequest* req);
+
+  /**
+   * wait until the counter of pending requests drops to zero.
+   * @param pending[IN] the counter given to submit() as req->pending
+   */
+  static void wait(int* pending);
+
+ private:
+  static void  start();
+  static void* run(void* arg);
+
+  static int       threadCount;   // # of I/O threads
+  static bool      started;       // true once the threads are started
+  static int       running;       // # of I/O threads started
+  static IoRequest* queue[MAX_QUEUE_LENGTH];  // circular request queue
+  static int       head;          // next request to serve
+  static int       length;        // # of queued requests
+  static pthread_mutex_t lock;    // protects everything above
+  static pthread_cond_t  queued;  // signaled when a request is queued
+  static pthread_cond_t  done;    // signaled when a request is finished
+};
+
+#endif // IOENGINE_H
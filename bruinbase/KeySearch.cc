@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <climits>
+#include "KeySearch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KEYSEARCH_X86
+#include <immintrin.h>
+#endif
+
+const char*          KeySearch::name = "scalar";
+KeySearch::CountLess KeySearch::countLess = KeySearch::first;
+
+static int countLessScalar(const int* keys, int n, int key)
+{
+  int count = 0;
+
+  // no early exit, so the loop does not mispredict on the boundary
+  for (int i = 0; i < n; i++) {
+    count += (keys[i] < key);
+  }
+  return count;
+}
+
+#ifdef KEYSEARCH_X86
+__attribute__((target("sse2")))
+static int countLessSse2(const int* keys, int n, int key)
+{
+  __m128i k = _mm_set1_epi32(key);
+  int count = 0;
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (keys + i));
+    __m128i lt = _mm_cmpgt_epi32(k, v);
+    count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+  }
+  return count + countLessScalar(keys + i, n - i, key);
+}
+
+__attribute__((target("avx2")))
+static int countLessAvx2(const int* keys, int n, int key)
+{
+  __m256i k = _mm256_set1_epi32(key);
+  int count = 0;
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (keys + i));
+    __m256i lt = _mm256_cmpgt_epi32(k, v);
+    count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+  }
+  return count + countLessScalar(keys + i, n - i, key);
+}
+#endif
+
+KeySearch::CountLess KeySearch::pick()
+{
+#ifdef KEYSEARCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    name = "avx2";
+    return countLessAvx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    name = "sse2";
+    return countLessSse2;
+  }
+#endif
+  name = "scalar";
+  return countLessScalar;
+}
+
+// the kernel is picked at the first search, so that searches made
+// while static objects are constructed work as well
+int KeySearch::first(const int* keys, int n, int key)
+{
+  countLess = pick();
+  return countLess(keys, n, key);
+}
+
+int KeySearch::lowerBound(const int* keys, int n, int key)
+{
+  int low = 0, high = n;
+
+  // keys[0..low) < key <= keys[high..n)
+  while (high - low > WINDOW) {
+    int mid = (low + high) / 2;
+    if (keys[mid] < key) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low + countLess(keys + low, high - low, key);
+}
+
+int KeySearch::upperBound(const int* keys, int n, int key)
+{
+  if (key == INT_MAX) return n;
+  return lowerBound(keys, n, key + 1);
+}
+
+const char* KeySearch::kernelName()
+{
+  if (countLess == first) countLess = pick();
+  return name;
+}
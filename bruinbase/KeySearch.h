@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+/**
+ * searches a sorted array of int keys, as stored in a B+tree node.
+ * a binary search narrows the range down to WINDOW keys, and the keys
+ * smaller than the search key are counted in the remaining window with
+ * SIMD comparisons. the vector kernel is picked at startup from what the
+ * CPU supports (AVX2, SSE2, or plain C++ on other machines).
+ */
+class KeySearch {
+ public:
+  static const int WINDOW = 32;  // # of keys the vector kernel compares
+
+  /**
+   * @param keys[IN] the keys, sorted in ascending order
+   * @param n[IN] the # of keys
+   * @param key[IN] the key to search for
+   * @return the index of the first key larger than or equal to key.
+   *         n if there is none
+   */
+  static int lowerBound(const int* keys, int n, int key);
+
+  /**
+   * @param keys[IN] the keys, sorted in ascending order
+   * @param n[IN] the # of keys
+   * @param key[IN] the key to search for
+   * @return the index of the first key larger than key.
+   *         n if there is none
+   */
+  static int upperBound(const int* keys, int n, int key);
+
+  /**
+   * @return the name of the kernel in use: "avx2", "sse2" or "scalar"
+   */
+  static const char* kernelName();
+
+ private:
+  typedef int (*CountLess)(const int* keys, int n, int key);
+
+  static CountLess pick();
+  static int first(const int* keys, int n, int key);
+
+  static CountLess   countLess;  // # of keys in keys[0..n) smaller than key
+  static const char* name;       // the name of countLess
+};
+
+#endif // KEYSEARCH_H
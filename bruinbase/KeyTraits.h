@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef KEYTRAITS_H
+#define KEYTRAITS_H
+
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <ostream>
+#include "KeySearch.h"
+
+/**
+ * the key-traits policies a B+tree is instantiated with
+ * (see BTLeafNodeT, BTNonLeafNodeT and BTreeIndexT).
+ * a policy gives
+ *   Key           the key type. the nodes store it as is, sizeof(Key)
+ *                 bytes per key, so it must be a plain struct or number
+ *   TYPE_ID       the id of the key type in the index metadata, so an
+ *                 index is opened with the key type it was built with
+ *   less()        the order of the keys
+ *   minKey(), maxKey()
+ *                 the smallest and the largest key
+ *   lowerBound(), upperBound()
+ *                 the searches of the sorted keys of a node
+ *   separator()   the prefix compression hook: the shortest key that
+ *                 tells two neighbor nodes apart, which the parent node
+ *                 takes instead of the whole first key of the right node
+ *   print()       prints a key, for printTree()
+ */
+
+/**
+ * 32-bit int keys, searched with the SIMD kernels of KeySearch.
+ */
+struct IntKey {
+  typedef int Key;
+  static const int TYPE_ID = 1;
+
+  static bool less(Key k1, Key k2) { return k1 < k2; }
+  static Key minKey() { return INT_MIN; }
+  static Key maxKey() { return INT_MAX; }
+
+  static int lowerBound(const Key* keys, int n, Key key)
+    { return KeySearch::lowerBound(keys, n, key); }
+  static int upperBound(const Key* keys, int n, Key key)
+    { return KeySearch::upperBound(keys, n, key); }
+
+  // an int is as short as it gets
+  static Key separator(Key /*left*/, Key right) { return right; }
+
+  static void print(std::ostream& os, Key key) { os << key; }
+};
+
+/**
+ * 64-bit int keys, for the identifiers that do not fit in an int.
+ */
+struct Int64Key {
+  typedef long long Key;
+  static const int TYPE_ID = 2;
+
+  static bool less(Key k1, Key k2) { return k1 < k2; }
+  static Key minKey() { return LLONG_MIN; }
+  static Key maxKey() { return LLONG_MAX; }
+
+  static int lowerBound(const Key* keys, int n, Key key)
+    { return std::lower_bound(keys, keys + n, key) - keys; }
+  static int upperBound(const Key* keys, int n, Key key)
+    { return std::upper_bound(keys, keys + n, key) - keys; }
+
+  static Key separator(Key /*left*/, Key right) { return right; }
+
+  static void print(std::ostream& os, Key key) { os << key; }
+};
+
+/**
+ * a string of N bytes, padded with NULs. the bytes compare as unsigned
+ * chars, as strcmp() does. N should be a multiple of 4, so that the
+ * rids and the pids after the keys of a node stay aligned.
+ */
+template <int N>
+struct FixedString {
+  char bytes[N];
+
+  // the string of the first N bytes of s
+  static FixedString make(const char* s) {
+    FixedString key;
+    strncpy(key.bytes, s, N);
+    return key;
+  }
+};
+
+/**
+ * fixed-width string keys of N bytes. longer strings are indexed by
+ * their first N bytes.
+ */
+template <int N>
+struct FixedStringKey {
+  typedef FixedString<N> Key;
+  static const int TYPE_ID = 0x100 + N;
+
+  static bool less(const Key& k1, const Key& k2)
+    { return memcmp(k1.bytes, k2.bytes, N) < 0; }
+  static Key minKey() { Key key; memset(key.bytes, 0, N); return key; }
+  static Key maxKey() { Key key; memset(key.bytes, 0xff, N); return key; }
+
+  static int lowerBound(const Key* keys, int n, const Key& key)
+    { return std::lower_bound(keys, keys + n, key, less) - keys; }
+  static int upperBound(const Key* keys, int n, const Key& key)
+    { return std::upper_bound(keys, keys + n, key, less) - keys; }
+
+  // right cut after the first byte that differs from left, the rest
+  // NULs. a node with room for shorter keys takes the prefix alone
+  static Key separator(const Key& left, const Key& right) {
+    Key key;
+    int i = 0;
+
+    if (!less(left, right)) {
+      return right;
+    }
+    while (left.bytes[i] == right.bytes[i]) {
+      i++;
+    }
+    memcpy(key.bytes, right.bytes, i + 1);
+    memset(key.bytes + i + 1, 0, N - i - 1);
+    return key;
+  }
+
+  static void print(std::ostream& os, const Key& key)
+    { os.write(key.bytes, strnlen(key.bytes, N)); }
+};
+
+/**
+ * the key of PairKey: a key of First followed by a key of Second.
+ */
+template <class First, class Second>
+struct KeyPair {
+  typename First::Key  first;
+  typename Second::Key second;
+
+  static KeyPair make(const typename First::Key& first,
+                      const typename Second::Key& second) {
+    KeyPair key;
+    key.first = first;
+    key.second = second;
+    return key;
+  }
+};
+
+/**
+ * composite keys of two key types, e.g. PairKey<IntKey, IntKey>.
+ * the keys are in lexicographic order: by the first part, then by the
+ * second. a search on the first part alone starts at
+ * (first, Second::minKey()).
+ */
+template <class First, class Second>
+struct PairKey {
+  typedef KeyPair<First, Second> Key;
+  static const int TYPE_ID = 0x10000 * First::TYPE_ID + Second::TYPE_ID;
+
+  static bool less(const Key& k1, const Key& k2) {
+    if (First::less(k1.first, k2.first)) return true;
+    if (First::less(k2.first, k1.first)) return false;
+    return Second::less(k1.second, k2.second);
+  }
+  static Key minKey() { return Key::make(First::minKey(), Second::minKey()); }
+  static Key maxKey() { return Key::make(First::maxKey(), Second::maxKey()); }
+
+  static int lowerBound(const Key* keys, int n, const Key& key)
+    { return std::lower_bound(keys, keys + n, key, less) - keys; }
+  static int upperBound(const Key* keys, int n, const Key& key)
+    { return std::upper_bound(keys, keys + n, key, less) - keys; }
+
+  // the separator of the first parts, with the smallest second part, if
+  // they differ. otherwise the separator of the second parts
+  static Key separator(const Key& left, const Key& right) {
+    if (!less(left, right)) {
+      return right;
+    }
+    if (First::less(left.first, right.first)) {
+      return Key::make(First::separator(left.first, right.first),
+                       Second::minKey());
+    }
+    return Key::make(right.first, Second::separator(left.second, right.second));
+  }
+
+  static void print(std::ostream& os, const Key& key) {
+    os << '(';
+    First::print(os, key.first);
+    os << ", ";
+    Second::print(os, key.second);
+    os << ')';
+  }
+};
+
+#endif // KEYTRAITS_H
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include "LoadPipeline.h"
+
+using std::string;
+using std::vector;
+
+LoadPipeline::LoadPipeline()
+{
+  map = NULL;
+  size = pos = 0;
+  nextChunk = nextOut = 0;
+  stopping = false;
+  threadCount = 0;
+  byteCount = 0;
+  parserCount = 0;
+  badLines = 0;
+  parseTime = waitTime = 0;
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&parsed, NULL);
+  pthread_cond_init(&taken, NULL);
+}
+
+LoadPipeline::~LoadPipeline()
+{
+  close();
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&parsed);
+  pthread_cond_destroy(&taken);
+}
+
+RC LoadPipeline::open(const string& filename, int count)
+{
+  struct stat statbuf;
+  int fd;
+
+  if (map != NULL || threadCount > 0) return RC_FILE_OPEN_FAILED;
+  if (count <= 0 || count > MAX_THREAD_COUNT) return RC_INVALID_ATTRIBUTE;
+
+  if ((fd = ::open(filename.c_str(), O_RDONLY)) < 0) return RC_FILE_OPEN_FAILED;
+  if (::fstat(fd, &statbuf) < 0) {
+    ::close(fd);
+    return RC_FILE_OPEN_FAILED;
+  }
+
+  // an empty file has nothing to map, and next() ends at once
+  size = statbuf.st_size;
+  if (size > 0) {
+    map = (char*) ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      map = NULL;
+      size = 0;
+      ::close(fd);
+      return RC_FILE_OPEN_FAILED;
+    }
+    ::madvise(map, size, MADV_SEQUENTIAL);
+  }
+  ::close(fd);
+
+  byteCount = size;
+  pos = 0;
+  nextChunk = nextOut = 0;
+  stopping = false;
+  badLines = 0;
+  parseTime = waitTime = 0;
+  for (int i = 0; i < MAX_CHUNKS; i++) {
+    chunks[i].ready = false;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (pthread_create(&threads[threadCount], NULL, run, this) == 0) {
+      threadCount++;
+    }
+  }
+  if (threadCount == 0) {
+    close();
+    return RC_FILE_OPEN_FAILED;
+  }
+  parserCount = threadCount;
+  return 0;
+}
+
+RC LoadPipeline::next(vector<LoadTuple>& tuples)
+{
+  double start = now();
+  Chunk* chunk;
+
+  pthread_mutex_lock(&lock);
+
+  // wait until the next chunk is parsed or there is none left
+  for (;;) {
+    chunk = &chunks[nextOut % MAX_CHUNKS];
+    if (chunk->ready) break;
+    if (pos >= size && nextOut == nextChunk) {
+      pthread_mutex_unlock(&lock);
+      return RC_END_OF_FILE;
+    }
+    pthread_cond_wait(&parsed, &lock);
+  }
+  tuples.swap(chunk->tuples);
+  chunk->tuples.clear();
+  chunk->ready = false;
+  badLines += chunk->badLines;
+  nextOut++;
+  waitTime += now() - start;
+  pthread_cond_broadcast(&taken);
+
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+RC LoadPipeline::close()
+{
+  // stop the parsers, which are waiting for room or parsing a chunk
+  pthread_mutex_lock(&lock);
+  stopping = true;
+  pthread_cond_broadcast(&taken);
+  pthread_mutex_unlock(&lock);
+
+  for (int i = 0; i < threadCount; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  threadCount = 0;
+
+  for (int i = 0; i < MAX_CHUNKS; i++) {
+    vector<LoadTuple>().swap(chunks[i].tuples);
+    chunks[i].ready = false;
+  }
+  if (map != NULL) {
+    ::munmap(map, size);
+    map = NULL;
+  }
+  size = pos = 0;
+  return 0;
+}
+
+double LoadPipeline::now()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void* LoadPipeline::run(void* arg)
+{
+  LoadPipeline* lp = (LoadPipeline*) arg;
+  const char *begin, *end, *nl;
+  Chunk chunk;
+  int id;
+
+  pthread_mutex_lock(&lp->lock);
+  for (;;) {
+    // wait for room to parse another chunk ahead of next()
+    while (!lp->stopping && lp->pos < lp->size &&
+           lp->nextChunk - lp->nextOut >= MAX_CHUNKS) {
+      pthread_cond_wait(&lp->taken, &lp->lock);
+    }
+    if (lp->stopping || lp->pos >= lp->size) break;
+
+    // take the next chunk. it ends after the first newline CHUNK_SIZE
+    // bytes in, or at the end of the file
+    begin = lp->map + lp->pos;
+    end = lp->map + lp->size;
+    if (end - begin > CHUNK_SIZE &&
+        (nl = (const char*) memchr(begin + CHUNK_SIZE, '\n',
+                                   end - begin - CHUNK_SIZE)) != NULL) {
+      end = nl + 1;
+    }
+    lp->pos = end - lp->map;
+    id = lp->nextChunk++;
+    pthread_mutex_unlock(&lp->lock);
+
+    // read the chunk after this one in the background
+    if (lp->pos < lp->size) {
+      long long ahead = lp->pos & ~((long long) sysconf(_SC_PAGESIZE) - 1);
+      ::madvise(lp->map + ahead,
+                std::min((long long) CHUNK_SIZE, lp->size - ahead),
+                MADV_WILLNEED);
+    }
+
+    double start = now();
+    lp->parse(begin, end, chunk);
+    double elapsed = now() - start;
+
+    pthread_mutex_lock(&lp->lock);
+    Chunk& slot = lp->chunks[id % MAX_CHUNKS];
+    slot.tuples.swap(chunk.tuples);
+    slot.badLines = chunk.badLines;
+    slot.ready = true;
+    lp->parseTime += elapsed;
+    pthread_cond_broadcast(&lp->parsed);
+  }
+
+  // next() may be waiting for a chunk that will never come
+  pthread_cond_broadcast(&lp->parsed);
+  pthread_mutex_unlock(&lp->lock);
+  return NULL;
+}
+
+void LoadPipeline::parse(const char* begin, const char* end, Chunk& chunk) const
+{
+  LoadTuple tuple;
+  const char* nl;
+
+  chunk.tuples.clear();
+  chunk.badLines = 0;
+
+  // a line ends at a newline or at the end of the file
+  for (; begin < end; begin = nl + 1) {
+    if ((nl = (const char*) memchr(begin, '\n', end - begin)) == NULL) nl = end;
+    if (parseLine(begin, nl, tuple.key, tuple.value, tuple.length) < 0) {
+      chunk.badLines++;
+      continue;
+    }
+    chunk.tuples.push_back(tuple);
+  }
+}
+
+RC LoadPipeline::parseLine(const char* s, const char* end, int& key,
+                           const char*& value, int& length)
+{
+  const char *e;
+  unsigned n = 0;
+  bool negative;
+  char c;
+
+  // ignore beginning white spaces
+  while (s < end && (*s == ' ' || *s == '\t')) s++;
+
+  // get the integer key value. like atoi(), stop at the first non-digit
+  e = s;
+  negative = (e < end && *e == '-');
+  if (e < end && (*e == '-' || *e == '+')) e++;
+  for (; e < end && (unsigned) (*e - '0') < 10; e++) {
+    n = n * 10 + (*e - '0');
+  }
+  key = negative ? (int) (0u - n) : (int) n;
+
+  // look for comma
+  if ((s = (const char*) memchr(s, ',', end - s)) == NULL) {
+    return RC_INVALID_FILE_FORMAT;
+  }
+
+  // ignore white spaces
+  do { s++; } while (s < end && (*s == ' ' || *s == '\t'));
+
+  // a value delimited by ' or " ends at the closing quote. otherwise,
+  // (and without the closing quote) it ends with the line
+  e = end;
+  if (s < end && ((c = *s) == '\'' || c == '"')) {
+    s++;
+    if ((e = (const char*) memchr(s, c, end - s)) == NULL) e = end;
+  }
+
+  value = s;
+  length = e - s;
+  return 0;
+}
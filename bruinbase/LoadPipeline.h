@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef LOADPIPELINE_H
+#define LOADPIPELINE_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+
+/**
+ * a tuple parsed from a load file. the value is not copied: it points
+ * into the mapped load file and stays valid until LoadPipeline::close()
+ */
+struct LoadTuple {
+  int         key;
+  const char* value;   // the value, not NUL-terminated
+  int         length;  // the length of the value
+};
+
+/**
+ * reads and parses a load file for LOAD on several threads.
+ * the file is mapped into memory and cut into chunks of about CHUNK_SIZE
+ * bytes at line boundaries. each parser thread takes the next chunk,
+ * asks the kernel to read the chunk after it, and parses its lines in
+ * place with parseLine(). next() hands the parsed chunks to the
+ * caller in file order. the parsers stay at most MAX_CHUNKS chunks ahead
+ * of the caller, which bounds the memory held.
+ */
+class LoadPipeline {
+ public:
+  static const int CHUNK_SIZE = 1 << 20;       // bytes per chunk
+  static const int MAX_CHUNKS = 32;            // # of chunks parsed ahead
+  static const int MAX_THREAD_COUNT = 16;      // # of parser threads
+  static const int DEFAULT_THREAD_COUNT = 4;
+
+  LoadPipeline();
+
+  /**
+   * close() the pipeline.
+   */
+  ~LoadPipeline();
+
+  /**
+   * open a load file and start parsing it.
+   * @param filename[IN] the name of the load file
+   * @param threadCount[IN] the # of parser threads, up to MAX_THREAD_COUNT
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename, int threadCount);
+
+  /**
+   * take the tuples of the next chunk of the file, waiting for them
+   * to be parsed if necessary.
+   * @param tuples[OUT] the tuples of the chunk, in file order
+   * @return error code. 0 if no error.
+   *    RC_END_OF_FILE - when every chunk has been taken
+   */
+  RC next(std::vector<LoadTuple>& tuples);
+
+  /**
+   * stop the parser threads and close the file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * parse a line of a load file in place, the way
+   * SqlEngine::parseLoadLine() does, without copying anything.
+   * the value is the rest of the line after the comma, or the part
+   * between the quotes if it is quoted with ' or ".
+   * @param line[IN] the first character of the line
+   * @param end[IN] the end of the line, i.e., its newline or the end
+   *    of the buffer
+   * @param key[OUT] the key field of the tuple in the line
+   * @param value[OUT] the first character of the value field in the line
+   * @param length[OUT] the length of the value field
+   * @return error code. 0 if no error
+   */
+  static RC parseLine(const char* line, const char* end, int& key,
+                      const char*& value, int& length);
+
+  /**
+   * @return the time since the epoch in seconds, for timing the stages
+   */
+  static double now();
+
+  // the statistics of the last file opened. they survive close()
+  long long getByteCount() const  { return byteCount; }
+  int getBadLineCount() const     { return badLines; }
+  int getThreadCount() const      { return parserCount; }
+  double getParseTime() const     { return parseTime; }  // summed over threads
+  double getWaitTime() const      { return waitTime; }   // spent in next()
+
+ private:
+  LoadPipeline(const LoadPipeline&);             // not copyable
+  LoadPipeline& operator=(const LoadPipeline&);
+
+  // a chunk of the file and its tuples once parsed
+  struct Chunk {
+    std::vector<LoadTuple> tuples;
+    int  badLines;   // # of lines that could not be parsed
+    bool ready;      // true once the tuples are parsed
+  };
+
+  static void* run(void* arg);
+  void parse(const char* begin, const char* end, Chunk& chunk) const;
+
+  char*      map;          // the mapping of the load file
+  long long  size;         // the size of the load file
+  long long  pos;          // the offset of the first chunk not taken yet
+  int        nextChunk;    // the id of the next chunk a parser takes
+  int        nextOut;      // the id of the next chunk next() returns
+  bool       stopping;     // true when close() is stopping the parsers
+  Chunk      chunks[MAX_CHUNKS];  // chunk i is in chunks[i % MAX_CHUNKS]
+
+  int        threadCount;  // # of parser threads running
+  pthread_t  threads[MAX_THREAD_COUNT];
+  pthread_mutex_t lock;    // protects everything above
+  pthread_cond_t  parsed;  // signaled when a chunk is parsed
+  pthread_cond_t  taken;   // signaled when next() takes a chunk
+
+  long long  byteCount;    // the size of the last file opened
+  int        parserCount;  // # of parser threads started for it
+  int        badLines;     // # of lines that could not be parsed
+  double     parseTime;    // the time the parsers spent parsing
+  double     waitTime;     // the time next() waited for the parsers
+};
+
+#endif // LOADPIPELINE_H
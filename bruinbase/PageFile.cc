@@ -9,26 +9,39 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include "BufferPool.h"
+#include "IoEngine.h"
+#include <cstring>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 using std::string;
 
 int PageFile::readCount = 0;
 int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
 
 PageFile::PageFile() 
 { 
   fd = -1; 
+  fid = -1;
   epid = 0; 
+  map = NULL;
+  mapSize = 0;
+  lastMapped = -1;
+  pending = 0;
 }
 
 PageFile::PageFile(const string& filename, char mode)
 {
   fd = -1;
+  fid = -1;
   epid = 0;
+  map = NULL;
+  mapSize = 0;
+  lastMapped = -1;
+  pending = 0;
   open(filename.c_str(), mode);
 }
 
@@ -44,6 +57,8 @@ RC PageFile::open(const string& filename, char mode)
   switch (mode) {
   case 'r':
   case 'R':
+  case 'm':
+  case 'M':
     oflag = O_RDONLY;
     break;
   case 'w':
@@ -63,68 +78,153 @@ RC PageFile::open(const string& filename, char mode)
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
   epid = statbuf.st_size / PAGE_SIZE;
 
+  // map the file in 'm' mode. an empty file has nothing to map
+  if ((mode == 'm' || mode == 'M') && epid > 0) {
+    mapSize = (size_t) epid * PAGE_SIZE;
+    map = (char*) ::mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+      map = NULL;
+      ::close(fd);
+      fd = -1;
+      epid = 0;
+      return RC_FILE_OPEN_FAILED;
+    }
+    ::madvise(map, mapSize, MADV_SEQUENTIAL);
+    lastMapped = -1;
+    return 0;
+  }
+
+  // register the file with the buffer pool, which shares the cached
+  // pages among every PageFile open on the same file
+  if ((fid = BufferPool::openFile(fd, oflag != O_RDONLY)) < 0) {
+    ::close(fd);
+    fd = -1;
+    epid = 0;
+    return RC_FILE_OPEN_FAILED;
+  }
+
   return 0;
 }
 
 RC PageFile::close()
 {
+  RC rc = 0;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
-  // close the file
-  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
+  // wait for the reads started by prefetch()
+  IoEngine::wait(&pending);
 
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-    }
+  // unmap a file opened in 'm' mode
+  if (map != NULL) {
+    ::munmap(map, mapSize);
+    map = NULL;
+    mapSize = 0;
   }
 
+  // the last close of the file writes its dirty pages
+  // and evicts all its cached pages
+  if (fid >= 0) rc = BufferPool::closeFile(fid);
+
+  // close the file
+  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
+
   // set the fd and epid to the initial state
   fd = -1; 
+  fid = -1;
   epid = 0;
-  return 0;
+  return rc;
 }
 
-PageId PageFile::endPid() const 
+RC PageFile::flush()
 {
-  return epid;
+  if (fid < 0) return (map != NULL) ? 0 : RC_FILE_WRITE_FAILED;
+  return BufferPool::flushFile(fid);
 }
 
-RC PageFile::seek(PageId pid) const
+PageId PageFile::endPid() const 
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  return epid;
 }
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
-  RC rc;
+  int frame;
+
   if (pid < 0) return RC_INVALID_PID; 
 
-  // seek to the location of the page
-  if ((rc = seek(pid) < 0)) return rc;
+  // a mapped file is read-only
+  if (map != NULL) return RC_INVALID_FILE_MODE;
 
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
-
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
+  // keep the copy in the buffer pool up to date so that the next read
+  // of the page is a hit. nothing to copy if the buffer is the frame itself
+  if ((frame = BufferPool::pinForWrite(fid, pid)) >= 0) {
+    char* page = BufferPool::frameData(frame);
+    if (page != buffer) memcpy(page, buffer, PAGE_SIZE);
+
+    // in write-back mode, the page is written later by the buffer pool
+    if (BufferPool::isWriteBack()) {
+      BufferPool::markDirty(frame);
+      BufferPool::unpin(frame);
+      if (pid >= epid) epid = pid + 1;
+      return 0;
     }
+    BufferPool::unpin(frame);
+  }
+
+  // write the buffer to the disk page
+  if (::pwrite(fd, buffer, PAGE_SIZE, (off_t) pid * PAGE_SIZE) < 0) {
+    return RC_FILE_WRITE_FAILED;
   }
 
   // if the written pid >= end pid, update the end pid
   if (pid >= epid) epid = pid + 1;
 
   // increase page write count
-  writeCount++;
+  __sync_fetch_and_add(&writeCount, 1);
+
+  return 0;
+}
+
+RC PageFile::writeRun(PageId pid, const void* buffer, int count)
+{
+  RC rc = 0;
+  const char* page = (const char*) buffer;
+  int inFile;   // # of the pages already in the file
+
+  if (pid < 0 || count < 0) return RC_INVALID_PID;
+  if (map != NULL) return RC_INVALID_FILE_MODE;
+
+  inFile = (pid < epid) ? epid - pid : 0;
+  if (inFile > count) inFile = count;
+
+  // the rest extends the file with a single pwrite(), so none of it is
+  // in the pool. it goes first, so that it can be cut off below
+  if (inFile < count) {
+    size_t size = (size_t) (count - inFile) * PAGE_SIZE;
+
+    if (::pwrite(fd, page + (size_t) inFile * PAGE_SIZE, size,
+                 (off_t) (pid + inFile) * PAGE_SIZE) != (ssize_t) size) {
+      rc = RC_FILE_WRITE_FAILED;
+    }
+  }
+
+  // a page already in the file may be cached (or dirty) in the pool
+  for (int i = 0; rc == 0 && i < inFile; i++) {
+    rc = write(pid + i, page + (size_t) i * PAGE_SIZE);
+  }
+
+  // a failed run is cut off again, so that the file ends where it did
+  if (rc < 0) {
+    if (inFile < count && ::ftruncate(fd, (off_t) epid * PAGE_SIZE) < 0) {
+      rc = RC_FILE_WRITE_FAILED;
+    }
+    return rc;
+  }
+  if (inFile < count) {
+    epid = pid + count;
+    __sync_fetch_and_add(&writeCount, count - inFile);
+  }
 
   return 0;
 }
@@ -132,47 +232,161 @@ RC PageFile::write(PageId pid, const void* buffer)
 RC PageFile::read(PageId pid, void* buffer) const
 {
   RC rc;
+  PageHandle handle;
+
+  // pin the page and copy it to the buffer
+  if ((rc = fetch(pid, handle)) < 0) return rc;
+  memcpy(buffer, handle.data(), PAGE_SIZE);
+
+  return 0;
+}
+
+RC PageFile::fetch(PageId pid, PageHandle& handle) const
+{
+  int frame;
+  bool cached;
+
+  handle.unpin();
 
   if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
 
-  //
-  // if the page is in cache, read it from there
-  //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
+  // a page of a mapped file is accessed in the mapping
+  if (map != NULL) {
+    if (pid != lastMapped) {
+      lastMapped = pid;
+      __sync_fetch_and_add(&readCount, 1);
     }
+    handle.file = const_cast<PageFile*>(this);
+    handle.pagePid = pid;
+    handle.frame = -1;
+    handle.page = map + (size_t) pid * PAGE_SIZE;
+    handle.dirty = false;
+    return 0;
   }
 
-  // seek to the page
-  if ((rc = seek(pid) < 0)) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
-    }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
+  // pin the page in the buffer pool
+  if ((frame = BufferPool::pin(fid, pid, cached)) < 0) return RC_NO_FREE_FRAME;
+
+  // read the page into the frame if it was not cached.
+  // other threads fetching the page wait until it is loaded
+  if (!cached) {
+    if (::pread(fd, BufferPool::frameData(frame), PAGE_SIZE,
+                (off_t) pid * PAGE_SIZE) < 0) {
+      BufferPool::discard(frame);
+      return RC_FILE_READ_FAILED;
     }
+    BufferPool::loaded(frame);
+
+    // increase the page read count
+    __sync_fetch_and_add(&readCount, 1);
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
-    return RC_FILE_READ_FAILED;
+
+  handle.file = const_cast<PageFile*>(this);
+  handle.pagePid = pid;
+  handle.frame = frame;
+  handle.page = BufferPool::frameData(frame);
+  handle.dirty = false;
+
+  return 0;
+}
+
+RC PageFile::prefetch(PageId pid) const
+{
+  RC rc;
+  int frame;
+
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+
+  // let the kernel read ahead a page of a mapped file
+  if (map != NULL) {
+    ::madvise(map + (size_t) pid * PAGE_SIZE, PAGE_SIZE, MADV_WILLNEED);
+    return 0;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
 
-  // increase the page read count
-  readCount++;
+  // nothing to do if the page is cached or on its way
+  if ((frame = BufferPool::reserve(fid, pid)) < 0) return 0;
+
+  IoRequest* req = new IoRequest;
+  req->fd = fd;
+  req->buffer = BufferPool::frameData(frame);
+  req->length = PAGE_SIZE;
+  req->offset = (off_t) pid * PAGE_SIZE;
+  req->arg = (void*) (long) frame;
+  req->pending = &pending;
+  req->done = prefetched;
+
+  if ((rc = IoEngine::submit(req)) < 0) {
+    BufferPool::discard(frame);
+    delete req;
+    return rc;
+  }
 
   return 0;
 }
+
+void PageFile::prefetched(IoRequest* req, ssize_t result)
+{
+  int frame = (int) (long) req->arg;
+
+  if (result < 0) {
+    BufferPool::discard(frame);
+  } else {
+    BufferPool::loaded(frame);
+    BufferPool::unpin(frame);
+
+    // increase the page read count
+    __sync_fetch_and_add(&readCount, 1);
+  }
+
+  delete req;
+}
+
+int PageFile::getPageWriteCount()
+{
+  // pages written through plus dirty pages written back by the pool
+  return writeCount + BufferPool::getFlushCount();
+}
+
+int PageFile::getCacheHitCount()
+{
+  return BufferPool::getHitCount();
+}
+
+int PageFile::getCacheMissCount()
+{
+  return BufferPool::getMissCount();
+}
+
+PageHandle::PageHandle()
+{
+  file = NULL;
+  pagePid = -1;
+  frame = -1;
+  page = NULL;
+  dirty = false;
+}
+
+PageHandle::~PageHandle()
+{
+  unpin();
+}
+
+RC PageHandle::unpin()
+{
+  RC rc = 0;
+
+  if (page == NULL) return 0;
+
+  // write the page modified in place
+  if (dirty) rc = file->write(pagePid, page);
+
+  // pages of a mapped file are not pinned
+  if (frame >= 0) BufferPool::unpin(frame);
+  file = NULL;
+  pagePid = -1;
+  frame = -1;
+  page = NULL;
+  dirty = false;
+
+  return rc;
+}
@@ -11,17 +11,88 @@
 #define PAGEFILE_H
 
 #include <string>
+#include <sys/types.h>
 #include "Bruinbase.h"
 
+// the page size can be set at build time, e.g. make PAGE_SIZE=4096.
+// files record the page size they were written with (see RecordFile
+// and BTreeIndex) and are refused by a build with another page size
+#ifndef BRUINBASE_PAGE_SIZE
+#define BRUINBASE_PAGE_SIZE 1024
+#endif
+#if BRUINBASE_PAGE_SIZE < 1024 || (BRUINBASE_PAGE_SIZE & (BRUINBASE_PAGE_SIZE - 1))
+#error "BRUINBASE_PAGE_SIZE must be a power of two of at least 1024"
+#endif
+
 typedef int PageId;
 
+class PageFile;
+struct IoRequest;
+
 /**
- * read/write a file in the unit of a page
+ * a pin on a page held in the buffer pool.
+ * PageFile::fetch() pins a page and the handle gives direct access to the
+ * frame that caches it, so the page can be read (and modified) in place
+ * without copying it. the pin is released by unpin() or when the handle
+ * is destroyed. a handle cannot be copied.
+ */
+class PageHandle {
+ public:
+  PageHandle();
+  ~PageHandle();
+
+  /**
+   * @return the page buffer in the buffer pool. NULL if nothing is pinned
+   */
+  char* data() const { return page; }
+
+  /**
+   * @return the id of the pinned page. -1 if nothing is pinned
+   */
+  PageId pid() const { return pagePid; }
+
+  /**
+   * @return true if the handle pins a page of the file pf
+   */
+  bool pins(const PageFile& pf) const { return page != NULL && file == &pf; }
+
+  /**
+   * note that the page was modified in place.
+   * the page is written back to the file when the pin is released.
+   * only valid for pages fetched from a file opened in 'w' mode.
+   */
+  void markDirty() { dirty = true; }
+
+  /**
+   * release the pin, writing the page first if it was marked dirty.
+   * @return error code. 0 if no error
+   */
+  RC unpin();
+
+ private:
+  friend class PageFile;
+
+  PageHandle(const PageHandle&);             // not copyable
+  PageHandle& operator=(const PageHandle&);
+
+  PageFile* file;     // the file the page belongs to
+  PageId    pagePid;  // the pinned page
+  int       frame;    // the pinned buffer pool frame. -1 in a mapped file
+  char*     page;     // the page buffer of the frame
+  bool      dirty;    // true if the page was modified
+};
+
+/**
+ * read/write a file in the unit of a page.
+ * pages are read and written with pread()/pwrite(), so several threads
+ * may read the same unix file through their own PageFile objects.
+ * a single PageFile object must not be shared by threads.
  */
 class PageFile {
  public:
 
-  static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
+  // the size of a page. 1KB unless the build sets BRUINBASE_PAGE_SIZE
+  static const int PAGE_SIZE = BRUINBASE_PAGE_SIZE;
 
   PageFile();
   PageFile(const std::string& filename, char mode);
@@ -29,17 +100,27 @@ class PageFile {
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * 'm' mode is a read-only mode that maps the whole file into memory.
+   * pages are then accessed in the mapping and bypass the buffer pool.
+   * the mapping is advised for sequential access (MADV_SEQUENTIAL).
    * @param filename[IN] the name of the file to open
-   * @param mode[IN] 'r' for read, 'w' for write
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for mapped read
    * @return error code. 0 if no error
    */
   RC open(const std::string& filename, char mode);
 
   /**
    * close the file.
+   * the dirty pages of the file in the buffer pool are written first.
    * @return error code. 0 if no error
    */
   RC close();
+
+  /**
+   * write the dirty pages of the file in the buffer pool to the disk.
+   * @return error code. 0 if no error
+   */
+  RC flush();
   
   /**
    * read a disk page into memory buffer.
@@ -48,16 +129,53 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC read(PageId pid, void *buffer) const;
+
+  /**
+   * pin a disk page in the buffer pool and give access to it in place.
+   * unlike read(), the page is not copied. any pin already held by
+   * the handle is released first. for a file opened in 'm' mode,
+   * the handle points into the mapping of the file.
+   * @param pid[IN] the page to fetch
+   * @param handle[OUT] the handle pinning the page
+   * @return error code. 0 if no error
+   */
+  RC fetch(PageId pid, PageHandle& handle) const;
+
+  /**
+   * start reading a disk page into the buffer pool in the background
+   * (see IoEngine.h), so that a later fetch() or read() of the page does
+   * not wait for the disk. nothing is done if the page is already cached.
+   * a fetch() of the page before the read is finished waits for it.
+   * @param pid[IN] the page to read ahead
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid) const;
   
   /**
    * write the memory buffer to the disk page.
    * if (pid >= endPid()), the file is expanded such that
    * endPid() becomes (pid + 1).
+   * the buffer may be the frame of a pinned page of this file.
+   * when the buffer pool is in write-back mode, the page is only
+   * updated in the pool and written to the disk later.
    * @param pid[IN] page to write to
    * @param buffer[IN] the content to write
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * write consecutive pages from a memory buffer.
+   * the pages past the end of the file are written with a single
+   * pwrite() and are not cached in the buffer pool. the pages already
+   * in the file are written one by one with write(). a run that fails
+   * does not extend the file.
+   * @param pid[IN] the first page to write to
+   * @param buffer[IN] the content of count pages, one after another
+   * @param count[IN] the # of pages to write
+   * @return error code. 0 if no error
+   */
+  RC writeRun(PageId pid, const void *buffer, int count);
     
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
@@ -67,46 +185,43 @@ class PageFile {
   PageId endPid() const;
 
   /**
-   * @return the total # of disk reads
+   * @return the total # of disk reads. for mapped files, every access
+   * to a page other than the last accessed one counts as a read
    */
   static int getPageReadCount()  { return readCount; }
   
   /**
    * @return the total # of disk writes
    */
-  static int getPageWriteCount() { return writeCount; }
+  static int getPageWriteCount();
 
- protected:
   /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
-   * @return error code. 0 if no error
+   * @return the total # of page reads served from the buffer pool
+   */
+  static int getCacheHitCount();
+
+  /**
+   * @return the total # of page reads that missed the buffer pool
    */
-  RC seek(PageId pid) const;
+  static int getCacheMissCount();
 
  private:
   int     fd;     // file descriptor of the associated unix file
+  int     fid;    // id of the file in the BufferPool. -1 in 'm' mode
   PageId  epid;   // (last page id + 1) of the file
 
-  //
-  // the following set of members implement LRU caching 
-  //
-  static const int CACHE_COUNT = 10;
+  char*   map;          // the mapping of the file in 'm' mode. NULL otherwise
+  size_t  mapSize;      // the size of the mapping
+  mutable PageId lastMapped;  // the last page accessed in the mapping
+  mutable int    pending;     // # of prefetch() reads not finished yet
 
-  static int cacheClock; // clock tick counter for LRU policy
+  // pages are cached in the process-wide BufferPool (see BufferPool.h)
 
-  // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+  // called by an IoEngine thread when a prefetch() read is finished
+  static void prefetched(IoRequest* req, ssize_t result);
 
-  static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  static int readCount;  // total # of page reads (updated atomically)
+  static int writeCount; // total # of page writes (updated atomically)
 };
   
 #endif // PAGEFILE_H
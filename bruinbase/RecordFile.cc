@@ -7,30 +7,88 @@
  * @date 3/24/2008
  */
 
+#include <cstring>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "RecordFile.h"
 
 using std::string;
 
 //
-// helper functions for page manipultation
+// the page formats.
 //
+// a slotted page keeps its records at its end and their slots at its
+// start, and the free space of the page is in between
+// -------------------------------------------------------------------
+// | count | freeEnd | slot 0 | slot 1 | ... free ... | rec 1 | rec 0 |
+// -------------------------------------------------------------------
+// count is # records in the page and freeEnd the offset where the records
+// start. a slot is the (offset, size) of its record as unsigned shorts.
+// a record is the key followed by the value and a NUL, so that the value
+// can be read in place. the value of an overflow record (OVERFLOW_FLAG
+// set in the size of its slot) is in a chain of overflow pages, and the
+// record holds the key, the first page of the chain and the value length.
+//
+// an overflow page holds a piece of a value
+// ---------------------------------------------------
+// | OVERFLOW_PAGE | next pid | length | piece ...   |
+// ---------------------------------------------------
+// its count of OVERFLOW_PAGE tells scans that it holds no record.
+// the chain of a value is written right before the page of its record,
+// so the last page of a file is always a record page.
+//
+// a fixed-slot page of an older file gives every record the same slot
+// ------------------------------------------------------------
+// | count | key 0 | value 0 | key 1 | value 1 | ...          |
+// ------------------------------------------------------------
+// where a value takes LEGACY_VALUE_LENGTH bytes.
+//
+// a page of a columnar file holds keys alone
+// ------------------------------------------------
+// | count | key 0 | key 1 | ...                  |
+// ------------------------------------------------
+// the value of record i (counting from the first record of the file) is
+// in the value column, at the byte offset that is the i'th long long of
+// the offset column. the values follow each other in the value column,
+// each ending with a NUL, and may run across a page boundary.
+//
+static const int PAGE_HEADER = 2 * sizeof(int);
+static const int SLOT_SIZE = 2 * sizeof(unsigned short);
+static const unsigned short OVERFLOW_FLAG = 0x8000;
+static const int OVERFLOW_RECORD = 3 * sizeof(int);
+static const int OVERFLOW_PAGE = -1;
+static const int OVERFLOW_HEADER = 3 * sizeof(int);
+static const int OVERFLOW_DATA = PageFile::PAGE_SIZE - OVERFLOW_HEADER;
+static const char* VALUE_COLUMN = ".val";
+static const char* OFFSET_COLUMN = ".off";
+static const char* ZONE_MAP = ".zone";
+
+// the longest value kept in its record. the size of a record has to fit
+// in the 15 bits of a slot next to OVERFLOW_FLAG
+static const int MAX_INLINE_LENGTH =
+  (PageFile::PAGE_SIZE - PAGE_HEADER - SLOT_SIZE < OVERFLOW_FLAG ?
+   PageFile::PAGE_SIZE - PAGE_HEADER - SLOT_SIZE : OVERFLOW_FLAG - 1) -
+  sizeof(int) - 1;
 
-// compute the pointer to the n'th slot in a page
-static char* slotPtr(char* page, int n);
-
-// read the record in the n'th slot in the page
-static void readSlot(const char* page, int n, int& key, std::string& value);
-
-// write the record to the n'th slot in the page
-static void writeSlot(char* page, int n, int key, const std::string& value);
+//
+// helper functions for page manipultation
+//
 
 // get # records stored in the page
 static int getRecordCount(const char* page);
 
-// update # records stored in the page
-static void setRecordCount(char* page, int count);
+// make the page an empty slotted page
+static void initPage(char* page);
+
+// the size of the record of a value in a slotted page
+static int recordSize(int length);
+
+// true if a record of the size fits in the free space of a slotted page
+static bool fitsInPage(const char* page, int size);
 
+// add a slot for a record of the size to a slotted page and return
+// the space of the record in the page
+static char* addSlot(char* page, int size, bool overflowed);
 
 //
 // helper functions for RecordId manipulation
@@ -102,10 +160,14 @@ bool operator != (const RecordId& r1, const RecordId& r2)
 }
 
 
+
 RecordFile::RecordFile()
 {
+  brid.pid = brid.sid = 0;
   erid.pid = 0;
   erid.sid = 0;
+  format = SLOTTED;
+  zoned = false;
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
@@ -113,10 +175,10 @@ RecordFile::RecordFile(const string& filename, char mode)
   open(filename, mode);
 }
 
-RC RecordFile::open(const string& filename, char mode)
+RC RecordFile::open(const string& filename, char mode, bool columnar)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  PageHandle page;
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
@@ -127,39 +189,112 @@ RC RecordFile::open(const string& filename, char mode)
 
   // get the end pid of the file
   erid.pid = pf.endPid();
+  format = SLOTTED;
 
-  // if the end pid is zero, the file is empty.
-  // set the end record id to (0, 0).
   if (erid.pid == 0) {
-    erid.sid = 0;
-    return 0;
-  }
-
-  // obtain # records in the last page to set sid of the end record id.
-  // read the last page of the file and get # records in the page.
-  // remeber that the id of the last page is endPid()-1 not endPid().
-  if ((rc = pf.read(--erid.pid, page)) < 0) {
-    // an error occurred during page read
+    // if the end pid is zero, the file is empty. a new file gets its
+    // header page, and its records start on the next page
+    brid.pid = brid.sid = 0;
+    if (mode == 'w') {
+      if ((rc = writeHeader(columnar ? COLUMNAR : SLOTTED)) < 0) {
+        pf.close();
+        return rc;
+      }
+      format = columnar ? COLUMNAR : SLOTTED;
+      brid.pid = 1;
+    }
+  } else if ((rc = readHeader()) < 0 || (format == FIXED_SLOT && mode == 'w' &&
+                                         (rc = RC_INVALID_FILE_FORMAT))) {
+    // find out where the records start and check the page size.
+    // records are not appended to fixed-slot pages
     erid.pid = erid.sid = 0;
     pf.close();
     return rc;
   }
 
-  // get # records in the last page
-  erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
-    // the last page is full. advance the end record id to the next page.
-    erid.pid++;
-    erid.sid = 0;
+  // the columns of the values of a columnar file
+  if (format == COLUMNAR) {
+    if ((rc = valFile.open(filename + VALUE_COLUMN, mode)) < 0 ||
+        (rc = offFile.open(filename + OFFSET_COLUMN, mode)) < 0) {
+      valFile.close();
+      pf.close();
+      erid.pid = erid.sid = 0;
+      return rc;
+    }
+  }
+
+  if (erid.pid <= brid.pid) {
+    // no record page yet
+    erid = brid;
+  } else {
+    // obtain # records in the last page to set sid of the end record id.
+    // read the last page of the file and get # records in the page.
+    // remeber that the id of the last page is endPid()-1 not endPid().
+    if ((rc = pf.fetch(--erid.pid, page)) < 0) {
+      // an error occurred during page read
+      erid.pid = erid.sid = 0;
+      close();
+      return rc;
+    }
+
+    // get # records in the last page
+    erid.sid = getRecordCount(page.data());
+    if (erid.sid >= RECORDS_PER_PAGE || erid.sid < 0) {
+      // the last page is full. advance the end record id to the next page.
+      erid.pid++;
+      erid.sid = 0;
+    }
+  }
+
+  // the zone map of the pages
+  if (format != FIXED_SLOT && (rc = openZones(filename, mode)) < 0) {
+    erid.pid = erid.sid = 0;
+    close();
+    return rc;
   }
   
   return 0;
 }
 
+RC RecordFile::openZones(const string& filename, char mode)
+{
+  RC   rc;
+
+  // the zone map is started with the file. a file that had records
+  // before it, or has none, goes without one
+  zoned = false;
+  if (::access((filename + ZONE_MAP).c_str(), F_OK) < 0 &&
+      (mode != 'w' || erid != brid)) {
+    return 0;
+  }
+  if ((rc = zoneFile.open(filename + ZONE_MAP, mode)) < 0) return rc;
+  zoned = true;
+
+  return 0;
+}
+
 RC RecordFile::close()
 {
+  brid.pid = brid.sid = 0;
   erid.pid = 0;
   erid.sid = 0;
+  string().swap(overflow);
+
+  // the columns of a columnar file
+  if (format == COLUMNAR) {
+    valPage.unpin();
+    offPage.unpin();
+    valFile.close();
+    offFile.close();
+  }
+  format = SLOTTED;
+
+  // the zone map
+  if (zoned) {
+    zonePage.unpin();
+    zoneFile.close();
+    zoned = false;
+  }
 
   return pf.close();
 }
@@ -167,18 +302,221 @@ RC RecordFile::close()
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  PageHandle page;
+  const char* v;
+
+  // read the record in place and copy the value
+  if ((rc = read(rid, key, v, page)) < 0) return rc;
+  value.assign(v);
+
+  return 0;
+}
+
+RC RecordFile::read(const RecordId& rid, int& key, const char*& value,
+                    PageHandle& page) const
+{
+  RC   rc;
   
   // check whether the rid is in the valid range
-  if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
+  if (rid.pid < brid.pid || rid.pid > erid.pid) return RC_INVALID_RID;
   if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // fetch the page containing the record unless it is already pinned
+  if (!page.pins(pf) || page.pid() != rid.pid) {
+    if ((rc = pf.fetch(rid.pid, page)) < 0) return rc;
+  }
+
+  return readRecord(page.data(), rid, key, &value);
+}
+
+RC RecordFile::readNext(RecordId& rid, int& key, const char*& value,
+                        PageHandle& page, int low, int high) const
+{
+  return nextRecord(rid, key, &value, page, low, high);
+}
+
+RC RecordFile::readNextKey(RecordId& rid, int& key, PageHandle& page,
+                           int low, int high) const
+{
+  // a NULL value is not read
+  return nextRecord(rid, key, NULL, page, low, high);
+}
+
+RC RecordFile::nextRecord(RecordId& rid, int& key, const char** value,
+                          PageHandle& page, int low, int high) const
+{
+  RC   rc;
+  bool ranged = (low != INT_MIN || high != INT_MAX);
+
+  if (rid < brid) rid = brid;
+
+  // skip the slots past the last record of a page, overflow pages, and
+  // the pages without a key in the range
+  for (; rid < erid; rid.pid++, rid.sid = 0) {
+    if (ranged && rid.sid == 0 && !inZone(rid.pid, low, high)) continue;
+    if (!page.pins(pf) || page.pid() != rid.pid) {
+      if ((rc = pf.fetch(rid.pid, page)) < 0) return rc;
+    }
+    if (rid.sid < getRecordCount(page.data())) {
+      return readRecord(page.data(), rid, key, value);
+    }
+  }
+
+  return RC_END_OF_FILE;
+}
+
+bool RecordFile::inZone(PageId pid, int low, int high) const
+{
+  PageId zpid = pid / ZONES_PER_PAGE;
+  int  zone[2];
+
+  // without a zone map, any page may hold a key in the range
+  if (!zoned || zpid >= zoneFile.endPid()) return true;
+  if (!zonePage.pins(zoneFile) || zonePage.pid() != zpid) {
+    if (zoneFile.fetch(zpid, zonePage) < 0) return true;
+  }
+
+  // the zone of a page without a record is empty: zone[0] > zone[1]
+  memcpy(zone, zonePage.data() + sizeof(zone) * (pid % ZONES_PER_PAGE),
+         sizeof(zone));
+  return zone[0] <= high && zone[1] >= low && zone[0] <= zone[1];
+}
 
-  // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+RC RecordFile::readRecord(const char* page, const RecordId& rid, int& key,
+                          const char** value) const
+{
+  const char *ptr;
+  unsigned short slot[2];
+
+  if (rid.sid >= getRecordCount(page)) return RC_INVALID_RID;
+
+  switch (format) {
+  case FIXED_SLOT:
+    // every record of a fixed-slot page takes the same space
+    ptr = page + sizeof(int) + (sizeof(int) + LEGACY_VALUE_LENGTH) * rid.sid;
+    memcpy(&key, ptr, sizeof(int));
+    if (value != NULL) *value = ptr + sizeof(int);
+    return 0;
+
+  case COLUMNAR:
+    // the value is in the value column
+    memcpy(&key, page + sizeof(int) * (1 + rid.sid), sizeof(int));
+    return (value != NULL) ? readValue(rowOf(rid), *value) : 0;
+
+  default:
+    // the slot tells where the record is
+    memcpy(slot, page + PAGE_HEADER + SLOT_SIZE * rid.sid, SLOT_SIZE);
+    ptr = page + slot[0];
+    memcpy(&key, ptr, sizeof(int));
+    if (value == NULL) return 0;
+    if (slot[1] & OVERFLOW_FLAG) return readOverflow(ptr, *value);
+    *value = ptr + sizeof(int);
+    return 0;
+  }
+}
+
+RC RecordFile::readOverflow(const char* record, const char*& value) const
+{
+  RC   rc;
+  PageHandle page;
+  int  header[3];
+  PageId pid;
+  int  length;
+
+  // the record is the key, the first page of the chain and the length
+  memcpy(&pid, record + sizeof(int), sizeof(PageId));
+  memcpy(&length, record + sizeof(int) + sizeof(PageId), sizeof(int));
+
+  // put the pieces of the value together
+  overflow.clear();
+  overflow.reserve(length);
+  while ((int) overflow.size() < length) {
+    if ((rc = pf.fetch(pid, page)) < 0) return rc;
+    memcpy(header, page.data(), sizeof(header));
+    if (header[0] != OVERFLOW_PAGE) return RC_INVALID_FILE_FORMAT;
+    overflow.append(page.data() + OVERFLOW_HEADER, header[2]);
+    pid = header[1];
+  }
+
+  value = overflow.c_str();
+  return 0;
+}
+
+int RecordFile::rowOf(const RecordId& rid) const
+{
+  // the records of a columnar file fill its pages
+  return (rid.pid - brid.pid) * KEYS_PER_PAGE + rid.sid;
+}
+
+RC RecordFile::readOffset(int row, long long& offset) const
+{
+  RC   rc;
+  PageId pid = row / OFFSETS_PER_PAGE;
+
+  if (!offPage.pins(offFile) || offPage.pid() != pid) {
+    if ((rc = offFile.fetch(pid, offPage)) < 0) return rc;
+  }
+  memcpy(&offset, offPage.data() + sizeof(long long) * (row % OFFSETS_PER_PAGE),
+         sizeof(long long));
+  return 0;
+}
+
+RC RecordFile::readValue(int row, const char*& value) const
+{
+  RC   rc;
+  long long offset;
+  PageId pid;
+  const char *ptr, *end;
+  int  at;
+
+  if ((rc = readOffset(row, offset)) < 0) return rc;
+  pid = offset / PageFile::PAGE_SIZE;
+  at = offset % PageFile::PAGE_SIZE;
+
+  if (!valPage.pins(valFile) || valPage.pid() != pid) {
+    if ((rc = valFile.fetch(pid, valPage)) < 0) return rc;
+  }
+
+  // a value that ends in its page is read in place
+  ptr = valPage.data() + at;
+  if (memchr(ptr, 0, PageFile::PAGE_SIZE - at) != NULL) {
+    value = ptr;
+    return 0;
+  }
+
+  // otherwise, put the pieces of the value together
+  overflow.assign(ptr, PageFile::PAGE_SIZE - at);
+  do {
+    if ((rc = valFile.fetch(++pid, valPage)) < 0) return rc;
+    ptr = valPage.data();
+    end = (const char*) memchr(ptr, 0, PageFile::PAGE_SIZE);
+    overflow.append(ptr, (end != NULL) ? end - ptr : PageFile::PAGE_SIZE);
+  } while (end == NULL);
+
+  value = overflow.c_str();
+  return 0;
+}
+
+RC RecordFile::prefetch(const RecordId& rid) const
+{
+  // check whether the rid is in the valid range
+  if (rid.pid < brid.pid || rid >= erid) return RC_INVALID_RID;
+
+  return pf.prefetch(rid.pid);
+}
+
+RC RecordFile::recordCount(PageId pid, int& count) const
+{
+  RC rc;
+  PageHandle page;
+
+  if (pid < brid.pid || pid > erid.pid) return RC_INVALID_PID;
+
+  // the count of an overflow page is OVERFLOW_PAGE
+  if ((rc = pf.fetch(pid, page)) < 0) return rc;
+  count = getRecordCount(page.data());
+  if (count < 0) count = 0;
 
   return 0;
 }
@@ -186,42 +524,381 @@ RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  RecordAppender appender(*this);
+
+  // the last page is read, updated, and written back right away
+  if ((rc = appender.append(key, value, rid)) < 0) return rc;
+  return appender.flush();
+}
+
+RecordAppender::RecordAppender(RecordFile& rf) : rf(rf)
+{
+  run = new char[RUN_PAGES * PageFile::PAGE_SIZE];
+  runPid = 0;
+  count = 0;
+  offBuf = valBuf = NULL;
+  offPid = valPid = -1;
+  valEnd = 0;
+  zoneBuf = NULL;
+  zonePid = -1;
+  durable.pid = durable.sid = 0;
+  pending = 0;
+}
+
+RecordAppender::~RecordAppender()
+{
+  if (flush() < 0) discard();
+  delete [] run;
+  delete [] offBuf;
+  delete [] valBuf;
+  delete [] zoneBuf;
+}
+
+RC RecordAppender::append(int key, const std::string& value, RecordId& rid)
+{
+  return append(key, value.c_str(), value.size(), rid);
+}
+
+RC RecordAppender::append(int key, const char* value, int length, RecordId& rid)
+{
+  RC   rc;
+  RecordId erid = rf.erid;
+  int  size = recordSize(length);
+  bool overflowed = (length > MAX_INLINE_LENGTH);
+  PageId first;
+  char *page, *ptr;
+  int  *zone;
+
+  // the records before the first one since the last flush() are on the disk
+  if (pending == 0) durable = rf.erid;
+
+  if (rf.format == RecordFile::COLUMNAR) {
+    return appendColumns(key, value, length, rid);
+  }
 
-  // unless we are writing to the the first slot of an empty page,
-  // we have to read the page first
+  // a record that does not fit in the last page starts the next one
   if (erid.sid > 0) {
-    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
+    if ((rc = pageOf(erid.pid, false, page)) < 0) return rc;
+    if (overflowed || !fitsInPage(page, size)) {
+      erid.pid++;
+      erid.sid = 0;
+    }
+  }
+
+  // write the chain of overflow pages of a long value, followed by
+  // a new page for its record
+  first = erid.pid;
+  for (int done = 0; overflowed && done < length; done += OVERFLOW_DATA) {
+    int header[3] = { OVERFLOW_PAGE, erid.pid + 1, length - done };
+
+    if (header[2] > OVERFLOW_DATA) header[2] = OVERFLOW_DATA;
+    if ((rc = pageOf(erid.pid, true, page)) < 0) return rc;
+    memcpy(page, header, sizeof(header));
+    memcpy(page + OVERFLOW_HEADER, value + done, header[2]);
+    erid.pid++;
+  }
+
+  // write the record to the first empty slot of the page
+  if ((rc = pageOf(erid.pid, erid.sid == 0, page)) < 0 ||
+      (rc = zoneOf(erid.pid, zone)) < 0) {
+    return rc;
+  }
+  if (key < zone[0]) zone[0] = key;
+  if (key > zone[1]) zone[1] = key;
+  ptr = addSlot(page, size, overflowed);
+  memcpy(ptr, &key, sizeof(int));
+  if (overflowed) {
+    memcpy(ptr + sizeof(int), &first, sizeof(PageId));
+    memcpy(ptr + sizeof(int) + sizeof(PageId), &length, sizeof(int));
   } else {
-    // if this is the first slot of an empty page
-    // we can simply initialize the page with zeros
-    memset(page, 0, PageFile::PAGE_SIZE);
+    memcpy(ptr + sizeof(int), value, length);
+    ptr[sizeof(int) + length] = 0;
   }
-    
-  // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
 
-  // the first four bytes in the page stores # records in the page.
-  // update this number.
-  setRecordCount(page, erid.sid + 1);
+  // output the rid of the record slot and advance the end record id
+  rid = erid;
+  rf.erid = ++erid;
+  pending++;
+
+  return 0;
+}
+
+RC RecordAppender::appendColumns(int key, const char* value, int length,
+                                 RecordId& rid)
+{
+  RC   rc;
+  RecordId erid = rf.erid;
+  int  row = rf.rowOf(erid);
+  int  piece, count;
+  char *page;
+  int  *zone;
 
-  // write the page to the disk
-  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
-    
-  // we need to output the rid of the record slot
+  if (offPid < 0 && (rc = startColumns(row)) < 0) return rc;
+
+  // the key goes to the last page
+  if ((rc = pageOf(erid.pid, erid.sid == 0, page)) < 0 ||
+      (rc = zoneOf(erid.pid, zone)) < 0) {
+    return rc;
+  }
+  if (key < zone[0]) zone[0] = key;
+  if (key > zone[1]) zone[1] = key;
+  count = erid.sid + 1;
+  memcpy(page + sizeof(int) * count, &key, sizeof(int));
+  memcpy(page, &count, sizeof(int));
+
+  // the offset of the value goes to the offset column
+  if (row / RecordFile::OFFSETS_PER_PAGE != offPid) {
+    if ((rc = rf.offFile.write(offPid, offBuf)) < 0) return rc;
+    offPid = row / RecordFile::OFFSETS_PER_PAGE;
+    memset(offBuf, 0, PageFile::PAGE_SIZE);
+  }
+  memcpy(offBuf + sizeof(long long) * (row % RecordFile::OFFSETS_PER_PAGE),
+         &valEnd, sizeof(long long));
+
+  // and the value with its NUL to the end of the value column
+  for (int done = 0; done <= length; done += piece) {
+    int at = valEnd % PageFile::PAGE_SIZE;
+
+    if (valEnd / PageFile::PAGE_SIZE != valPid) {
+      if ((rc = rf.valFile.write(valPid, valBuf)) < 0) return rc;
+      valPid = valEnd / PageFile::PAGE_SIZE;
+      memset(valBuf, 0, PageFile::PAGE_SIZE);
+    }
+    piece = length - done;
+    if (piece > PageFile::PAGE_SIZE - at) piece = PageFile::PAGE_SIZE - at;
+    memcpy(valBuf + at, value + done, piece);
+    if (done + piece == length && piece < PageFile::PAGE_SIZE - at) {
+      valBuf[at + piece++] = 0;
+    }
+    valEnd += piece;
+  }
+
+  // output the rid of the record slot and advance the end record id
   rid = erid;
+  rf.erid = ++erid;
+  pending++;
+
+  return 0;
+}
+
+RC RecordAppender::startColumns(int row)
+{
+  RC   rc;
+  long long offset;
+  const char* value;
+
+  offBuf = new char[PageFile::PAGE_SIZE];
+  valBuf = new char[PageFile::PAGE_SIZE];
+
+  // the value column ends after the value of the last record
+  valEnd = 0;
+  if (row > 0) {
+    if ((rc = rf.readOffset(row - 1, offset)) < 0 ||
+        (rc = rf.readValue(row - 1, value)) < 0) {
+      return rc;
+    }
+    valEnd = offset + strlen(value) + 1;
+  }
+  rf.offPage.unpin();
+  rf.valPage.unpin();
+
+  // carry on from the last page of each column
+  offPid = row / RecordFile::OFFSETS_PER_PAGE;
+  valPid = valEnd / PageFile::PAGE_SIZE;
+  memset(offBuf, 0, PageFile::PAGE_SIZE);
+  memset(valBuf, 0, PageFile::PAGE_SIZE);
+  if (offPid < rf.offFile.endPid() &&
+      (rc = rf.offFile.read(offPid, offBuf)) < 0) {
+    return rc;
+  }
+  if (valPid < rf.valFile.endPid() &&
+      (rc = rf.valFile.read(valPid, valBuf)) < 0) {
+    return rc;
+  }
+
+  return 0;
+}
+
+RC RecordAppender::zoneOf(PageId pid, int*& zone)
+{
+  RC   rc;
+  static int none[2];
+
+  // a file without a zone map keeps the zones nowhere
+  if (!rf.zoned) {
+    zone = none;
+    return 0;
+  }
 
-  // advance the end record id by one to the next empty slot
-  ++erid;
+  // the zone map is filled a page at a time. a page of it that is in
+  // the file already is read first
+  if (pid / RecordFile::ZONES_PER_PAGE != zonePid) {
+    if (zonePid < 0) {
+      zoneBuf = new int[PageFile::PAGE_SIZE / sizeof(int)];
+    } else if ((rc = rf.zoneFile.write(zonePid, zoneBuf)) < 0) {
+      return rc;
+    }
+    zonePid = pid / RecordFile::ZONES_PER_PAGE;
+    if (zonePid < rf.zoneFile.endPid()) {
+      if ((rc = rf.zoneFile.read(zonePid, zoneBuf)) < 0) return rc;
+    } else {
+      for (int i = 0; i < RecordFile::ZONES_PER_PAGE; i++) {
+        zoneBuf[2 * i] = INT_MAX;
+        zoneBuf[2 * i + 1] = INT_MIN;
+      }
+    }
+  }
+  zone = zoneBuf + 2 * (pid % RecordFile::ZONES_PER_PAGE);
+
+  return 0;
+}
+
+RC RecordAppender::pageOf(PageId pid, bool fresh, char*& page)
+{
+  RC rc;
+  int *zone;
+
+  // a page of the run
+  if (count > 0 && pid >= runPid && pid < runPid + count) {
+    page = run + (pid - runPid) * PageFile::PAGE_SIZE;
+    return 0;
+  }
+
+  // pages are added in order. a full run is written out to make room
+  if (count > 0 && (count == RUN_PAGES || pid != runPid + count)) {
+    if ((rc = flush()) < 0) return rc;
+  }
+  if (count == 0) runPid = pid;
+
+  // a run starts at the last page, which may hold records already
+  page = run + count * PageFile::PAGE_SIZE;
+  if (fresh && (rc = zoneOf(pid, zone)) < 0) return rc;
+  if (fresh) {
+    // the zone of a new page is empty until a record is added
+    zone[0] = INT_MAX;
+    zone[1] = INT_MIN;
+  }
+  if (fresh && rf.format == RecordFile::COLUMNAR) {
+    memset(page, 0, PageFile::PAGE_SIZE);
+  } else if (fresh) {
+    initPage(page);
+  } else if ((rc = rf.pf.read(pid, page)) < 0) {
+    return rc;
+  }
+  count++;
 
   return 0;
 }
 
+RC RecordAppender::flush()
+{
+  RC rc = 0;
+
+  // nothing was appended since the last flush()
+  if (count == 0) return 0;
+
+  // the last pages of the columns and of the zone map are written
+  // again when they fill up
+  if (offPid >= 0) {
+    if ((rc = rf.offFile.write(offPid, offBuf)) < 0 ||
+        (rc = rf.valFile.write(valPid, valBuf)) < 0) {
+      return rc;
+    }
+  }
+  if (zonePid >= 0 && (rc = rf.zoneFile.write(zonePid, zoneBuf)) < 0) {
+    return rc;
+  }
+
+  // the run is kept for discard() if it could not be written
+  if ((rc = rf.pf.writeRun(runPid, run, count)) < 0) return rc;
+  count = 0;
+  durable = rf.erid;
+  pending = 0;
+
+  return 0;
+}
+
+int RecordAppender::discard()
+{
+  int dropped = pending;
+
+  // the pages of the columns and of the zone map are read again from
+  // the disk by the next append()
+  delete [] offBuf;
+  delete [] valBuf;
+  delete [] zoneBuf;
+  offBuf = valBuf = NULL;
+  offPid = valPid = -1;
+  zoneBuf = NULL;
+  zonePid = -1;
+
+  count = 0;
+  rf.erid = durable;
+  pending = 0;
+
+  return dropped;
+}
+
 const RecordId& RecordFile::endRid() const
 {
   return erid;
 }
 
+const RecordId& RecordFile::beginRid() const
+{
+  return brid;
+}
+
+//
+// the header page format:
+// ---------------------------------------
+// | FILE_MAGIC | version | page size |
+// ---------------------------------------
+//
+static const int FILE_VERSION = 2;        // slotted pages
+static const int FIXED_SLOT_VERSION = 1;  // fixed-slot pages
+static const int COLUMNAR_VERSION = 3;    // columnar
+
+RC RecordFile::writeHeader(Format format)
+{
+  char buffer[PageFile::PAGE_SIZE];
+  int  header[3] = { FILE_MAGIC, FILE_VERSION, PageFile::PAGE_SIZE };
+
+  if (format == COLUMNAR) header[1] = COLUMNAR_VERSION;
+
+  memset(buffer, 0, PageFile::PAGE_SIZE);
+  memcpy(buffer, header, sizeof(header));
+  return pf.write(0, buffer);
+}
+
+RC RecordFile::readHeader()
+{
+  RC   rc;
+  PageHandle page;
+  int  header[3];
+
+  if ((rc = pf.fetch(0, page)) < 0) return rc;
+  memcpy(header, page.data(), sizeof(header));
+
+  if (header[0] != FILE_MAGIC) {
+    // a headerless file starts with the record count of its first page
+    if (PageFile::PAGE_SIZE != LEGACY_PAGE_SIZE) return RC_INVALID_FILE_FORMAT;
+    brid.pid = brid.sid = 0;
+    format = FIXED_SLOT;
+    return 0;
+  }
+  if (header[2] != PageFile::PAGE_SIZE) return RC_INVALID_FILE_FORMAT;
+  switch (header[1]) {
+  case FILE_VERSION:       format = SLOTTED; break;
+  case FIXED_SLOT_VERSION: format = FIXED_SLOT; break;
+  case COLUMNAR_VERSION:   format = COLUMNAR; break;
+  default:                 return RC_INVALID_FILE_FORMAT;
+  }
+  brid.pid = 1;
+  brid.sid = 0;
+  return 0;
+}
+
 static int getRecordCount(const char* page)
 {
   int count;
@@ -231,47 +908,44 @@ static int getRecordCount(const char* page)
   return count;
 }
 
-static void setRecordCount(char* page, int count)
+static void initPage(char* page)
 {
-  // the first four bytes of a page contains # records in the page
-  memcpy(page, &count, sizeof(int));
+  int header[2] = { 0, PageFile::PAGE_SIZE };
+
+  memset(page, 0, PageFile::PAGE_SIZE);
+  memcpy(page, header, sizeof(header));
 }
 
-static char* slotPtr(char* page, int n) 
+static int recordSize(int length)
 {
-  // compute the location of the n'th slot in a page.
-  // remember that the first four bytes in a page is used to store
-  // # records in the page and each slot consists of an integer and
-  // a string of length MAX_VALUE_LENGTH
-  return (page+sizeof(int)) + (sizeof(int)+RecordFile::MAX_VALUE_LENGTH)*n;
+  // the key, the value and its NUL. a long value leaves the key,
+  // the pid of its chain and its length
+  return (length > MAX_INLINE_LENGTH) ? OVERFLOW_RECORD
+                                      : (int) sizeof(int) + length + 1;
 }
 
-static void readSlot(const char* page, int n, int& key, std::string& value)
+static bool fitsInPage(const char* page, int size)
 {
-  // compute the location of the record
-  char *ptr = slotPtr(const_cast<char*>(page), n);
-
-  // read the key 
-  memcpy(&key, ptr, sizeof(int));
+  int header[2];
 
-  // read the value
-  value.assign(ptr + sizeof(int));
+  memcpy(header, page, sizeof(header));
+  return header[1] - PAGE_HEADER - SLOT_SIZE * (header[0] + 1) >= size &&
+         header[0] < RecordFile::RECORDS_PER_PAGE;
 }
 
-static void writeSlot(char* page, int n, int key, const std::string& value)
+static char* addSlot(char* page, int size, bool overflowed)
 {
-  // compute the location of the record
-  char *ptr = slotPtr(page, n);
-
-  // store the key
-  memcpy(ptr, &key, sizeof(int));
-
-  // store the value. 
-  if ((int)value.size() >= RecordFile::MAX_VALUE_LENGTH) {
-    // when the string is longer than MAX_VALUE_LENGTH, truncate it.
-    memcpy(ptr + sizeof(int), value.c_str(), RecordFile::MAX_VALUE_LENGTH -1);
-    *(ptr + sizeof(int) + RecordFile::MAX_VALUE_LENGTH - 1) = 0;
-  } else {
-    strcpy(ptr + sizeof(int), value.c_str());
-  }
+  int header[2];
+  unsigned short slot[2];
+
+  // the record goes right before the records in the page
+  memcpy(header, page, sizeof(header));
+  header[1] -= size;
+  slot[0] = header[1];
+  slot[1] = size | (overflowed ? OVERFLOW_FLAG : 0);
+  memcpy(page + PAGE_HEADER + SLOT_SIZE * header[0], slot, SLOT_SIZE);
+
+  header[0]++;
+  memcpy(page, header, sizeof(header));
+  return page + slot[0];
 }
@@ -11,6 +11,7 @@
 #define RECORDFILE_H
 
 #include <string>
+#include <climits>
 #include "PageFile.h"
 
 /**
@@ -39,18 +40,48 @@ bool operator== (const RecordId& r1, const RecordId& r2);
 bool operator!= (const RecordId& r1, const RecordId& r2);
 
 /**
- * read/write a record to a file
+ * read/write a record to a file.
+ * the first page of the file is a header page that records the page size
+ * the file was written with. files written before the header page was
+ * introduced start with a record page and have 1KB pages.
+ * records are kept in slotted pages: a record takes the length of its
+ * value and a page holds as many records as fit (see RecordFile.cc).
+ * a value too long for a page is stored in overflow pages.
+ * a file can be created columnar instead: its pages hold the keys alone,
+ * and the values are kept apart in a value column (filename + ".val")
+ * with their offsets in an offset column (filename + ".off"). a scan
+ * that needs the keys alone (see readNextKey()) then reads 4 bytes
+ * per record.
+ * older files, which give every value LEGACY_VALUE_LENGTH bytes, can be
+ * read but not appended to.
+ * the smallest and the largest key of every page are kept in a zone map
+ * (filename + ".zone"), so that a scan for a key range skips the pages
+ * that cannot hold a key in the range (see readNext()). a file that had
+ * records before it had a zone map goes without one.
  */
 class RecordFile {
  public:
 
-  // maximum length of the value field
-  static const int MAX_VALUE_LENGTH = 100;  
+  static const int FILE_MAGIC = 0x46524242;    // "BBRF", at the header start
+  static const int LEGACY_PAGE_SIZE = 1024;   // page size of headerless files
 
-  // number of record slots per page
-  static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
-    // Note that we subtract sizeof(int) from PAGE_SIZE because the first
-    // four bytes in the page is used to store # records in the page.
+  // the length of the value field in the fixed-slot pages of older files
+  static const int LEGACY_VALUE_LENGTH = 100;
+
+  // # of keys in a page of a columnar file. a page starts with
+  // # records in it
+  static const int KEYS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int)) / sizeof(int);
+
+  // # of value offsets in a page of the offset column
+  static const int OFFSETS_PER_PAGE = PageFile::PAGE_SIZE / sizeof(long long);
+
+  // the largest # of records in a page, which a columnar page holds.
+  // a slotted page holds fewer: a record takes a slot (two shorts),
+  // the key and a NUL at least
+  static const int RECORDS_PER_PAGE = KEYS_PER_PAGE;
+
+  // # of pages whose smallest and largest keys a page of the zone map holds
+  static const int ZONES_PER_PAGE = PageFile::PAGE_SIZE / (2 * sizeof(int));
 
   RecordFile();
   RecordFile(const std::string& filename, char mode);
@@ -58,11 +89,17 @@ class RecordFile {
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * 'm' mode is a read-only mode that maps the file into memory
+   * (see PageFile::open()). it is meant for sequential scans.
    * @param filename[IN] the name of the file to open
-   * @param mode[IN] 'r' for read, 'w' for write
-   * @return error code. 0 if no error
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for mapped read
+   * @param columnar[IN] true to create the file columnar if it does not
+   *    exist. an existing file keeps its format
+   * @return error code. 0 if no error.
+   *    RC_INVALID_FILE_FORMAT - when the file has another page size,
+   *    or has fixed-slot pages and is opened in 'w' mode
    */
-  RC open(const std::string& filename, char mode);
+  RC open(const std::string& filename, char mode, bool columnar = false);
 
   /**
    * close the file.
@@ -79,6 +116,74 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * read a record in place, without copying its value.
+   * page keeps the page of the record pinned, so that reading the next
+   * record of the same page does not access the PageFile again.
+   * value stays valid until page is released or used for another page.
+   * a value in overflow pages is put together in a buffer of the file
+   * instead, and stays valid until the next read.
+   * @param rid[IN] the id of the record to read
+   * @param key[OUT] the record key
+   * @param value[OUT] the record value inside the page
+   * @param page[IN/OUT] the handle of the page of the last record read
+   * @return error code. 0 if no error
+   */
+  RC read(const RecordId& rid, int& key, const char*& value,
+          PageHandle& page) const;
+
+  /**
+   * read the record at rid in place, or the first record after it
+   * when there is none at rid, as in a scan of the file. since the #
+   * of records varies from page to page, a scan cannot go through the
+   * file by ++rid alone:
+   *   for (rid = rf.beginRid(); rf.readNext(rid, ...) == 0; ++rid)
+   * the pages that the zone map shows to hold no key in [low, high] are
+   * skipped. the records of the other pages are all read, whatever
+   * their keys.
+   * @param rid[IN/OUT] where to start. set to the id of the record read
+   * @param key[OUT] the record key
+   * @param value[OUT] the record value (see read())
+   * @param page[IN/OUT] the handle of the page of the last record read
+   * @param low[IN] the smallest key the scan looks for
+   * @param high[IN] the largest key the scan looks for
+   * @return error code. 0 if no error.
+   *    RC_END_OF_FILE - when there is no record at or after rid
+   */
+  RC readNext(RecordId& rid, int& key, const char*& value, PageHandle& page,
+              int low = INT_MIN, int high = INT_MAX) const;
+
+  /**
+   * read the key of the record at rid, or of the first record after it,
+   * as readNext() does. the value is not read: the value column of a
+   * columnar file and the overflow pages of a long value are not touched.
+   * @param rid[IN/OUT] where to start. set to the id of the record read
+   * @param key[OUT] the record key
+   * @param page[IN/OUT] the handle of the page of the last record read
+   * @param low[IN] the smallest key the scan looks for
+   * @param high[IN] the largest key the scan looks for
+   * @return error code. 0 if no error.
+   *    RC_END_OF_FILE - when there is no record at or after rid
+   */
+  RC readNextKey(RecordId& rid, int& key, PageHandle& page,
+                 int low = INT_MIN, int high = INT_MAX) const;
+
+  /**
+   * start reading the page of a record in the background, so that
+   * a later read() of the record does not wait for the disk.
+   * @param rid[IN] the id of the record that will be read
+   * @return error code. 0 if no error
+   */
+  RC prefetch(const RecordId& rid) const;
+
+  /**
+   * read the # of records on a page of the file.
+   * @param pid[IN] the page. the overflow pages of long values hold none
+   * @param count[OUT] the # of records on the page
+   * @return error code. 0 if no error
+   */
+  RC recordCount(PageId pid, int& count) const;
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
@@ -96,9 +201,141 @@ class RecordFile {
    */
   const RecordId& endRid() const;
 
+  /**
+   * a scan of the file starts at this record id.
+   * @return the first record id of the RecordFile
+   */
+  const RecordId& beginRid() const;
+
+  /**
+   * @return true if the file is columnar
+   */
+  bool isColumnar() const { return format == COLUMNAR; }
+
+  /**
+   * @return true if the file has a zone map
+   */
+  bool hasZoneMap() const { return zoned; }
+
  private:
+  friend class RecordAppender;
+
+  enum Format { FIXED_SLOT, SLOTTED, COLUMNAR };
+
+  RC readHeader();
+  RC writeHeader(Format format);
+  RC readRecord(const char* page, const RecordId& rid, int& key,
+                const char** value) const;
+  RC readOverflow(const char* record, const char*& value) const;
+  RC readOffset(int row, long long& offset) const;
+  RC readValue(int row, const char*& value) const;
+  int rowOf(const RecordId& rid) const;
+  RC nextRecord(RecordId& rid, int& key, const char** value, PageHandle& page,
+                int low, int high) const;
+  RC openZones(const std::string& filename, char mode);
+  bool inZone(PageId pid, int low, int high) const;
+
   PageFile pf;     // the PageFile used to store the records
+  RecordId brid;   // the first record id of the file
   RecordId erid;   // the last record id of the file + 1
+  Format format;   // how the records are laid out in the pages
+  mutable std::string overflow;  // the last value put together from pages
+
+  // the value and offset columns of a columnar file
+  PageFile valFile;
+  PageFile offFile;
+  mutable PageHandle valPage;  // the value page of the last value read
+  mutable PageHandle offPage;  // the offset page of the last value read
+
+  // the zone map. the smallest and the largest key of page pid are the
+  // ints 2*pid and 2*pid+1 of the file
+  PageFile zoneFile;
+  bool zoned;                   // true if the file has a zone map
+  mutable PageHandle zonePage;  // the zone map page read last
+};
+
+/**
+ * append records to a RecordFile a run of pages at a time.
+ * RecordFile::append() reads and writes the last page of the file for
+ * every record. an appender fills the pages in memory instead and writes
+ * RUN_PAGES of them at once (see PageFile::writeRun()), so a large load
+ * costs one write per run. the end rid of the file advances with every
+ * append(), but the records are on the disk only after flush().
+ * the file must not be read or appended to otherwise until then.
+ * the records of a failed flush() stay in memory until discard().
+ */
+class RecordAppender {
+ public:
+  static const int RUN_PAGES = (64 << 10) / PageFile::PAGE_SIZE;  // 64KB
+
+  RecordAppender(RecordFile& rf);
+
+  /**
+   * flush() the records still in memory, or discard() them if that fails.
+   */
+  ~RecordAppender();
+
+  /**
+   * append a new record at the end of the file.
+   * @param key[IN] the record key
+   * @param value[IN] the record value
+   * @param rid[OUT] the location of the stored record
+   * @return error code. 0 if no error
+   */
+  RC append(int key, const std::string& value, RecordId& rid);
+
+  /**
+   * append a new record at the end of the file.
+   * @param key[IN] the record key
+   * @param value[IN] the record value. it does not have to be
+   *    NUL-terminated
+   * @param length[IN] the length of the value
+   * @param rid[OUT] the location of the stored record
+   * @return error code. 0 if no error
+   */
+  RC append(int key, const char* value, int length, RecordId& rid);
+
+  /**
+   * write the pages filled since the last flush() to the file.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * drop the records appended since the last flush(), e.g. after it
+   * failed. the end rid of the file goes back to the last record on
+   * the disk.
+   * @return the # of records dropped
+   */
+  int discard();
+
+ private:
+  RecordAppender(const RecordAppender&);             // not copyable
+  RecordAppender& operator=(const RecordAppender&);
+
+  RC pageOf(PageId pid, bool fresh, char*& page);
+  RC appendColumns(int key, const char* value, int length, RecordId& rid);
+  RC startColumns(int row);
+  RC zoneOf(PageId pid, int*& zone);
+
+  // the pages of the columns of a columnar file being filled
+  char*      offBuf;   // the offset page being filled
+  PageId     offPid;   // its id. -1 before the first columnar append
+  char*      valBuf;   // the value page being filled
+  PageId     valPid;   // its id
+  long long  valEnd;   // the end of the value column
+
+  // the page of the zone map being filled
+  int*       zoneBuf;
+  PageId     zonePid;  // its id. -1 before the first append
+
+  RecordFile& rf;  // the file to append to
+  char*   run;     // the pages being filled, one after another
+  PageId  runPid;  // the id of the first page in run
+  int     count;   // # of pages in run. 0 if nothing is buffered
+
+  RecordId durable;  // the end rid of the records on the disk
+  int     pending;   // # of records appended since the last flush()
 };
 
 #endif // RECORDFILE_H
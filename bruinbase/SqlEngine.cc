@@ -8,22 +8,111 @@
  */
 
 #include <cstdio>
+#include <cstring>
+#include <climits>
+#include <cmath>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeIndex.h"
+#include "TableStats.h"
+#include "LoadPipeline.h"
 
 using namespace std;
 
 #define index_file(name) name + ".idx"
 #define table_file(name) name + ".tbl"
+#define stats_file(name) name + ".stat"
+#define value_index_file(name) name + ".vdx"
 
 // external functions and variables for load file and sql command parsing 
 extern FILE* sqlin;
 int sqlparse(void);
 
 
+// report a table file that cannot be opened
+static void tableOpenError(const string& table, RC rc)
+{
+  if (rc == RC_INVALID_FILE_FORMAT) {
+    fprintf(stderr, "Error: table %s was written with another page size "
+            "or in an older format (reload it)\n", table.c_str());
+  } else {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+  }
+}
+
+// the # of record pages of a table file
+static int recordPageCount(const RecordFile& rf)
+{
+  return rf.endRid().pid - rf.beginRid().pid + (rf.endRid().sid > 0);
+}
+
+// leave some room in the nodes of a bulk loaded index for later inserts
+double SqlEngine::indexFillFactor = 0.9;
+
+RC SqlEngine::setIndexFillFactor(double fillFactor)
+{
+  if (fillFactor <= 0 || fillFactor > 1) return RC_INVALID_ATTRIBUTE;
+
+  indexFillFactor = fillFactor;
+  return 0;
+}
+
+// index scans print the tuples in table order unless asked for key order
+bool SqlEngine::keyOrder = false;
+
+RC SqlEngine::setKeyOrder(bool ordered)
+{
+  keyOrder = ordered;
+  return 0;
+}
+
+int SqlEngine::loadThreads = LoadPipeline::DEFAULT_THREAD_COUNT;
+
+RC SqlEngine::setLoadThreads(int threadCount)
+{
+  if (threadCount <= 0 || threadCount > LoadPipeline::MAX_THREAD_COUNT) {
+    return RC_INVALID_ATTRIBUTE;
+  }
+  loadThreads = threadCount;
+  return 0;
+}
+
+// indexes are not counted unless asked for
+bool SqlEngine::countedIndex = false;
+
+RC SqlEngine::setCountedIndex(bool counted)
+{
+  countedIndex = counted;
+  return 0;
+}
+
+// tables are stored in rows unless asked for
+bool SqlEngine::columnarTables = false;
+
+RC SqlEngine::setColumnarTables(bool columnar)
+{
+  columnarTables = columnar;
+  return 0;
+}
+
+SqlEngine::Plan SqlEngine::lastPlan = SqlEngine::TABLE_SCAN;
+
+const char* SqlEngine::getLastPlan()
+{
+  switch (lastPlan) {
+  case INDEX_ONLY: return "index-only scan";
+  case INDEX_SCAN: return "index range scan";
+  case RID_SCAN:   return "index range scan, rid-sorted fetch";
+  case VALUE_SCAN: return "value index range scan";
+  case NO_SCAN:    return "no scan, the key range is empty";
+  default:         return "table scan";
+  }
+}
+
 RC SqlEngine::run(FILE* commandline)
 {
   fprintf(stdout, "Bruinbase> ");
@@ -41,7 +130,7 @@ SqlEngine::_preprocess_selcond(vector<SelCond>& condV, struct SelCond cond)
 {
 	for (vector<SelCond>::iterator it = condV.begin();
 	     it != condV.end(); ++it) {
-		if (cond.attr == 1 && it->comp == cond.comp) {
+		if (cond.attr == 1 && it->attr == cond.attr && it->comp == cond.comp) {
 			int value = atoi(cond.value);
 			switch(cond.comp) {
 			case SelCond::LT:
@@ -91,60 +180,270 @@ SqlEngine::preprocess_selcond(vector<SelCond>& new_cond,
 	// 	cout << "attr: " << it->attr << ", comp: " << it->comp;
 	// 	cout << ", value: " << it->value << endl;
 	// }
+	return 0;
 }
 
+/*
+ * Find the smallest key the conditions on the key column let through.
+ * key is left as it is if they do not bound the key from below.
+ */
 RC
 SqlEngine::find_key(vector<SelCond> cond, int& key)
 {
 	for (vector<SelCond>::const_iterator it = cond.begin();
 	     it != cond.end(); ++it) {
-		if (it->attr == 1 &&
-		    it->comp == SelCond::GE) {
-				key = it->intValue;
-		} 
+		if (it->attr != 1) {
+			continue;
+		}
+		if ((it->comp == SelCond::GE || it->comp == SelCond::EQ) &&
+		    it->intValue > key) {
+			key = it->intValue;
+		} else if (it->comp == SelCond::GT && it->intValue + 1 > key) {
+			key = it->intValue + 1;
+		}
 	}
+
+	return 0;
+}
+
+/*
+ * Find the largest key the conditions on the key column let through.
+ * INT_MAX if they do not bound the key from above.
+ */
+RC
+SqlEngine::find_end_key(const vector<SelCond>& cond, int& endKey)
+{
+	endKey = INT_MAX;
 	for (vector<SelCond>::const_iterator it = cond.begin();
 	     it != cond.end(); ++it) {
-		if (it->attr == 1 &&
-		    it->comp == SelCond::GT) {
-				key = it->intValue + 1;
+		if (it->attr != 1) {
+			continue;
+		}
+		if ((it->comp == SelCond::LE || it->comp == SelCond::EQ) &&
+		    it->intValue < endKey) {
+			endKey = it->intValue;
+		} else if (it->comp == SelCond::LT && it->intValue - 1 < endKey) {
+			endKey = it->intValue - 1;
 		}
 	}
 
+	return 0;
+}
+
+// true if key satisfies every condition on the key column
+static bool keyMatches(int key, const vector<SelCond>& cond)
+{
 	for (vector<SelCond>::const_iterator it = cond.begin();
 	     it != cond.end(); ++it) {
-		if (it->attr == 1 && it->comp == SelCond::EQ) {
-			key = it->intValue;
+		if (it->attr != 1) {
+			continue;
+		}
+		switch (it->comp) {
+		case SelCond::EQ: if (key != it->intValue) return false; break;
+		case SelCond::NE: if (key == it->intValue) return false; break;
+		case SelCond::LT: if (key >= it->intValue) return false; break;
+		case SelCond::GT: if (key <= it->intValue) return false; break;
+		case SelCond::LE: if (key > it->intValue) return false; break;
+		case SelCond::GE: if (key < it->intValue) return false; break;
 		}
 	}
+	return true;
+}
+
+// true if the tuple satisfies every condition
+static bool tupleMatches(int key, const char* value, const vector<SelCond>& cond)
+{
+	if (!keyMatches(key, cond)) {
+		return false;
+	}
+	for (vector<SelCond>::const_iterator it = cond.begin();
+	     it != cond.end(); ++it) {
+		if (it->attr != 2) {
+			continue;
+		}
+		int diff = strcmp(value, it->value);
+		switch (it->comp) {
+		case SelCond::EQ: if (diff != 0) return false; break;
+		case SelCond::NE: if (diff == 0) return false; break;
+		case SelCond::LT: if (diff >= 0) return false; break;
+		case SelCond::GT: if (diff <= 0) return false; break;
+		case SelCond::LE: if (diff > 0) return false; break;
+		case SelCond::GE: if (diff < 0) return false; break;
+		}
+	}
+	return true;
+}
 
+// print a tuple for SELECT key, value or *
+static void printTuple(int attr, int key, const char* value)
+{
+	switch (attr) {
+	case 1:  // SELECT key
+		fprintf(stdout, "%d\n", key);
+		break;
+	case 2:  // SELECT value
+		fprintf(stdout, "%s\n", value);
+		break;
+	case 3:  // SELECT *
+		fprintf(stdout, "%d '%s'\n", key, value);
+		break;
+	}
+}
+
+// orders index entries by rid, which is the order of the table
+static bool ridLess(const IndexEntry& e1, const IndexEntry& e2)
+{
+	return e1.rid < e2.rid;
+}
+
+// orders index entries by key alone
+static bool entryKeyLess(const IndexEntry& e1, const IndexEntry& e2)
+{
+	return e1.key < e2.key;
+}
+
+// orders (key, value) pairs by key alone
+static bool valueLess(const ValueEntry& e1, const ValueEntry& e2)
+{
+	return e1.value < e2.value;
+}
+
+// drops the index entries of the tuples at or past end, which did not
+// make it to the disk
+template <class Entry>
+static void dropFrom(vector<Entry>& entries, const RecordId& end)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].rid < end) {
+			entries[n++] = entries[i];
+		}
+	}
+	entries.resize(n);
+}
+
+static bool pairKeyLess(const pair<int, string>& t1, const pair<int, string>& t2)
+{
+	return t1.first < t2.first;
+}
+
+RC
+SqlEngine::print_keys(BTreeIndex& btIndex, int attr, int key,
+		      const vector<SelCond>& cond)
+{
+	IndexCursor cursor;
+	IndexEntry batch[BTLeafNode::MAX_LEAF_KEY_COUNT];
+	int endKey;
+	int count = 0;
+	int n;
+
+	find_end_key(cond, endKey);
+
+	// a counted index counts the keys in [key, endKey] from two paths
+	// down the tree. only a NE condition can exclude keys in the range
+	if (attr == 4 && btIndex.isCounted()) {
+		if (btIndex.countRange(key, endKey, count)) {
+			fprintf(stderr, "Error: BTreeIndex count failed\n");
+			return -1;
+		}
+		for (vector<SelCond>::const_iterator it = cond.begin();
+		     it != cond.end(); ++it) {
+			if (it->comp == SelCond::NE && key <= it->intValue &&
+			    it->intValue <= endKey &&
+			    !btIndex.countRange(it->intValue, it->intValue, n)) {
+				count -= n;
+			}
+		}
+		fprintf(stdout, "%d\n", count);
+		return 0;
+	}
+
+	if (btIndex.locate(key, cursor)) {
+		fprintf(stderr, "Error: BTreeIndex locate on %d failed\n", key);
+		return -1;
+	}
+	btIndex.setReadAheadLimit(endKey);
+
+	// the keys come from the leaf nodes, one leaf node at a time
+	while (!btIndex.readBatch(cursor, endKey, batch,
+				  BTLeafNode::MAX_LEAF_KEY_COUNT, n)) {
+		for (int i = 0; i < n; i++) {
+			if (!keyMatches(batch[i].key, cond)) {
+				continue;
+			}
+			count++;
+			if (attr == 1) {
+				fprintf(stdout, "%d\n", batch[i].key);
+			}
+		}
+	}
+
+	// print matching tuple count if "select count(*)"
+	if (attr == 4) {
+		fprintf(stdout, "%d\n", count);
+	}
 	return 0;
 }
 
 RC
-SqlEngine::print_tuples(BTreeIndex btIndex, int attr,
+SqlEngine::print_tuples(BTreeIndex& btIndex, int attr,
 			const string& table, int key,
 			vector<SelCond> cond)
 {
 	RC rc;
 	int count = 0;
 	string value;
-	RecordId rid;
 	RecordFile rf;
 	IndexCursor cursor;
+	IndexEntry batch[BATCH_CAPACITY]; // entries read from the index
+	int head = 0, tail = 0;           // the entries left in batch[head..tail)
+	int ahead = 0;                    // tuples of batch[..ahead) are prefetched
+	int endKey;                       // no tuple beyond this key matches
+	int n;
 
 	if ((rc = rf.open(table_file(table), 'r')) < 0) {
-		fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+		tableOpenError(table, rc);
 		return rc;
 	}
 
 	if (btIndex.locate(key, cursor)) {
 		fprintf(stderr, "Error: BTreeIndex locate on %d failed\n", key);
+		rf.close();
 		return -1;
 	}
 
-	while (!btIndex.readForward(cursor, key, rid) &&
-	       !rf.read(rid, key, value)) {
+	// find where the key range of the scan ends
+	find_end_key(cond, endKey);
+	btIndex.setReadAheadLimit(endKey);
+
+	for (;;) {
+		// read the entries of the next leaf node when the batch runs low.
+		// the room left always holds a whole leaf node
+		if (tail - head < READ_AHEAD_DEPTH && cursor.pid >= 0) {
+			memmove(batch, batch + head, (tail - head) * sizeof(IndexEntry));
+			tail -= head;
+			ahead -= head;
+			head = 0;
+			if (btIndex.readBatch(cursor, endKey, batch + tail,
+					      BATCH_CAPACITY - tail, n)) {
+				cursor.pid = -1;
+			} else {
+				tail += n;
+			}
+		}
+
+		// keep READ_AHEAD_DEPTH tuples ahead of the scan
+		// and start reading their table pages in the background
+		for (; ahead < tail && ahead < head + READ_AHEAD_DEPTH; ahead++) {
+			if (ahead == 0 || batch[ahead].rid.pid != batch[ahead - 1].rid.pid) {
+				rf.prefetch(batch[ahead].rid);
+			}
+		}
+		if (head == tail || rf.read(batch[head++].rid, key, value)) {
+			break;
+		}
+
 		for (vector<SelCond>::const_iterator it = cond.begin();
 		     it != cond.end(); ++it) {
 			if (it->attr == 1) {
@@ -252,22 +551,404 @@ SqlEngine::print_tuples(BTreeIndex btIndex, int attr,
 		fprintf(stdout, "%d\n", count);
 	}
 
-	return 0;
+	return rf.close();
+}
+
+/*
+ * Pick the access path of a SELECT on a table with an index.
+ * SELECT key and COUNT(*) with conditions on the key column alone are
+ * covered by the index, and its leaf nodes hold many more entries per
+ * page than the table holds tuples, so they are read instead of the table.
+ * Otherwise the cost of a range scan, which reads the table pages of the
+ * matching tuples through their rids, is weighed against a sequential
+ * scan of the whole table. The matching tuples are estimated from the key
+ * range of the conditions, taking the keys to be spread evenly between
+ * the smallest and the largest key of the index.
+ */
+SqlEngine::Plan
+SqlEngine::choose_plan(BTreeIndex& btIndex, int attr, const string& table,
+		       const vector<SelCond>& cond, const TableStats* stats)
+{
+	vector<SelCond> new_cond;
+	RecordFile rf;
+	IndexCursor cursor;
+	IndexEntry sample[BTLeafNode::MAX_LEAF_KEY_COUNT];
+	int key = INT_MIN, endKey;
+	int minKey, maxKey;
+	int n, distinct, perPage = 1;
+	bool covered = (attr == 1 || attr == 4);
+	double rows, pages, matches, scatter, fetches, leaves;
+	double indexCost, ridCost;
+
+	preprocess_selcond(new_cond, cond);
+	for (vector<SelCond>::const_iterator it = new_cond.begin();
+	     it != new_cond.end(); ++it) {
+		if (it->attr != 1) {
+			covered = false;
+		}
+	}
+	if (covered) {
+		return INDEX_ONLY;
+	}
+
+	if (btIndex.getKeyRange(minKey, maxKey)) {
+		return INDEX_SCAN;  // the index scan reports the error
+	}
+	find_key(new_cond, key);
+	find_end_key(new_cond, endKey);
+	if (max(key, minKey) > min(endKey, maxKey)) {
+		return INDEX_SCAN;  // nothing matches. the index tells quickly
+	}
+
+	if (stats) {
+		// the key histogram follows skewed keys
+		rows = stats->getRowCount();
+		pages = stats->getPageCount();
+		matches = stats->estimateRange(key, endKey);
+	} else {
+		// without statistics, the table size comes from the end rid of
+		// the table, and the tuples per page from its first page
+		if (rf.open(table_file(table), 'r')) {
+			return INDEX_SCAN;
+		}
+		pages = recordPageCount(rf);
+		if (pages > 0 && rf.recordCount(rf.beginRid().pid, perPage)) {
+			perPage = 1;
+		}
+		rows = pages * max(perPage, 1);
+		rf.close();
+		matches = rows * ((double) min(endKey, maxKey) - max(key, minKey) + 1) /
+			((double) maxKey - minKey + 1);
+	}
+	if (pages == 0) {
+		return TABLE_SCAN;
+	}
+
+	// sample how scattered the tuples of the range are over the table
+	// from the first leaf node of the range: 1 if every entry points to
+	// another table page, 1 / RECORDS_PER_PAGE if the table is in key
+	// order. the range scan reads the same nodes first
+	scatter = 1;
+	btIndex.setReadAheadLimit(endKey);
+	if (!btIndex.locate(key, cursor) &&
+	    !btIndex.readBatch(cursor, endKey, sample,
+			       BTLeafNode::MAX_LEAF_KEY_COUNT, n)) {
+		distinct = 1;
+		for (int i = 1; i < n; i++) {
+			distinct += (sample[i].rid.pid != sample[i - 1].rid.pid);
+		}
+		scatter = (double) distinct / n;
+	}
+
+	// the tree is walked down once and the leaf nodes of the range are
+	// read in order. the table pages of the matches are read once each,
+	// at random unless the tuples are clustered by key
+	fetches = min(matches * scatter, pages * (1 - pow(1 - 1 / pages, matches)));
+	leaves = matches / (BTLeafNode::MAX_LEAF_KEY_COUNT * indexFillFactor);
+	indexCost = btIndex.getTreeHeight() + leaves +
+		(1 + (RANDOM_PAGE_COST - 1) * scatter) * fetches;
+
+	// sorting the rids first turns the random reads into reads in file
+	// order, for the cost of the sort
+	ridCost = btIndex.getTreeHeight() + leaves + fetches +
+		matches * log2(max(matches, 2.0)) / RID_COMPARES_PER_PAGE;
+
+	if (min(indexCost, ridCost) >= pages) {
+		return TABLE_SCAN;
+	}
+	return ridCost < indexCost ? RID_SCAN : INDEX_SCAN;
+}
+
+/*
+ * Return true if the statistics of the table show that no key satisfies
+ * the conditions on the key column.
+ */
+bool
+SqlEngine::key_range_empty(const TableStats& stats, const vector<SelCond>& cond)
+{
+	vector<SelCond> new_cond;
+	int key = INT_MIN, endKey;
+
+	preprocess_selcond(new_cond, cond);
+	find_key(new_cond, key);
+	find_end_key(new_cond, endKey);
+
+	return stats.getRowCount() == 0 ||
+	       max(key, stats.getMinKey()) > min(endKey, stats.getMaxKey());
+}
+
+/*
+ * Find the range of values the conditions on the value column let
+ * through. low is the largest of their lower bounds and high the
+ * smallest of their upper bounds, NULL if there is none. A strict bound
+ * is taken as inclusive: the tuples are checked against the conditions
+ * anyway. Return false if no condition bounds the value.
+ */
+bool
+SqlEngine::find_value_range(const vector<SelCond>& cond,
+			    const char*& low, const char*& high)
+{
+	low = high = NULL;
+	for (vector<SelCond>::const_iterator it = cond.begin();
+	     it != cond.end(); ++it) {
+		if (it->attr != 2) {
+			continue;
+		}
+		if (it->comp == SelCond::EQ || it->comp == SelCond::GE ||
+		    it->comp == SelCond::GT) {
+			if (low == NULL || strcmp(it->value, low) > 0) {
+				low = it->value;
+			}
+		}
+		if (it->comp == SelCond::EQ || it->comp == SelCond::LE ||
+		    it->comp == SelCond::LT) {
+			if (high == NULL || strcmp(it->value, high) < 0) {
+				high = it->value;
+			}
+		}
+	}
+	return low != NULL || high != NULL;
+}
+
+/*
+ * Decide whether the value index answers a query with conditions on
+ * the value column more cheaply than a scan of the table. There is no
+ * histogram of the values, so the entries of the value range are counted
+ * in the index instead, a leaf node at a time, until fetching their
+ * tuples in rid order would cost as much as the table scan.
+ */
+SqlEngine::Plan
+SqlEngine::choose_value_plan(ValueIndex& vIndex, const string& table,
+			     const vector<SelCond>& cond)
+{
+	PageFile pf;
+	IndexCursor cursor;
+	vector<RecordId> rids;
+	const char *low, *high;
+	double pages, matches, fetches;
+	int leaves = 0;
+
+	if (!find_value_range(cond, low, high)) {
+		return TABLE_SCAN;
+	}
+	if (low != NULL && high != NULL && strcmp(low, high) > 0) {
+		return VALUE_SCAN;  // nothing matches. the index tells quickly
+	}
+	if (pf.open(table_file(table), 'r')) {
+		return VALUE_SCAN;  // the index scan reports the error
+	}
+	pages = max(0, pf.endPid() - 1);
+	pf.close();
+	if (pages == 0 || vIndex.locate(low ? low : "", low ? strlen(low) : 0, cursor)) {
+		return TABLE_SCAN;
+	}
+
+	while (!vIndex.readBatch(cursor, high, high ? strlen(high) : 0, rids)) {
+		leaves++;
+		matches = rids.size();
+		fetches = pages * (1 - pow(1 - 1 / pages, matches));
+		if (vIndex.getTreeHeight() + leaves + fetches +
+		    matches * log2(max(matches, 2.0)) / RID_COMPARES_PER_PAGE >= pages) {
+			return TABLE_SCAN;
+		}
+	}
+	return VALUE_SCAN;
+}
+
+/*
+ * Scan the tuples with keys from key on through the index like
+ * print_tuples(), but fetch them in the order of the table: the entries
+ * of the range are read RID_BATCH_SIZE at a time and sorted by rid, so
+ * each table page of a batch is read once, and in file order.
+ * The tuples of a batch are sorted by key before they are printed if
+ * setKeyOrder() asked for it. The batches follow one another in key
+ * order, so the whole output is then in key order.
+ */
+RC
+SqlEngine::print_tuples_by_rid(BTreeIndex& btIndex, int attr,
+			       const string& table, int key,
+			       const vector<SelCond>& cond)
+{
+	RC rc = 0;
+	int count = 0;
+	RecordFile rf;
+	IndexCursor cursor;
+	vector<IndexEntry> batch;         // the entries of the batch
+	vector<pair<int, string> > rows;  // the matches of the batch, for key order
+	PageHandle page;                  // the page of the last tuple read
+	const char* value;
+	size_t ahead;                     // tuples of batch[..ahead) are prefetched
+	size_t size;
+	int endKey;
+	int n;
+
+	if ((rc = rf.open(table_file(table), 'r')) < 0) {
+		tableOpenError(table, rc);
+		return rc;
+	}
+
+	if (btIndex.locate(key, cursor)) {
+		fprintf(stderr, "Error: BTreeIndex locate on %d failed\n", key);
+		rf.close();
+		return -1;
+	}
+	find_end_key(cond, endKey);
+	btIndex.setReadAheadLimit(endKey);
+
+	batch.reserve(RID_BATCH_SIZE + BTLeafNode::MAX_LEAF_KEY_COUNT);
+	while (cursor.pid >= 0) {
+		// read whole leaf nodes until the batch is full
+		batch.clear();
+		while (batch.size() < (size_t) RID_BATCH_SIZE && cursor.pid >= 0) {
+			size = batch.size();
+			batch.resize(size + BTLeafNode::MAX_LEAF_KEY_COUNT);
+			if (btIndex.readBatch(cursor, endKey, &batch[size],
+					      BTLeafNode::MAX_LEAF_KEY_COUNT, n)) {
+				n = 0;
+				cursor.pid = -1;
+			}
+			batch.resize(size + n);
+		}
+		sort(batch.begin(), batch.end(), ridLess);
+
+		ahead = 0;
+		for (size_t i = 0; i < batch.size(); i++) {
+			// start reading the next READ_AHEAD_DEPTH tuples'
+			// pages in the background, each page once
+			for (; ahead < batch.size() && ahead < i + READ_AHEAD_DEPTH; ahead++) {
+				if (ahead == 0 || batch[ahead].rid.pid != batch[ahead - 1].rid.pid) {
+					rf.prefetch(batch[ahead].rid);
+				}
+			}
+			if ((rc = rf.read(batch[i].rid, key, value, page)) < 0) {
+				fprintf(stderr, "Error: while reading a tuple from table %s\n",
+					table.c_str());
+				goto exit;
+			}
+			if (!tupleMatches(key, value, cond)) {
+				continue;
+			}
+			count++;
+			if (keyOrder && attr != 4) {
+				rows.push_back(make_pair(key, string(value)));
+			} else {
+				printTuple(attr, key, value);
+			}
+		}
+
+		stable_sort(rows.begin(), rows.end(), pairKeyLess);
+		for (size_t i = 0; i < rows.size(); i++) {
+			printTuple(attr, rows[i].first, rows[i].second.c_str());
+		}
+		rows.clear();
+	}
+
+	// print matching tuple count if "select count(*)"
+	if (attr == 4) {
+		fprintf(stdout, "%d\n", count);
+	}
+
+ exit:
+	page.unpin();
+	rf.close();
+	return rc;
+}
+
+/*
+ * Scan the tuples whose values are in the value range of the conditions
+ * through the value index. As in print_tuples_by_rid(), the rids of the
+ * range are read RID_BATCH_SIZE at a time and sorted, so each table page
+ * of a batch is read once, and in file order.
+ */
+RC
+SqlEngine::print_tuples_by_value(ValueIndex& vIndex, int attr,
+				 const string& table,
+				 const vector<SelCond>& cond)
+{
+	RC rc = 0;
+	int count = 0;
+	int key;
+	RecordFile rf;
+	IndexCursor cursor;
+	vector<RecordId> batch;   // the rids of the batch
+	PageHandle page;          // the page of the last tuple read
+	const char *value, *low, *high;
+	size_t ahead;             // tuples of batch[..ahead) are prefetched
+
+	if ((rc = rf.open(table_file(table), 'r')) < 0) {
+		tableOpenError(table, rc);
+		return rc;
+	}
+
+	find_value_range(cond, low, high);
+	if (vIndex.locate(low ? low : "", low ? strlen(low) : 0, cursor)) {
+		fprintf(stderr, "Error: ValueIndex locate failed\n");
+		rf.close();
+		return -1;
+	}
+
+	batch.reserve(RID_BATCH_SIZE + BTValueNode::CAPACITY);
+	while (cursor.pid >= 0) {
+		// read whole leaf nodes until the batch is full
+		batch.clear();
+		while (batch.size() < (size_t) RID_BATCH_SIZE && cursor.pid >= 0) {
+			if (vIndex.readBatch(cursor, high, high ? strlen(high) : 0, batch)) {
+				cursor.pid = -1;
+			}
+		}
+		sort(batch.begin(), batch.end());
+
+		ahead = 0;
+		for (size_t i = 0; i < batch.size(); i++) {
+			// start reading the next READ_AHEAD_DEPTH tuples'
+			// pages in the background, each page once
+			for (; ahead < batch.size() && ahead < i + READ_AHEAD_DEPTH; ahead++) {
+				if (ahead == 0 || batch[ahead].pid != batch[ahead - 1].pid) {
+					rf.prefetch(batch[ahead]);
+				}
+			}
+			if ((rc = rf.read(batch[i], key, value, page)) < 0) {
+				fprintf(stderr, "Error: while reading a tuple from table %s\n",
+					table.c_str());
+				goto exit;
+			}
+			if (tupleMatches(key, value, cond)) {
+				count++;
+				printTuple(attr, key, value);
+			}
+		}
+	}
+
+	// print matching tuple count if "select count(*)"
+	if (attr == 4) {
+		fprintf(stdout, "%d\n", count);
+	}
+
+ exit:
+	page.unpin();
+	rf.close();
+	return rc;
 }
 
 RC
-SqlEngine::select_from_index(BTreeIndex btIndex, int attr,
+SqlEngine::select_from_index(BTreeIndex& btIndex, Plan plan, int attr,
 			     const string& table,
 			     const vector<SelCond>& cond)
 {
-	int key = 0;
+	int key = INT_MIN;  // scan from the smallest key unless bounded below
 	vector<SelCond> new_cond;
 
 	preprocess_selcond(new_cond, cond);
 
 	find_key(new_cond, key);
 
-	print_tuples(btIndex, attr, table, key, new_cond);
+	if (plan == INDEX_ONLY) {
+		print_keys(btIndex, attr, key, new_cond);
+	} else if (plan == RID_SCAN) {
+		print_tuples_by_rid(btIndex, attr, table, key, new_cond);
+	} else {
+		print_tuples(btIndex, attr, table, key, new_cond);
+	}
 
 	return btIndex.close();
 }
@@ -277,33 +958,85 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   RecordFile rf;   // RecordFile containing the table
   RecordId   rid;  // record cursor for table scanning
   BTreeIndex btIndex;
+  ValueIndex vIndex;
 
   RC     rc;
   int    key;     
-  string value;
+  const char* value;  // the value of the tuple in the page
+  PageHandle  page;   // the page of the current tuple
   int    count;
-  int    diff;
+  int    diff = 0;
+  bool   keysOnly;  // true if the scan reads the keys alone
+  vector<SelCond> new_cond;
+  int    low = INT_MIN, high;  // the key range of the conditions
+
+  // the statistics of the table tell when nothing can match.
+  // they may outlive the table, so the table has to exist
+  TableStats stats;
+  bool hasStats = !stats.read(stats_file(table));
+  if (hasStats && key_range_empty(stats, cond) &&
+      ::access((table_file(table)).c_str(), F_OK) == 0) {
+    lastPlan = NO_SCAN;
+    if (attr == 4) {
+      fprintf(stdout, "0\n");
+    }
+    return 0;
+  }
 
-  // check if the index file exists?
+  // use the index if there is one and the planner finds it cheaper
+  lastPlan = TABLE_SCAN;
   if (!btIndex.open(index_file(table), 'r')) {
-	  return select_from_index(btIndex, attr, table, cond);
+    lastPlan = choose_plan(btIndex, attr, table, cond,
+                           hasStats ? &stats : NULL);
+    if (lastPlan != TABLE_SCAN) {
+      return select_from_index(btIndex, lastPlan, attr, table, cond);
+    }
+    btIndex.close();
   }
+  preprocess_selcond(new_cond, cond);
 
-  // open the table file
-  if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
-    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+  // the index on the value column serves the conditions on the value.
+  // the tuples it returns are checked against the conditions as given,
+  // unmerged, with the values of the key conditions parsed
+  if (!vIndex.open(value_index_file(table), 'r')) {
+    vector<SelCond> value_cond(cond);
+    for (unsigned i = 0; i < value_cond.size(); i++) {
+      if (value_cond[i].attr == 1) {
+        value_cond[i].intValue = atoi(value_cond[i].value);
+      }
+    }
+    if (choose_value_plan(vIndex, table, value_cond) == VALUE_SCAN) {
+      lastPlan = VALUE_SCAN;
+      rc = print_tuples_by_value(vIndex, attr, table, value_cond);
+      vIndex.close();
+      return rc;
+    }
+    vIndex.close();
+  }
+
+  // open the table file. the file is mapped into memory
+  // and the tuples are read in place while scanning
+  if ((rc = rf.open(table + ".tbl", 'm')) < 0) {
+    tableOpenError(table, rc);
     return rc;
   }
 
+  // a query that reads no value reads only the keys of a columnar table
+  keysOnly = rf.isColumnar() && attr != 2 && attr != 3;
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 1) keysOnly = false;
+  }
+
+  // the zone map of the table lets the scan skip the pages without
+  // a key in the range
+  find_key(new_cond, low);
+  find_end_key(new_cond, high);
+
   // scan the table file from the beginning
-  rid.pid = rid.sid = 0;
+  rid = rf.beginRid();
   count = 0;
-  while (rid < rf.endRid()) {
-    // read the tuple
-    if ((rc = rf.read(rid, key, value)) < 0) {
-      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-      goto exit_select;
-    }
+  while ((rc = keysOnly ? rf.readNextKey(rid, key, page, low, high)
+                        : rf.readNext(rid, key, value, page, low, high)) == 0) {
 
     // check the conditions on the tuple
     for (unsigned i = 0; i < cond.size(); i++) {
@@ -313,7 +1046,7 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 	diff = key - atoi(cond[i].value);
 	break;
       case 2:
-	diff = strcmp(value.c_str(), cond[i].value);
+	diff = strcmp(value, cond[i].value);
 	break;
       }
 
@@ -350,10 +1083,10 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
       fprintf(stdout, "%d\n", key);
       break;
     case 2:  // SELECT value
-      fprintf(stdout, "%s\n", value.c_str());
+      fprintf(stdout, "%s\n", value);
       break;
     case 3:  // SELECT *
-      fprintf(stdout, "%d '%s'\n", key, value.c_str());
+      fprintf(stdout, "%d '%s'\n", key, value);
       break;
     }
 
@@ -361,6 +1094,10 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
     next_tuple:
     ++rid;
   }
+  if (rc != RC_END_OF_FILE) {
+    fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+    goto exit_select;
+  }
 
   // print matching tuple count if "select count(*)"
   if (attr == 4) {
@@ -370,94 +1107,389 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 
   // close the table file and return
   exit_select:
+  page.unpin();
   rf.close();
   return rc;
 }
 
-RC SqlEngine::load(const string& table, const string& loadfile, bool index)
+// print where the time of a LOAD went: the parsers (summed over the
+// threads), appending to the table, and building the index. the time
+// the writer waited for the parsers tells which side holds the other up
+static void reportLoad(const LoadPipeline& pipeline, int count, double total,
+		       double writeTime, double indexTime)
 {
-	int key;
-	string value, line;
-	ifstream infile;
+	double mb = pipeline.getByteCount() / 1048576.0;
+	double parseTime = pipeline.getParseTime();
+
+	fprintf(stderr, "  -- %.3f seconds to load %d tuples (%.1f MB)\n",
+		total, count, mb);
+	fprintf(stderr, "     parse: %.3f s on %d threads, %.1f MB/s per thread\n",
+		parseTime, pipeline.getThreadCount(),
+		parseTime > 0 ? mb / parseTime : 0.0);
+	fprintf(stderr, "     write: %.3f s, %.0f tuples/s. waited %.3f s for the parsers\n",
+		writeTime, writeTime > 0 ? count / writeTime : 0.0,
+		pipeline.getWaitTime());
+	if (indexTime > 0) {
+		fprintf(stderr, "     index: %.3f s, %.0f tuples/s\n",
+			indexTime, count / indexTime);
+	}
+}
+
+RC SqlEngine::load(const string& table, const string& loadfile, bool index,
+		     bool valueIndex)
+{
+	LoadPipeline pipeline;       // reads and parses the load file
+	vector<LoadTuple> tuples;    // the tuples of a chunk of the file
 	RecordId rid = {0, 0};
 	RecordFile rf;
+	RecordAppender appender(rf);
 	RC rc;
 	BTreeIndex btIndex;
+	vector<IndexEntry> entries;  // the entries of a new index
+	vector<IndexEntry> run;      // the entries of a chunk, to insert
+	bool bulk = false;           // true to bulk load a new index
+	ValueIndex vIndex;
+	vector<ValueEntry> values;   // the entries of a new value index, or of a chunk
+	bool byValue;                // true to index the values
+	bool valueBulk = false;      // true to bulk load a new value index
+	TableStats stats;
+	bool collect;                // true to collect the stats while loading
+	bool failed = false;         // true once writing the table or an index insert failed
+	RC error = 0;                // the error of writing the table
+	int count = 0;               // # of tuples loaded
+	double start, mark, writeTime = 0, indexTime = 0;
 
-	infile.open(loadfile.c_str());
-	if (!infile.is_open()) {
+	// the parser threads start on the file while the table is opened
+	start = LoadPipeline::now();
+	if (pipeline.open(loadfile, loadThreads) < 0) {
 		fprintf(stderr, "Error: Failed to open %s\n", loadfile.c_str());
 		return -1;
 	}
 
-	if ((rc = rf.open(table_file(table), 'w')) < 0) {
-		fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+	if ((rc = rf.open(table_file(table), 'w', columnarTables)) < 0) {
+		tableOpenError(table, rc);
 		return rc;
 	}
 
+	// the tuples of an empty table are all loaded here, so its
+	// statistics are collected on the way. otherwise the table is
+	// analyzed once the tuples are in
+	collect = (rf.endRid() == rf.beginRid());
+
+	// as the index on the value column below, an index on the key column
+	// is kept up to date once it exists, and rebuilt for an empty table
+	index = index || ::access((index_file(table)).c_str(), F_OK) == 0;
+	if (index && collect) {
+		::unlink((index_file(table)).c_str());
+	}
 	if (index) {
-		btIndex.open(index_file(table), 'w');
+		if ((rc = btIndex.open(index_file(table), 'w')) < 0) {
+			fprintf(stderr, "Error: cannot open the index of table %s "
+				"(drop and rebuild an index of an older format)\n",
+				table.c_str());
+			rf.close();
+			return rc;
+		}
+
+		// a new index is built bottom-up once all the tuples are in
+		bulk = (btIndex.getTreeHeight() == 0);
+		if (bulk) {
+			btIndex.setCounted(countedIndex);
+		}
 	}
 
-	while(getline(infile, line)) {
-		// TODO: Handle this gracefully.
-		parseLoadLine(line, key, value);
-		if ((rc = rf.append(key, value, rid)) < 0) {
-			fprintf(stderr, "Error: Appending %d, %s failed\n",
-				key, value.c_str());
+	// an index on the value column is kept up to date once it exists.
+	// the index of an empty table may be left over from a table that
+	// was dropped, so it is rebuilt from the tuples loaded here
+	byValue = valueIndex || ::access((value_index_file(table)).c_str(), F_OK) == 0;
+	if (byValue && collect) {
+		::unlink((value_index_file(table)).c_str());
+	}
+	if (byValue) {
+		if ((rc = vIndex.open(value_index_file(table), 'w')) < 0) {
+			fprintf(stderr, "Error: cannot open the value index of table %s\n",
+				table.c_str());
+			if (index) {
+				btIndex.close();
+			}
+			rf.close();
 			return rc;
 		}
-		if (index && (rc = btIndex.insert(key, rid))) {
-			fprintf(stderr, "LOAD: BTreeIndex insert failed on "
-				"key = %d with error = %d\n", key, rc);
-			break;
+		valueBulk = (vIndex.getTreeHeight() == 0);
+	}
+
+	// the tuples come a chunk at a time, in the order of the file
+	while (!failed && pipeline.next(tuples) == 0) {
+		mark = LoadPipeline::now();
+		for (size_t i = 0; i < tuples.size(); i++) {
+			const LoadTuple& t = tuples[i];
+
+			if ((rc = appender.append(t.key, t.value, t.length, rid)) < 0) {
+				fprintf(stderr, "Error: Appending %d, %.*s failed\n",
+					t.key, t.length, t.value);
+				failed = true;
+				error = rc;
+				tuples.resize(i);
+				break;
+			}
+			if (collect) {
+				stats.add(t.key, t.value, t.length);
+			}
+			if (index) {
+				IndexEntry entry = { t.key, rid };
+				(bulk ? entries : run).push_back(entry);
+			}
+			if (byValue) {
+				ValueEntry entry;
+				entry.value.assign(t.value, min(t.length, (int) ValueIndex::MAX_KEY_LENGTH));
+				entry.rid = rid;
+				values.push_back(entry);
+			}
+		}
+		count += tuples.size();
+
+		// an existing index must not point past the end of the table,
+		// so the tuples of the chunk are written before it takes them
+		if (!failed && (!run.empty() || (!valueBulk && !values.empty())) &&
+		    (rc = appender.flush()) < 0) {
+			fprintf(stderr, "Error: writing the tuples of table %s failed\n",
+				table.c_str());
+			failed = true;
+			error = rc;
+		}
+
+		// the tuples not written yet when that failed are dropped,
+		// with their index entries
+		if (error < 0) {
+			count -= appender.discard();
+			dropFrom(entries, rf.endRid());
+			dropFrom(run, rf.endRid());
+			dropFrom(values, rf.endRid());
+		}
+		writeTime += LoadPipeline::now() - mark;
+
+		// an existing index takes the entries of the chunk in key
+		// order, so that inserts into the same leaf follow each other
+		if (!run.empty()) {
+			mark = LoadPipeline::now();
+			sort(run.begin(), run.end(), entryKeyLess);
+			for (size_t i = 0; i < run.size(); i++) {
+				if ((rc = btIndex.insert(run[i].key, run[i].rid))) {
+					fprintf(stderr, "LOAD: BTreeIndex insert failed on "
+						"key = %d with error = %d\n", run[i].key, rc);
+					failed = true;
+					break;
+				}
+			}
+			run.clear();
+			indexTime += LoadPipeline::now() - mark;
+		}
+		if (!valueBulk && !values.empty()) {
+			mark = LoadPipeline::now();
+			sort(values.begin(), values.end(), valueLess);
+			for (size_t i = 0; i < values.size(); i++) {
+				if ((rc = vIndex.insert(values[i].value.data(),
+							values[i].value.size(), values[i].rid))) {
+					fprintf(stderr, "LOAD: ValueIndex insert failed "
+						"with error = %d\n", rc);
+					failed = true;
+					break;
+				}
+			}
+			values.clear();
+			indexTime += LoadPipeline::now() - mark;
 		}
 	}
+	if ((rc = appender.flush()) < 0) {
+		fprintf(stderr, "Error: writing the tuples of table %s failed\n",
+			table.c_str());
+		failed = true;
+		error = rc;
+		count -= appender.discard();
+		dropFrom(entries, rf.endRid());
+		dropFrom(values, rf.endRid());
+	}
+	if (bulk) {
+		mark = LoadPipeline::now();
+		if ((rc = btIndex.bulkLoad(entries, indexFillFactor))) {
+			fprintf(stderr, "LOAD: BTreeIndex bulk load failed "
+				"with error = %d\n", rc);
+		}
+		indexTime += LoadPipeline::now() - mark;
+	}
 	if (index && btIndex.close()) {
 		fprintf(stderr, "LOAD, BTreeIndex close failed.\n");
 	}
+	if (valueBulk) {
+		mark = LoadPipeline::now();
+		if ((rc = vIndex.bulkLoad(values, indexFillFactor))) {
+			fprintf(stderr, "LOAD: ValueIndex bulk load failed "
+				"with error = %d\n", rc);
+		}
+		indexTime += LoadPipeline::now() - mark;
+	}
+	if (byValue && vIndex.close()) {
+		fprintf(stderr, "LOAD, ValueIndex close failed.\n");
+	}
+	// the statistics collected so far count the tuples dropped as well
+	if (collect && error == 0) {
+		stats.finish(recordPageCount(rf));
+		if (stats.write(stats_file(table)) < 0) {
+			fprintf(stderr, "Error: cannot write the statistics "
+				"of table %s\n", table.c_str());
+		}
+	}
 	rf.close();
-	infile.close();
-	return 0;
+	pipeline.close();
+	if (!collect || error < 0) {
+		analyze(table);
+	}
+
+	if (pipeline.getBadLineCount() > 0) {
+		fprintf(stderr, "Warning: skipped %d lines of %s that are not "
+			"a key and a value\n", pipeline.getBadLineCount(),
+			loadfile.c_str());
+	}
+	reportLoad(pipeline, count, LoadPipeline::now() - start,
+		   writeTime, indexTime);
+	return error;
 }
 
-RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
+RC SqlEngine::createIndex(const string& table, int attr)
 {
-    const char *s;
-    char        c;
-    string::size_type loc;
-    
-    // ignore beginning white spaces
-    c = *(s = line.c_str());
-    while (c == ' ' || c == '\t') { c = *++s; }
-
-    // get the integer key value
-    key = atoi(s);
-
-    // look for comma
-    s = strchr(s, ',');
-    if (s == NULL) { return RC_INVALID_FILE_FORMAT; }
-
-    // ignore white spaces
-    do { c = *++s; } while (c == ' ' || c == '\t');
-    
-    // if there is nothing left, set the value to empty string
-    if (c == 0) { 
-        value.erase();
-        return 0;
-    }
+	RecordFile rf;
+	RecordId rid;
+	PageHandle page;
+	RC rc;
+	int key, height;
+	const char* value;
+	BTreeIndex btIndex;
+	ValueIndex vIndex;
+	vector<IndexEntry> entries;
+	vector<ValueEntry> values;
+	double start = LoadPipeline::now();
 
-    // is the value field delimited by ' or "?
-    if (c == '\'' || c == '"') {
-        s++;
-    } else {
-        c = '\n';
-    }
+	if ((rc = rf.open(table_file(table), 'm')) < 0) {
+		tableOpenError(table, rc);
+		return rc;
+	}
+
+	if (attr == 1) {
+		rc = btIndex.open(index_file(table), 'w');
+		height = btIndex.getTreeHeight();
+	} else {
+		rc = vIndex.open(value_index_file(table), 'w');
+		height = vIndex.getTreeHeight();
+	}
+	if (rc < 0) {
+		fprintf(stderr, "Error: cannot open the index of table %s "
+			"(drop and rebuild an index of an older format)\n",
+			table.c_str());
+		rf.close();
+		return rc;
+	}
+	if (height > 0) {
+		fprintf(stderr, "Error: table %s has the index already\n",
+			table.c_str());
+		rc = RC_INVALID_ATTRIBUTE;
+		goto exit;
+	}
+
+	// the index is built bottom-up from the tuples of the table
+	for (rid = rf.beginRid(); ; ++rid) {
+		if (attr == 1) {
+			if ((rc = rf.readNextKey(rid, key, page)) < 0) {
+				break;
+			}
+			IndexEntry entry = { key, rid };
+			entries.push_back(entry);
+		} else {
+			if ((rc = rf.readNext(rid, key, value, page)) < 0) {
+				break;
+			}
+			ValueEntry entry;
+			entry.value.assign(value, min(strlen(value), (size_t) ValueIndex::MAX_KEY_LENGTH));
+			entry.rid = rid;
+			values.push_back(entry);
+		}
+	}
+	page.unpin();
+	if (rc != RC_END_OF_FILE) {
+		fprintf(stderr, "Error: while reading a tuple from table %s\n",
+			table.c_str());
+		goto exit;
+	}
+
+	if (attr == 1) {
+		btIndex.setCounted(countedIndex);
+		rc = btIndex.bulkLoad(entries, indexFillFactor);
+	} else {
+		rc = vIndex.bulkLoad(values, indexFillFactor);
+	}
+	if (rc < 0) {
+		fprintf(stderr, "Error: building the index of table %s failed "
+			"with error = %d\n", table.c_str(), rc);
+		goto exit;
+	}
+	fprintf(stderr, "  -- %.3f seconds to index %d tuples\n",
+		LoadPipeline::now() - start,
+		(int) (attr == 1 ? entries.size() : values.size()));
+
+ exit:
+	if (attr == 1) {
+		btIndex.close();
+	} else {
+		vIndex.close();
+	}
+	rf.close();
+	return rc;
+}
+
+RC SqlEngine::analyze(const string& table)
+{
+	RecordFile rf;
+	RecordId   rid;
+	TableStats stats;
+	PageHandle page;
+	const char* value;
+	int key;
+	RC rc;
+
+	if ((rc = rf.open(table_file(table), 'm')) < 0) {
+		tableOpenError(table, rc);
+		return rc;
+	}
+
+	for (rid = rf.beginRid(); (rc = rf.readNext(rid, key, value, page)) == 0; ++rid) {
+		stats.add(key, value);
+	}
+	page.unpin();
+	if (rc != RC_END_OF_FILE) {
+		fprintf(stderr, "Error: while reading a tuple from table %s\n",
+			table.c_str());
+		rf.close();
+		return rc;
+	}
+	stats.finish(recordPageCount(rf));
+	rf.close();
+
+	if ((rc = stats.write(stats_file(table))) < 0) {
+		fprintf(stderr, "Error: cannot write the statistics of table %s\n",
+			table.c_str());
+	}
+	return rc;
+}
+
+RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
+{
+    const char *v;
+    int         length;
+    RC          rc;
 
-    // get the value string
-    value.assign(s);
-    loc = value.find(c, 0);
-    if (loc != string::npos) { value.erase(loc); }
+    rc = LoadPipeline::parseLine(line.data(), line.data() + line.size(),
+                                 key, v, length);
+    if (rc < 0) { return rc; }
 
+    value.assign(v, length);
     return 0;
 }
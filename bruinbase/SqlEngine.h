@@ -14,6 +14,8 @@
 #include "Bruinbase.h"
 #include "RecordFile.h"
 #include "BTreeIndex.h"
+#include "ValueIndex.h"
+#include "TableStats.h"
 
 /**
  * data structure to represent a condition in the WHERE clause
@@ -54,15 +56,37 @@ class SqlEngine {
 
   /**
    * load a table from a load file.
+   * an index that exists already, on either column, is kept up to
+   * date whether index or valueIndex is set or not.
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
    * @param index[IN] true if "WITH INDEX" option was specified
+   * @param valueIndex[IN] true if "WITH INDEX ON value" was specified
    * @return error code. 0 if no error
    */
-  static RC load(const std::string& table, const std::string& loadfile, bool index);
+  static RC load(const std::string& table, const std::string& loadfile,
+                 bool index, bool valueIndex = false);
+
+  /**
+   * build an index on a column of an existing table from its tuples.
+   * @param table[IN] the table name in the CREATE INDEX command
+   * @param attr[IN] the column to index (1: key, 2: value)
+   * @return error code. 0 if no error.
+   *    RC_INVALID_ATTRIBUTE - when the table has the index already
+   */
+  static RC createIndex(const std::string& table, int attr);
+
+  /**
+   * collect the statistics of a table (see TableStats) and store them
+   * next to the table, for the query planner. LOAD does the same.
+   * @param table[IN] the table name in the ANALYZE command
+   * @return error code. 0 if no error
+   */
+  static RC analyze(const std::string& table);
 
   /**
    * parse a line from the load file into the (key, value) pair.
+   * LOAD itself parses the lines in place with LoadPipeline::parseLine().
    * @param line[IN] a line from a load file
    * @param key[OUT] the key field of the tuple in the line
    * @param value[OUT] the value field of the tuple in the line
@@ -70,8 +94,112 @@ class SqlEngine {
    */
   static RC parseLoadLine(const std::string& line, int& key, std::string& value);
 
+  /**
+   * set how full LOAD packs the nodes of a new index.
+   * LOAD with an index that does not exist yet builds it bottom-up
+   * (see BTreeIndex::bulkLoad()) with this fill factor. the default is 0.9
+   * @param fillFactor[IN] the fraction of each node to fill, in (0, 1]
+   * @return error code. 0 if no error
+   */
+  static RC setIndexFillFactor(double fillFactor);
+
+  /**
+   * set whether LOAD builds counted indexes (see BTreeIndex::setCounted()).
+   * COUNT(*) on the key column of a table with a counted index reads
+   * only two paths down the index. the default is false
+   * @param counted[IN] true to build counted indexes
+   * @return error code. 0 if no error
+   */
+  static RC setCountedIndex(bool counted);
+
+  /**
+   * set the # of threads LOAD parses the load file with
+   * (see LoadPipeline). the default is LoadPipeline::DEFAULT_THREAD_COUNT
+   * @param threadCount[IN] the # of parser threads
+   * @return error code. 0 if no error
+   */
+  static RC setLoadThreads(int threadCount);
+
+  /**
+   * set whether LOAD stores new tables in columns (see RecordFile::open()).
+   * a scan of a columnar table that needs no value reads only the keys.
+   * the default is false
+   * @param columnar[IN] true to store new tables in columns
+   * @return error code. 0 if no error
+   */
+  static RC setColumnarTables(bool columnar);
+
+  /**
+   * set whether an index scan that fetches the tuples in rid order
+   * prints them in key order all the same. the default is false
+   * @param ordered[IN] true to print the tuples in key order
+   * @return error code. 0 if no error
+   */
+  static RC setKeyOrder(bool ordered);
+
+  /**
+   * return the access path the last SELECT took:
+   * "index-only scan", "index range scan", "value index range scan"
+   * or "table scan".
+   * @return the name of the access path
+   */
+  static const char* getLastPlan();
+
  private:
-  static RC select_from_index(BTreeIndex btIndex, int attr, const std::string& table,
+  // the access paths of a SELECT (see choose_plan())
+  enum Plan { TABLE_SCAN, INDEX_SCAN, RID_SCAN, INDEX_ONLY, VALUE_SCAN, NO_SCAN };
+
+  // the cost of reading a table page at random, in the pages a
+  // sequential scan of the table reads in the same time. an index scan
+  // reads READ_AHEAD_DEPTH tuples ahead, which hides much of the seek
+  static const int RANDOM_PAGE_COST = 2;
+
+  // # of rid comparisons of a sort that cost as much as reading a page
+  static const int RID_COMPARES_PER_PAGE = 400;
+
+  // # of index entries a scan in rid order sorts at a time
+  static const int RID_BATCH_SIZE = 4096;
+
+  // the access path of the last SELECT
+  static Plan lastPlan;
+
+  // # of index entries an index scan reads ahead of the tuples it returns
+  static const int READ_AHEAD_DEPTH = 32;
+
+  // # of index entries an index scan buffers. a leaf node is read once
+  // fewer than READ_AHEAD_DEPTH entries are left, so this is enough for
+  // the entries of a whole leaf node on top of them
+  static const int BATCH_CAPACITY = BTLeafNode::MAX_LEAF_KEY_COUNT + READ_AHEAD_DEPTH;
+
+  // the fill factor of the indexes built by LOAD
+  static double indexFillFactor;
+
+  // # of threads LOAD parses the load file with
+  static int loadThreads;
+
+  // true if the indexes built by LOAD are counted
+  static bool countedIndex;
+
+  // true if LOAD stores new tables in columns
+  static bool columnarTables;
+
+  // true if a scan in rid order prints the tuples in key order
+  static bool keyOrder;
+
+  static Plan choose_plan(BTreeIndex& btIndex, int attr, const std::string& table,
+			  const std::vector<SelCond>& cond, const TableStats* stats);
+
+  static Plan choose_value_plan(ValueIndex& vIndex, const std::string& table,
+				const std::vector<SelCond>& cond);
+
+  static bool find_value_range(const std::vector<SelCond>& cond,
+			       const char*& low, const char*& high);
+
+  static bool key_range_empty(const TableStats& stats,
+			      const std::vector<SelCond>& cond);
+
+  static RC select_from_index(BTreeIndex& btIndex, Plan plan, int attr,
+			      const std::string& table,
 			      const std::vector<SelCond>& cond);
 
   static RC _preprocess_selcond(std::vector<SelCond>& condV, struct SelCond cond);
@@ -81,9 +209,23 @@ class SqlEngine {
 
   static RC find_key(std::vector<SelCond> cond, int& key);
 
-  static RC print_tuples(BTreeIndex btIndex, int attr,
+  static RC find_end_key(const std::vector<SelCond>& cond, int& endKey);
+
+  static RC print_tuples(BTreeIndex& btIndex, int attr,
 			 const std::string& table, int key,
 			 std::vector<SelCond> cond);
+
+  static RC print_tuples_by_rid(BTreeIndex& btIndex, int attr,
+				const std::string& table, int key,
+				const std::vector<SelCond>& cond);
+
+  static RC print_tuples_by_value(ValueIndex& vIndex, int attr,
+				  const std::string& table,
+				  const std::vector<SelCond>& cond);
+
+  // answer a query that reads nothing but keys from the index alone
+  static RC print_keys(BTreeIndex& btIndex, int attr, int key,
+		       const std::vector<SelCond>& cond);
 };
 
 #endif /* SQLENGINE_H */
@@ -24,7 +24,7 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
   etime = times(&tmsbuf);
   epagecnt = PageFile::getPageReadCount();
 
-  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
+  fprintf(stderr, "  -- %.3f seconds to run the select command (%s). Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), SqlEngine::getLastPlan(), epagecnt - bpagecnt);
 }
 
 %}
@@ -36,7 +36,7 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
   std::vector<SelCond>* conds;
 }
 
-%token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR 
+%token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR ANALYZE CREATE
 %token COMMA STAR LF
 %token <string> INTEGER STRING ID
 %token EQUAL NEQUAL LESS LESSEQUAL GREATER GREATEREQUAL 
@@ -55,6 +55,8 @@ commands:
 command:
         load_command { fprintf(stdout, "Bruinbase> "); }
 	| select_command { fprintf(stdout, "Bruinbase> "); }
+	| analyze_command { fprintf(stdout, "Bruinbase> "); }
+	| create_index_command { fprintf(stdout, "Bruinbase> "); }
 	| quit_command
 	| error LF { fprintf(stdout, "Bruinbase> "); }
 	| LF { fprintf(stdout, "Bruinbase> "); }
@@ -75,6 +77,25 @@ load_command:
 	  free($2);
 	  free($4);
 	}
+	| LOAD table FROM STRING WITH INDEX on attribute LF { 
+	  SqlEngine::load(std::string($2), std::string($4), $8 == 1, $8 == 2); 
+	  free($2);
+	  free($4);
+	}
+	;
+
+create_index_command:
+	CREATE INDEX on table '(' attribute ')' LF {
+	  SqlEngine::createIndex(std::string($4), $6);
+	  free($4);
+	}
+	;
+
+analyze_command:
+	ANALYZE table LF {
+	  SqlEngine::analyze(std::string($2));
+	  free($2);
+	}
 	;
 
 select_command:
@@ -113,6 +134,7 @@ condition:
 	  c->attr = $1;
 	  c->comp = static_cast<SelCond::Comparator>($2);
 	  c->value = $3;
+	  c->intValue = 0;
 	  $$ = c;
         }
 	;
@@ -140,6 +162,18 @@ table:
 	ID { $$ = $1; }
 	;
 
+/* ON is not a reserved word, so that a table may still be named on */
+on:
+	ID {
+		int other = strcasecmp($1, "on");
+		free($1);
+		if (other) {
+			sqlerror("syntax error. ON expected");
+			YYERROR;
+		}
+	}
+	;
+
 comparator:
 	EQUAL          { $$ = SelCond::EQ; }
 	| NEQUAL       { $$ = SelCond::NE; }
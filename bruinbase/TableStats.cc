@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include "TableStats.h"
+#include "PageFile.h"
+
+using std::string;
+
+// the fields of the stats page, in this order, followed by the bounds
+enum {
+  MAGIC, VERSION, PAGE_SIZE_FIELD, ROW_COUNT, PAGE_COUNT, MIN_KEY, MAX_KEY,
+  DISTINCT_KEYS, DISTINCT_VALUES, AVG_VALUE_LENGTH, MAX_VALUE_LENGTH,
+  BOUNDS
+};
+
+// FNV-1a hash of a string
+static unsigned hashValue(const char* value, int length)
+{
+  unsigned h = 2166136261u;
+
+  for (int i = 0; i < length; i++) {
+    h = (h ^ (unsigned char) value[i]) * 16777619u;
+  }
+  return h;
+}
+
+TableStats::TableStats()
+{
+  clear();
+}
+
+void TableStats::clear()
+{
+  rowCount = pageCount = 0;
+  minKey = INT_MAX;
+  maxKey = INT_MIN;
+  distinctKeys = distinctValues = 0;
+  avgValueLength = maxValueLength = 0;
+  memset(bounds, 0, sizeof(bounds));
+
+  keys.clear();
+  sketch.clear();
+  valueLengthSum = 0;
+}
+
+void TableStats::add(int key, const char* value, int length)
+{
+  unsigned h = hashValue(value, length);
+
+  keys.push_back(key);
+  valueLengthSum += length;
+  if (length > maxValueLength) maxValueLength = length;
+
+  // keep the SKETCH_SIZE smallest distinct hashes
+  if ((int) sketch.size() < SKETCH_SIZE || h < *sketch.rbegin()) {
+    sketch.insert(h);
+    if ((int) sketch.size() > SKETCH_SIZE) sketch.erase(--sketch.end());
+  }
+}
+
+void TableStats::finish(int pageCount)
+{
+  int n = keys.size();
+
+  this->pageCount = pageCount;
+  rowCount = n;
+  if (n == 0) return;
+
+  std::sort(keys.begin(), keys.end());
+  minKey = keys.front();
+  maxKey = keys.back();
+  distinctKeys = 1;
+  for (int i = 1; i < n; i++) {
+    distinctKeys += (keys[i] != keys[i - 1]);
+  }
+
+  // the bounds are the keys at every (n / BUCKET_COUNT)th place in key order
+  for (int i = 0; i <= BUCKET_COUNT; i++) {
+    bounds[i] = keys[std::min(n - 1, (int) ((long long) i * n / BUCKET_COUNT))];
+  }
+
+  // with fewer distinct hashes than the sketch holds, it counts them all.
+  // otherwise the largest of the k smallest hashes tells how densely the
+  // hashes of the distinct values cover the hash space
+  if ((int) sketch.size() < SKETCH_SIZE) {
+    distinctValues = sketch.size();
+  } else {
+    distinctValues = (int) std::min((double) n,
+      (SKETCH_SIZE - 1) * 4294967296.0 / ((double) *sketch.rbegin() + 1));
+  }
+  avgValueLength = (int) ((valueLengthSum + n / 2) / n);
+
+  std::vector<int>().swap(keys);
+  sketch.clear();
+}
+
+RC TableStats::read(const string& filename)
+{
+  PageFile pf;
+  char page[PageFile::PAGE_SIZE];
+  int* field = (int*) page;
+  RC rc;
+
+  if ((rc = pf.open(filename, 'r')) < 0) return rc;
+  rc = pf.read(0, page);
+  pf.close();
+  if (rc < 0) return rc;
+
+  if (field[MAGIC] != STATS_MAGIC || field[VERSION] != STATS_VERSION ||
+      field[PAGE_SIZE_FIELD] != PageFile::PAGE_SIZE) {
+    return RC_INVALID_FILE_FORMAT;
+  }
+  rowCount = field[ROW_COUNT];
+  pageCount = field[PAGE_COUNT];
+  minKey = field[MIN_KEY];
+  maxKey = field[MAX_KEY];
+  distinctKeys = field[DISTINCT_KEYS];
+  distinctValues = field[DISTINCT_VALUES];
+  avgValueLength = field[AVG_VALUE_LENGTH];
+  maxValueLength = field[MAX_VALUE_LENGTH];
+  memcpy(bounds, field + BOUNDS, sizeof(bounds));
+  return 0;
+}
+
+RC TableStats::write(const string& filename) const
+{
+  PageFile pf;
+  char page[PageFile::PAGE_SIZE];
+  int* field = (int*) page;
+  RC rc;
+
+  memset(page, 0, PageFile::PAGE_SIZE);
+  field[MAGIC] = STATS_MAGIC;
+  field[VERSION] = STATS_VERSION;
+  field[PAGE_SIZE_FIELD] = PageFile::PAGE_SIZE;
+  field[ROW_COUNT] = rowCount;
+  field[PAGE_COUNT] = pageCount;
+  field[MIN_KEY] = minKey;
+  field[MAX_KEY] = maxKey;
+  field[DISTINCT_KEYS] = distinctKeys;
+  field[DISTINCT_VALUES] = distinctValues;
+  field[AVG_VALUE_LENGTH] = avgValueLength;
+  field[MAX_VALUE_LENGTH] = maxValueLength;
+  memcpy(field + BOUNDS, bounds, sizeof(bounds));
+
+  if ((rc = pf.open(filename, 'w')) < 0) return rc;
+  if ((rc = pf.write(0, page)) < 0) {
+    pf.close();
+    return rc;
+  }
+  return pf.close();
+}
+
+double TableStats::estimateRange(int low, int high) const
+{
+  double perBucket = (double) rowCount / BUCKET_COUNT;
+  double count = 0;
+
+  if (rowCount == 0 || low > high || low > maxKey || high < minKey) return 0;
+
+  for (int i = 0; i < BUCKET_COUNT; i++) {
+    int lo = bounds[i], hi = bounds[i + 1];
+
+    if (hi < low || lo > high) continue;
+    if (lo == hi) {
+      count += perBucket;  // a bucket of one key inside the range
+    } else {
+      count += perBucket * ((double) std::min(hi, high) - std::max(lo, low) + 1) /
+               ((double) hi - lo + 1);
+    }
+  }
+  return std::min(count, (double) rowCount);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef TABLESTATS_H
+#define TABLESTATS_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <cstring>
+#include "Bruinbase.h"
+
+/**
+ * the statistics of a table, kept in a one-page sidecar file next to it.
+ * LOAD and ANALYZE collect them by passing every tuple of the table to
+ * add() and calling finish(). the key histogram is equi-depth: each of
+ * its BUCKET_COUNT buckets holds about the same number of tuples, so the
+ * tuples a key range selects are estimated well for skewed keys too.
+ */
+class TableStats {
+ public:
+  static const int STATS_MAGIC = 0x53544242;  // "BBTS", at the page start
+  static const int STATS_VERSION = 1;
+  static const int BUCKET_COUNT = 64;         // # of histogram buckets
+
+  // # of smallest value hashes kept to estimate the distinct values
+  static const int SKETCH_SIZE = 256;
+
+  TableStats();
+
+  /**
+   * forget the statistics and start collecting new ones.
+   */
+  void clear();
+
+  /**
+   * count a tuple of the table.
+   * @param key[IN] the key of the tuple
+   * @param value[IN] the value of the tuple
+   */
+  void add(int key, const char* value) { add(key, value, strlen(value)); }
+
+  /**
+   * count a tuple of the table.
+   * @param key[IN] the key of the tuple
+   * @param value[IN] the value of the tuple. it does not have to be
+   *    NUL-terminated
+   * @param length[IN] the length of the value
+   */
+  void add(int key, const char* value, int length);
+
+  /**
+   * compute the statistics of the tuples added since clear().
+   * @param pageCount[IN] the # of record pages of the table
+   */
+  void finish(int pageCount);
+
+  /**
+   * read the statistics from a stats file.
+   * @param filename[IN] the name of the stats file
+   * @return error code. 0 if no error.
+   *    RC_INVALID_FILE_FORMAT - when the file was written with another
+   *    page size or an older format
+   */
+  RC read(const std::string& filename);
+
+  /**
+   * write the statistics to a stats file. the file is created if it
+   * does not exist.
+   * @param filename[IN] the name of the stats file
+   * @return error code. 0 if no error
+   */
+  RC write(const std::string& filename) const;
+
+  /**
+   * estimate the # of tuples whose keys are in [low, high] from the
+   * key histogram. the keys are taken to be spread evenly in a bucket.
+   * @param low[IN] the smallest key of the range
+   * @param high[IN] the largest key of the range
+   * @return the estimated # of tuples
+   */
+  double estimateRange(int low, int high) const;
+
+  int getRowCount() const       { return rowCount; }
+  int getPageCount() const      { return pageCount; }
+  int getMinKey() const         { return minKey; }
+  int getMaxKey() const         { return maxKey; }
+  int getDistinctKeys() const   { return distinctKeys; }
+  int getDistinctValues() const { return distinctValues; }
+  int getAvgValueLength() const { return avgValueLength; }
+  int getMaxValueLength() const { return maxValueLength; }
+
+ private:
+  // what read() and write() store
+  int rowCount;        // # of tuples
+  int pageCount;       // # of record pages
+  int minKey;          // the smallest key
+  int maxKey;          // the largest key
+  int distinctKeys;    // # of distinct keys
+  int distinctValues;  // estimated # of distinct values
+  int avgValueLength;  // the average length of the values, rounded
+  int maxValueLength;  // the length of the longest value
+  int bounds[BUCKET_COUNT + 1];  // bucket i holds keys in [bounds[i], bounds[i+1]]
+
+  // what add() collects for finish()
+  std::vector<int> keys;           // the keys added
+  std::set<unsigned> sketch;       // the SKETCH_SIZE smallest value hashes
+  long long valueLengthSum;        // the total length of the values
+};
+
+#endif // TABLESTATS_H
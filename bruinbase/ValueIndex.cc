@@ -0,0 +1,601 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include <algorithm>
+#include "ValueIndex.h"
+
+using namespace std;
+
+/*
+ **********************************************************
+ * ValueIndex metadata format:
+ * ===========================
+ *
+ * -------------------------------------------------------
+ * |  rootPid  |  treeHeight  |  magic  |  version  |  pageSize  |
+ * -------------------------------------------------------
+ *    4Bytes       4Bytes       4Bytes     4Bytes      4Bytes
+ *
+ **********************************************************
+ */
+
+// the offsets of freeEnd and pid0 in a node page
+static const int FREE_END = sizeof(BTNodeHeader);
+static const int FIRST_PID = sizeof(BTNodeHeader) + sizeof(int);
+
+/*
+ * Output in sep the shortest key that is larger than l and not larger
+ * than r, i.e., the shortest prefix of r that is not a prefix of l.
+ * r itself if the two are equal.
+ */
+static void separator(const char* l, int ll, const char* r, int rl, string& sep)
+{
+	int i = 0;
+
+	while (i < ll && i < rl && l[i] == r[i]) {
+		i++;
+	}
+	sep.assign(r, min(i + 1, rl));
+}
+
+BTValueNode::BTValueNode(int level)
+{
+	int freeEnd = PageFile::PAGE_SIZE;
+	PageId pid0 = -1;
+
+	memset(buffer, 0, PageFile::PAGE_SIZE);
+	header()->version = BTVALUE_NODE_VERSION;
+	header()->level = level;
+	header()->flags = 0;
+	header()->keyCount = 0;
+	header()->nextPid = -1;
+	header()->prevPid = -1;
+	memcpy(buffer + FREE_END, &freeEnd, sizeof(int));
+	memcpy(buffer + FIRST_PID, &pid0, sizeof(PageId));
+}
+
+int BTValueNode::entrySize(int level, int length)
+{
+	return SLOT_SIZE + length + (level == 0 ? sizeof(RecordId) : sizeof(PageId));
+}
+
+int BTValueNode::getFreeSpace()
+{
+	int freeEnd;
+
+	memcpy(&freeEnd, buffer + FREE_END, sizeof(int));
+	return freeEnd - NODE_HEADER - SLOT_SIZE * getKeyCount();
+}
+
+int BTValueNode::locate(const char* searchKey, int length)
+{
+	int low = 0, high = getKeyCount();
+	const char* key;
+	int keyLength;
+
+	// the first entry whose key is not smaller than searchKey
+	while (low < high) {
+		int mid = (low + high) / 2;
+
+		readKey(mid, key, keyLength);
+		if (ValueIndex::compare(key, keyLength, searchKey, length) < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+RC BTValueNode::insert(int eid, const char* key, int length, const void* payload)
+{
+	int count = getKeyCount();
+	int freeEnd;
+
+	if (entrySize(getLevel(), length) > getFreeSpace()) {
+		return RC_NODE_FULL;
+	}
+
+	// the entry goes to the end of the free space, its slot in between
+	// the slots of its neighbors
+	memcpy(&freeEnd, buffer + FREE_END, sizeof(int));
+	freeEnd -= length + payloadSize();
+	memcpy(buffer + freeEnd, key, length);
+	memcpy(buffer + freeEnd + length, payload, payloadSize());
+	memcpy(buffer + FREE_END, &freeEnd, sizeof(int));
+
+	memmove(slot(eid + 1), slot(eid), SLOT_SIZE * (count - eid));
+	slot(eid)[0] = freeEnd;
+	slot(eid)[1] = length;
+	header()->keyCount++;
+
+	return 0;
+}
+
+RC BTValueNode::insertAndSplit(int eid, const char* key, int length,
+			       const void* payload, BTValueNode& sibling,
+			       string& splitKey)
+{
+	vector<string> keys;      // the keys of the entries, the new one included
+	vector<string> payloads;  // and their payloads
+	BTValueNode left(getLevel());
+	const char* k;
+	int n = getKeyCount() + 1;
+	int l, total = 0, half = 0, mid;
+
+	for (int i = 0, j = 0; i < n; i++) {
+		if (i == eid) {
+			keys.push_back(string(key, length));
+			payloads.push_back(string((const char*) payload, payloadSize()));
+			continue;
+		}
+		readKey(j, k, l);
+		keys.push_back(string(k, l));
+		payloads.push_back(string(k + l, payloadSize()));
+		j++;
+	}
+	for (int i = 0; i < n; i++) {
+		total += entrySize(getLevel(), keys[i].size());
+	}
+
+	// the entries in front of mid stay, as many as take half the bytes.
+	// a nonleaf node moves the mid entry up, so each side keeps an entry
+	for (mid = 0; mid < n - 1 && half < total / 2; mid++) {
+		half += entrySize(getLevel(), keys[mid].size());
+	}
+	if (getLevel() > 0) {
+		mid = max(1, min(mid, n - 2));
+	} else {
+		mid = max(1, mid);
+	}
+
+	// the node is rebuilt with the entries that stay
+	memcpy(left.buffer + FIRST_PID, buffer + FIRST_PID, sizeof(PageId));
+	left.setNextNodePtr(getNextNodePtr());
+	left.setPrevNodePtr(getPrevNodePtr());
+	for (int i = 0; i < mid; i++) {
+		left.append(keys[i].data(), keys[i].size(), payloads[i].data());
+	}
+
+	if (getLevel() == 0) {
+		separator(keys[mid - 1].data(), keys[mid - 1].size(),
+			  keys[mid].data(), keys[mid].size(), splitKey);
+	} else {
+		splitKey = keys[mid];
+		memcpy(sibling.buffer + FIRST_PID, payloads[mid].data(), sizeof(PageId));
+		mid++;
+	}
+	sibling.header()->level = getLevel();
+	for (int i = mid; i < n; i++) {
+		sibling.append(keys[i].data(), keys[i].size(), payloads[i].data());
+	}
+
+	memcpy(buffer, left.buffer, PageFile::PAGE_SIZE);
+	return 0;
+}
+
+void BTValueNode::readKey(int eid, const char*& key, int& length)
+{
+	key = buffer + slot(eid)[0];
+	length = slot(eid)[1];
+}
+
+RecordId BTValueNode::getRid(int eid)
+{
+	RecordId rid;
+
+	memcpy(&rid, buffer + slot(eid)[0] + slot(eid)[1], sizeof(RecordId));
+	return rid;
+}
+
+PageId BTValueNode::getChildPtr(int i)
+{
+	PageId pid;
+
+	if (i == 0) {
+		memcpy(&pid, buffer + FIRST_PID, sizeof(PageId));
+	} else {
+		memcpy(&pid, buffer + slot(i - 1)[0] + slot(i - 1)[1], sizeof(PageId));
+	}
+	return pid;
+}
+
+void BTValueNode::setFirstChildPtr(PageId pid)
+{
+	memcpy(buffer + FIRST_PID, &pid, sizeof(PageId));
+}
+
+RC BTValueNode::read(PageId pid, const PageFile& pf)
+{
+	RC rc;
+
+	if ((rc = pf.read(pid, buffer))) {
+		return rc;
+	}
+	if (header()->version != BTVALUE_NODE_VERSION) {
+		return RC_INVALID_FILE_FORMAT;
+	}
+	return 0;
+}
+
+RC BTValueNode::write(PageId pid, PageFile& pf)
+{
+	return pf.write(pid, buffer);
+}
+
+int ValueIndex::compare(const char* k1, int l1, const char* k2, int l2)
+{
+	int diff = memcmp(k1, k2, min(l1, l2));
+
+	return diff != 0 ? diff : l1 - l2;
+}
+
+const int ValueIndex::MAX_KEY_LENGTH;
+
+ValueIndex::ValueIndex()
+{
+	rootPid = -1;
+	treeHeight = 0;
+}
+
+PageId ValueIndex::fetch_new_page()
+{
+	char buffer[PageFile::PAGE_SIZE];
+	PageId pid = pf.endPid();
+
+	memset(buffer, 0xff, PageFile::PAGE_SIZE);
+	pf.write(pid, buffer);
+
+	return pid;
+}
+
+int ValueIndex::read_metadata()
+{
+	int header[5];
+	char buffer[PageFile::PAGE_SIZE];
+
+	if (pf.read(BTINDEX_MD_PID, buffer)) {
+		return -1;
+	}
+	memcpy(header, buffer, sizeof(header));
+	if (header[2] != VALUEINDEX_MAGIC || header[3] != VALUEINDEX_VERSION ||
+	    header[4] != PageFile::PAGE_SIZE) {
+		return -1;
+	}
+	rootPid = header[0];
+	treeHeight = header[1];
+	return 0;
+}
+
+int ValueIndex::commit_metadata()
+{
+	int header[5] = { rootPid, treeHeight, VALUEINDEX_MAGIC,
+			  VALUEINDEX_VERSION, PageFile::PAGE_SIZE };
+	char buffer[PageFile::PAGE_SIZE];
+
+	memset(buffer, 0, PageFile::PAGE_SIZE);
+	memcpy(buffer, header, sizeof(header));
+	return pf.write(BTINDEX_MD_PID, buffer);
+}
+
+RC ValueIndex::open(const string& indexname, char mode)
+{
+	RC ret;
+
+	if ((ret = pf.open(indexname, mode))) {
+		return ret;
+	}
+
+	if (pf.endPid() == 0) {
+		rootPid = -1;
+		treeHeight = 0;
+	} else if (read_metadata()) {
+		pf.close();
+		return RC_INVALID_FILE_FORMAT;
+	}
+	return 0;
+}
+
+RC ValueIndex::close()
+{
+	return pf.close();
+}
+
+/*
+ * Insert (value, rid) under the node pid at depth. When the node splits,
+ * return RC_NODE_FULL with the key and the pid of the new sibling in
+ * splitkey and splitpid.
+ */
+RC ValueIndex::_insert(PageId pid, int depth, const char* value, int length,
+		       const RecordId& rid, string& splitkey, PageId& splitpid)
+{
+	BTValueNode node;
+	RC ret;
+	int eid;
+
+	if ((ret = node.read(pid, pf))) {
+		return ret;
+	}
+	eid = node.locate(value, length);
+
+	if (depth == treeHeight) {
+		// Leaf nodes
+		ret = node.insert(eid, value, length, &rid);
+	} else {
+		// NonLeaf nodes. the new child of a split goes right after
+		// the child that split
+		ret = _insert(node.getChildPtr(eid), depth + 1, value, length,
+			      rid, splitkey, splitpid);
+		if (ret != RC_NODE_FULL) {
+			return ret;
+		}
+		ret = node.insert(eid, splitkey.data(), splitkey.size(), &splitpid);
+	}
+
+	if (ret == RC_NODE_FULL) {
+		BTValueNode sibling;
+		PageId next = node.getNextNodePtr();
+		PageId newPid = fetch_new_page();
+		string key = splitkey;
+
+		if (depth == treeHeight) {
+			node.insertAndSplit(eid, value, length, &rid, sibling, splitkey);
+		} else {
+			node.insertAndSplit(eid, key.data(), key.size(), &splitpid,
+					    sibling, splitkey);
+		}
+		splitpid = newPid;
+		sibling.setNextNodePtr(next);
+		sibling.setPrevNodePtr(pid);
+		sibling.write(newPid, pf);
+		node.setNextNodePtr(newPid);
+		if (next >= 0) {
+			BTValueNode nextNode;
+			nextNode.read(next, pf);
+			nextNode.setPrevNodePtr(newPid);
+			nextNode.write(next, pf);
+		}
+		node.write(pid, pf);
+		return RC_NODE_FULL;
+	}
+	if (ret == 0) {
+		node.write(pid, pf);
+	}
+	return ret;
+}
+
+RC ValueIndex::insert(const char* value, int length, const RecordId& rid)
+{
+	string splitkey;
+	PageId splitpid = -1;
+	RC ret;
+
+	length = min(length, MAX_KEY_LENGTH);
+	if (treeHeight == 0) {
+		BTValueNode root;
+
+		treeHeight = 1;
+		fetch_new_page();
+		rootPid = fetch_new_page();
+		root.write(rootPid, pf);
+		commit_metadata();
+	}
+
+	ret = _insert(rootPid, 1, value, length, rid, splitkey, splitpid);
+
+	// a split of the root makes a new root above the two nodes
+	if (ret == RC_NODE_FULL) {
+		BTValueNode root(treeHeight);
+		PageId newPid = fetch_new_page();
+
+		root.setFirstChildPtr(rootPid);
+		root.append(splitkey.data(), splitkey.size(), &splitpid);
+		root.write(newPid, pf);
+		rootPid = newPid;
+		treeHeight++;
+		return commit_metadata();
+	}
+	return ret;
+}
+
+// orders value entries by value, and entries with the same value by rid
+static bool valueEntryLess(const ValueEntry& e1, const ValueEntry& e2)
+{
+	int diff = ValueIndex::compare(e1.value.data(), e1.value.size(),
+				       e2.value.data(), e2.value.size());
+
+	return diff < 0 || (diff == 0 && e1.rid < e2.rid);
+}
+
+RC ValueIndex::bulkLoad(vector<ValueEntry>& entries, double fillFactor)
+{
+	vector<string> keys;  // the separator in front of each node of a level
+	vector<PageId> pids;  // the nodes of a level
+	int n = entries.size();
+	int limit = (int) (fillFactor * BTValueNode::CAPACITY);
+	RC ret;
+
+	if (treeHeight != 0 || fillFactor <= 0 || fillFactor > 1) {
+		return RC_INVALID_ATTRIBUTE;
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	for (int i = 1; i < n; i++) {
+		if (valueEntryLess(entries[i], entries[i - 1])) {
+			sort(entries.begin(), entries.end(), valueEntryLess);
+			break;
+		}
+	}
+
+	// the metadata page comes first. it is written at the end
+	fetch_new_page();
+
+	// the leaf level. each leaf takes entries up to the fill factor of
+	// its bytes, and the leaves take consecutive pages in value order
+	for (int i = 0; i < n; ) {
+		BTValueNode leaf;
+		PageId pid = pf.endPid();
+		int begin = i;
+
+		for (; i < n; i++) {
+			int length = min((int) entries[i].value.size(), MAX_KEY_LENGTH);
+
+			if (i > begin && leaf.getUsedSpace() +
+			    BTValueNode::entrySize(0, length) > limit) {
+				break;
+			}
+			if (leaf.append(entries[i].value.data(), length, &entries[i].rid)) {
+				break;
+			}
+		}
+		keys.push_back(string());
+		if (begin > 0) {
+			leaf.setPrevNodePtr(pid - 1);
+			separator(entries[begin - 1].value.data(),
+				  min((int) entries[begin - 1].value.size(), MAX_KEY_LENGTH),
+				  entries[begin].value.data(),
+				  min((int) entries[begin].value.size(), MAX_KEY_LENGTH),
+				  keys.back());
+		}
+		if (i < n) {
+			leaf.setNextNodePtr(pid + 1);
+		}
+		if ((ret = leaf.write(pid, pf))) {
+			return ret;
+		}
+		pids.push_back(pid);
+	}
+	treeHeight = 1;
+
+	// build each nonleaf level on the one below until one node is left.
+	// every node gets at least two children. the separator in front of
+	// the first child of a node moves up to the level above
+	while (pids.size() > 1) {
+		vector<int>    groups;  // the first child of each node
+		vector<string> upperKeys;
+		vector<PageId> upperPids;
+		int used = 0;
+
+		n = pids.size();
+		for (int j = 0; j < n; j++) {
+			int size = BTValueNode::entrySize(treeHeight, keys[j].size());
+
+			if (groups.empty() || (j - groups.back() >= 2 &&
+			    (used + size > limit || used + size > BTValueNode::CAPACITY))) {
+				groups.push_back(j);
+				used = 0;
+			} else {
+				used += size;
+			}
+		}
+
+		// a last node with a single child joins the node in front of
+		// it if that one has two children, or takes its last child
+		if (groups.size() > 1 && groups.back() == n - 1) {
+			if (groups[groups.size() - 2] == n - 3) {
+				groups.pop_back();
+			} else {
+				groups.back()--;
+			}
+		}
+		groups.push_back(n);
+
+		for (size_t g = 0; g + 1 < groups.size(); g++) {
+			BTValueNode node(treeHeight);
+			PageId pid = pf.endPid();
+
+			node.setFirstChildPtr(pids[groups[g]]);
+			for (int j = groups[g] + 1; j < groups[g + 1]; j++) {
+				if ((ret = node.append(keys[j].data(), keys[j].size(), &pids[j]))) {
+					return ret;
+				}
+			}
+			if (g > 0) {
+				node.setPrevNodePtr(pid - 1);
+			}
+			if (g + 2 < groups.size()) {
+				node.setNextNodePtr(pid + 1);
+			}
+			if ((ret = node.write(pid, pf))) {
+				return ret;
+			}
+			upperKeys.push_back(keys[groups[g]]);
+			upperPids.push_back(pid);
+		}
+		keys.swap(upperKeys);
+		pids.swap(upperPids);
+		treeHeight++;
+	}
+
+	rootPid = pids[0];
+	return commit_metadata();
+}
+
+RC ValueIndex::locate(const char* searchValue, int length, IndexCursor& cursor)
+{
+	BTValueNode node;
+	PageId pid = rootPid;
+	RC ret;
+
+	length = min(length, MAX_KEY_LENGTH);
+	cursor.pid = -1;
+	cursor.eid = 0;
+	if (treeHeight == 0) {
+		return 0;
+	}
+
+	for (int depth = 1; depth < treeHeight; depth++) {
+		if ((ret = node.read(pid, pf))) {
+			return ret;
+		}
+		pid = node.getChildPtr(node.locate(searchValue, length));
+	}
+	if ((ret = node.read(pid, pf))) {
+		return ret;
+	}
+	cursor.pid = pid;
+	cursor.eid = node.locate(searchValue, length);
+	return 0;
+}
+
+RC ValueIndex::readBatch(IndexCursor& cursor, const char* endValue,
+			 int endLength, vector<RecordId>& rids)
+{
+	BTValueNode node;
+	size_t start = rids.size();
+	const char* key;
+	int length;
+	RC ret;
+
+	endLength = min(endLength, MAX_KEY_LENGTH);
+	while (cursor.pid >= 0) {
+		if ((ret = node.read(cursor.pid, pf))) {
+			return ret;
+		}
+		for (; cursor.eid < node.getKeyCount(); cursor.eid++) {
+			node.readKey(cursor.eid, key, length);
+			if (endValue != NULL &&
+			    compare(key, length, endValue, endLength) > 0) {
+				cursor.pid = -1;
+				break;
+			}
+			rids.push_back(node.getRid(cursor.eid));
+		}
+
+		// the leaf node is used up. the next one follows
+		if (cursor.pid >= 0) {
+			cursor.pid = node.getNextNodePtr();
+			cursor.eid = 0;
+		}
+		if (rids.size() > start) {
+			return 0;
+		}
+	}
+	return RC_END_OF_TREE;
+}
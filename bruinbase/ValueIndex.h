@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef VALUEINDEX_H
+#define VALUEINDEX_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+#include "BTreeNode.h"
+#include "BTreeIndex.h"
+
+#define VALUEINDEX_MAGIC 0x58445642  // "BVDX"
+#define VALUEINDEX_VERSION 1
+#define BTVALUE_NODE_VERSION 1       // the version of the node page format
+
+/**
+ * A (value, RecordId) pair to bulk load into a ValueIndex.
+ */
+typedef struct {
+  std::string value;
+  RecordId    rid;
+} ValueEntry;
+
+/**
+ * BTValueNode: a node of a ValueIndex, whose keys are strings of any
+ * length up to ValueIndex::MAX_KEY_LENGTH.
+ *
+ *******************************************************************
+ * BTValueNode page format                                         *
+ * --------------------------------------------------------------  *
+ * | header | freeEnd | pid0 | slot | slot | ... | ... | entry | entry |
+ * --------------------------------------------------------------  *
+ * |   16   |    4    |  4   |  4   |  4   | ... | ... |       |       |
+ * --------------------------------------------------------------  *
+ *******************************************************************
+ *
+ * The nodes are slotted: the slots, sorted by key, grow from the front
+ * of the page and the entries they point to grow from its end, with the
+ * free space in between. A slot is the offset and the key length of its
+ * entry (two unsigned shorts). An entry of a leaf node is the key bytes
+ * followed by the rid. An entry of a nonleaf node is the key bytes
+ * followed by the pid of the child that holds the keys larger than or
+ * equal to it. pid0 is the child in front of the first key, and -1 in a
+ * leaf node. freeEnd is the offset of the first entry byte.
+ */
+class BTValueNode {
+  public:
+   /**
+    * Create an empty node.
+    * @param level[IN] 0 for a leaf node. 1 for the parents of leaf
+    *    nodes, 2 for their parents, and so on
+    */
+    BTValueNode(int level = 0);
+
+   /**
+    * Find the first entry whose key is larger than or equal to
+    * searchKey. In a nonleaf node, this is also the child to follow
+    * for searchKey (see getChildPtr()): a key equal to the key of an
+    * entry is looked for in front of the entry, where the first of its
+    * duplicates may be.
+    * @param searchKey[IN] the key to search for
+    * @param length[IN] the length of searchKey
+    * @return the entry number. getKeyCount() if there is none
+    */
+    int locate(const char* searchKey, int length);
+
+   /**
+    * Insert an entry in front of the eid entry.
+    * @param eid[IN] where to insert the entry
+    * @param key[IN] the key of the entry
+    * @param length[IN] the length of key
+    * @param payload[IN] the rid (in a leaf) or the pid (in a nonleaf)
+    * @return 0 if successful. RC_NODE_FULL if the entry does not fit
+    */
+    RC insert(int eid, const char* key, int length, const void* payload);
+
+   /**
+    * Append an entry after the last entry of the node.
+    * The key must not be smaller than any key in the node.
+    * @param key[IN] the key of the entry
+    * @param length[IN] the length of key
+    * @param payload[IN] the rid (in a leaf) or the pid (in a nonleaf)
+    * @return 0 if successful. RC_NODE_FULL if the entry does not fit
+    */
+    RC append(const char* key, int length, const void* payload)
+      { return insert(getKeyCount(), key, length, payload); }
+
+   /**
+    * Insert an entry in front of the eid entry and move the entries
+    * of the upper half of the bytes to sibling.
+    * In a leaf node, splitKey is the shortest key that is larger than
+    * the last key left in this node and not larger than the first key
+    * of the sibling. In a nonleaf node, the middle entry moves up: its
+    * key is output in splitKey, and its child becomes the pid0 of the
+    * sibling.
+    * @param eid[IN] where to insert the entry
+    * @param key[IN] the key of the entry
+    * @param length[IN] the length of key
+    * @param payload[IN] the rid (in a leaf) or the pid (in a nonleaf)
+    * @param sibling[IN] the node to split with. it MUST be empty
+    * @param splitKey[OUT] the key to insert into the parent node
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC insertAndSplit(int eid, const char* key, int length,
+                      const void* payload, BTValueNode& sibling,
+                      std::string& splitKey);
+
+   /**
+    * Read the key of the eid entry. The key points into the node.
+    * @param eid[IN] the entry number
+    * @param key[OUT] the key
+    * @param length[OUT] the length of the key
+    */
+    void readKey(int eid, const char*& key, int& length);
+
+   /**
+    * Return the rid of the eid entry of a leaf node.
+    * @param eid[IN] the entry number
+    * @return the RecordId of the entry
+    */
+    RecordId getRid(int eid);
+
+   /**
+    * Return the i'th child pointer of a nonleaf node. Child 0 is in
+    * front of the first key, and child i + 1 right after the key of
+    * the i'th entry.
+    * @param i[IN] the child number, from 0 to getKeyCount()
+    * @return the PageId of the child
+    */
+    PageId getChildPtr(int i);
+
+   /**
+    * Set the child pointer in front of the first key of a nonleaf node.
+    * @param pid[IN] the PageId of the child
+    */
+    void setFirstChildPtr(PageId pid);
+
+   /**
+    * Return the # of bytes an entry with a key of the length takes in
+    * a node of the level, its slot included.
+    * @param level[IN] the level of the node
+    * @param length[IN] the length of the key
+    * @return the # of bytes
+    */
+    static int entrySize(int level, int length);
+
+    int getKeyCount() { return header()->keyCount; }
+    int getLevel() { return header()->level; }
+    int getUsedSpace() { return PageFile::PAGE_SIZE - NODE_HEADER - getFreeSpace(); }
+    PageId getNextNodePtr() { return header()->nextPid; }
+    void setNextNodePtr(PageId pid) { header()->nextPid = pid; }
+    PageId getPrevNodePtr() { return header()->prevPid; }
+    void setPrevNodePtr(PageId pid) { header()->prevPid = pid; }
+
+   /**
+    * Read the content of the node from the page pid in the PageFile pf.
+    * @param pid[IN] the PageId to read
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    *    RC_INVALID_FILE_FORMAT - when the page is not a value index node
+    */
+    RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Write the content of the node to the page pid in the PageFile pf.
+    * @param pid[IN] the PageId to write to
+    * @param pf[IN] PageFile to write to
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC write(PageId pid, PageFile& pf);
+
+    // the node header: BTNodeHeader, freeEnd and pid0
+    const static int NODE_HEADER = sizeof(BTNodeHeader) + sizeof(int) + sizeof(PageId);
+    const static int SLOT_SIZE = 2 * sizeof(unsigned short);
+    // the room for entries in a node
+    const static int CAPACITY = PageFile::PAGE_SIZE - NODE_HEADER;
+
+  private:
+    int getFreeSpace();
+    int payloadSize() { return getLevel() == 0 ? sizeof(RecordId) : sizeof(PageId); }
+    BTNodeHeader* header() { return (BTNodeHeader*) buffer; }
+    unsigned short* slot(int eid)
+      { return (unsigned short*) (buffer + NODE_HEADER + SLOT_SIZE * eid); }
+    char buffer[PageFile::PAGE_SIZE];
+};
+
+/**
+ * Implements a B+tree index on the value column of a table.
+ * The index keys are the values, compared byte by byte as strcmp()
+ * does. A value longer than MAX_KEY_LENGTH is indexed by its first
+ * MAX_KEY_LENGTH bytes, so a lookup may return the rids of values
+ * slightly outside its range, which the caller has to check.
+ * The keys in the nonleaf nodes are only as long as it takes to tell
+ * the nodes apart (see BTValueNode::insertAndSplit()), so that a nonleaf
+ * node holds more of them and the tree stays low.
+ */
+class ValueIndex {
+ public:
+  // the longest key, which leaves room for four entries in a node
+  static const int MAX_KEY_LENGTH =
+    BTValueNode::CAPACITY / 4 - BTValueNode::SLOT_SIZE - sizeof(RecordId);
+
+  ValueIndex();
+
+  /**
+   * Open the index file in read or write mode.
+   * Under 'w' mode, the index file is created if it does not exist.
+   * @param indexname[IN] the name of the index file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error.
+   *    RC_INVALID_FILE_FORMAT - when the index was written with another
+   *    page size or is not a value index
+   */
+  RC open(const std::string& indexname, char mode);
+
+  /**
+   * Close the index file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * Insert (value, RecordId) pair to the index.
+   * @param value[IN] the value. it does not have to be NUL-terminated
+   * @param length[IN] the length of the value
+   * @param rid[IN] the RecordId of the record with the value
+   * @return error code. 0 if no error
+   */
+  RC insert(const char* value, int length, const RecordId& rid);
+
+  /**
+   * Build an empty index bottom-up from (value, RecordId) pairs, as
+   * BTreeIndex::bulkLoad() does. The nodes are filled to fillFactor of
+   * their bytes.
+   * @param entries[IN/OUT] the pairs to load. sorted on return
+   * @param fillFactor[IN] the fraction of each node to fill, in (0, 1]
+   * @return error code. 0 if no error.
+   *    RC_INVALID_ATTRIBUTE - when the index is not empty
+   */
+  RC bulkLoad(std::vector<ValueEntry>& entries, double fillFactor);
+
+  /**
+   * Find the first leaf-node entry whose value is larger than or equal
+   * to searchValue, as BTreeIndex::locate() does.
+   * @param searchValue[IN] the value to find
+   * @param length[IN] the length of searchValue
+   * @param cursor[OUT] the cursor pointing to the entry
+   * @return error code. 0 if no error
+   */
+  RC locate(const char* searchValue, int length, IndexCursor& cursor);
+
+  /**
+   * Read the rids of the entries from the cursor on, up to the last
+   * entry whose value is not larger than endValue, from one leaf node,
+   * and move the cursor past them, as BTreeIndex::readBatch() does.
+   * @param cursor[IN/OUT] the cursor pointing to a leaf-node entry
+   * @param endValue[IN] the largest value to read. NULL to read to the
+   *    end of the index
+   * @param endLength[IN] the length of endValue
+   * @param rids[OUT] the rids read are appended to it, in value order
+   * @return error code. 0 if no error.
+   *    RC_END_OF_TREE - when no entry is left up to endValue
+   */
+  RC readBatch(IndexCursor& cursor, const char* endValue, int endLength,
+               std::vector<RecordId>& rids);
+
+  /**
+   * Return the height of the tree. 0 if the index is empty.
+   * @return the height of the tree
+   */
+  int getTreeHeight() const { return treeHeight; }
+
+  /**
+   * Compare two keys byte by byte, like strcmp() on strings.
+   * @return < 0, 0 or > 0 as k1 is smaller than, equal to or larger than k2
+   */
+  static int compare(const char* k1, int l1, const char* k2, int l2);
+
+ private:
+  PageFile pf;          /// the PageFile used to store the b+tree
+  PageId   rootPid;     /// the PageId of the root node
+  int      treeHeight;  /// the height of the tree
+
+  int read_metadata();
+  int commit_metadata();
+  PageId fetch_new_page();
+  RC _insert(PageId pid, int depth, const char* value, int length,
+             const RecordId& rid, std::string& splitkey, PageId& splitpid);
+};
+
+#endif /* VALUEINDEX_H */
@@ -7,13 +7,69 @@
  * @date 3/24/2008
  */
  
+#include <cstdlib>
+#include <cstring>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "BufferPool.h"
+#include "IoEngine.h"
 
 int main()
 {
+  const char* env;
+
+  // size the buffer pool. BRUINBASE_BUFFER_MB sets its size in megabytes
+  // and BRUINBASE_BUFFER_POLICY picks the eviction policy (clock or lru-k)
+  int frames = BufferPool::DEFAULT_FRAME_COUNT;
+  BufferPool::Policy policy = BufferPool::CLOCK;
+  if ((env = getenv("BRUINBASE_BUFFER_MB")) != NULL && atoi(env) > 0) {
+    frames = (int) ((long long) atoi(env) * 1024 * 1024 / PageFile::PAGE_SIZE);
+  }
+  if ((env = getenv("BRUINBASE_BUFFER_POLICY")) != NULL && strcasecmp(env, "lru-k") == 0) {
+    policy = BufferPool::LRU_K;
+  }
+  BufferPool::configure(frames, policy);
+
+  // BRUINBASE_WRITE_BACK=0 writes every page through to the disk
+  if ((env = getenv("BRUINBASE_WRITE_BACK")) != NULL && atoi(env) == 0) {
+    BufferPool::setWriteBack(false);
+  }
+
+  // BRUINBASE_IO_THREADS sets the # of threads reading pages ahead
+  if ((env = getenv("BRUINBASE_IO_THREADS")) != NULL && atoi(env) > 0) {
+    IoEngine::configure(atoi(env));
+  }
+
+  // BRUINBASE_FILL_FACTOR sets how full LOAD packs the nodes of a new index
+  if ((env = getenv("BRUINBASE_FILL_FACTOR")) != NULL && atof(env) > 0) {
+    SqlEngine::setIndexFillFactor(atof(env));
+  }
+
+  // BRUINBASE_COUNTED_INDEX=1 makes LOAD build counted indexes
+  if ((env = getenv("BRUINBASE_COUNTED_INDEX")) != NULL && atoi(env) != 0) {
+    SqlEngine::setCountedIndex(true);
+  }
+
+  // BRUINBASE_COLUMNAR=1 makes LOAD store new tables in columns
+  if ((env = getenv("BRUINBASE_COLUMNAR")) != NULL && atoi(env) != 0) {
+    SqlEngine::setColumnarTables(true);
+  }
+
+  // BRUINBASE_LOAD_THREADS sets the # of threads LOAD parses with
+  if ((env = getenv("BRUINBASE_LOAD_THREADS")) != NULL) {
+    SqlEngine::setLoadThreads(atoi(env));
+  }
+
+  // BRUINBASE_KEY_ORDER=1 keeps the output of index scans in key order
+  if ((env = getenv("BRUINBASE_KEY_ORDER")) != NULL && atoi(env) != 0) {
+    SqlEngine::setKeyOrder(true);
+  }
+
   // run the SQL engine taking user commands from standard input (console).
   SqlEngine::run(stdin);
 
+  // write out the pages of the files that were left open
+  BufferPool::flushAll();
+
   return 0;
 }
@@ -5,23 +5,24 @@ using namespace std;
 
 int main() {
 	BTLeafNode* test = new BTLeafNode();
+	PageFile pf;  // no key gets enough rids for posting pages
 	RecordId rid1 = {5, 9};
 	int testKey1 = 50;
 
 	// Testing insert
-	test->insert(testKey1, rid1);
+	test->insert(testKey1, rid1, pf);
 	cout << endl;
 	test->printBuffer();
 
 	int testKey2 = 30;
 	RecordId rid2 = {3, 5};
-	test->insert(testKey2, rid2);
+	test->insert(testKey2, rid2, pf);
 	cout << endl;
 	test->printBuffer();
 
 	int testKey3 = 40;
 	RecordId rid3 = {2, 7};
-	test->insert(testKey3, rid3);
+	test->insert(testKey3, rid3, pf);
 	cout << endl;
 	test->printBuffer();
 
@@ -33,7 +34,7 @@ int main() {
 	RecordId rid4 = {3, 12};
 	BTLeafNode* testSplit = new BTLeafNode();
 	int testKey5 = 100;
-	test->insertAndSplit(testKey4, rid4, *testSplit, testKey5);
+	test->insertAndSplit(testKey4, rid4, *testSplit, testKey5, pf);
 	cout << endl;
 	test->printBuffer();
 	cout << endl;
@@ -73,6 +74,16 @@ int main() {
 	cout << "Return readRid pid is " << readRid.pid << endl;
 	cout << "Return readRid sid is " << readRid.sid << endl;
 
+	// Testing insert of a key the node has already
+	RecordId rid6 = {1, 3};
+	test->insert(testKey3, rid6, pf);
+	cout << endl;
+	test->printBuffer();
+	cout << endl;
+	test->readEntry(1, readKey, readRid);
+	cout << "Return readRid pid is " << readRid.pid << endl;
+	cout << "Return readRid sid is " << readRid.sid << endl;
+
 	return 0;
 }
 
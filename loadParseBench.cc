@@ -0,0 +1,152 @@
+#include "LoadPipeline.h"
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+using namespace std;
+
+/*
+ * Compares the load-line parser of LOAD (LoadPipeline::parseLine() on
+ * the raw file buffer) with the old way of parsing a load file (getline,
+ * atoi, strchr and a string copy of every value), in MB/s.
+ * The third column is the whole LoadPipeline, mapping and all, on one
+ * thread and on the default # of threads.
+ * Usage: loadParseBench [repeat] file.del ...
+ * e.g., ./loadParseBench 20 bruinbase/movie.del test-script/xlarge.del
+ */
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// how load files were parsed before parseLine()
+static int oldParse(const string& line, int& key, string& value)
+{
+	const char *s;
+	char c;
+	string::size_type loc;
+
+	c = *(s = line.c_str());
+	while (c == ' ' || c == '\t') { c = *++s; }
+	key = atoi(s);
+	s = strchr(s, ',');
+	if (s == NULL) { return -1; }
+	do { c = *++s; } while (c == ' ' || c == '\t');
+	if (c == 0) {
+		value.erase();
+		return 0;
+	}
+	if (c == '\'' || c == '"') {
+		s++;
+	} else {
+		c = '\n';
+	}
+	value.assign(s);
+	loc = value.find(c, 0);
+	if (loc != string::npos) { value.erase(loc); }
+	return 0;
+}
+
+static double oldRun(const string& text, int repeat, long long& checksum)
+{
+	double start = now();
+
+	for (int i = 0; i < repeat; i++) {
+		istringstream in(text);
+		string line, value;
+		int key;
+
+		while (getline(in, line)) {
+			if (oldParse(line, key, value) == 0) {
+				checksum += key + value.size();
+			}
+		}
+	}
+	return (now() - start) / repeat;
+}
+
+static double newRun(const string& text, int repeat, long long& checksum)
+{
+	double start = now();
+
+	for (int i = 0; i < repeat; i++) {
+		const char *s = text.data(), *end = s + text.size(), *nl, *value;
+		int key, length;
+
+		for (; s < end; s = nl + 1) {
+			if ((nl = (const char*) memchr(s, '\n', end - s)) == NULL) nl = end;
+			if (LoadPipeline::parseLine(s, nl, key, value, length) == 0) {
+				checksum += key + length;
+			}
+		}
+	}
+	return (now() - start) / repeat;
+}
+
+static double pipelineRun(const char* file, int threads, int repeat,
+			  long long& checksum)
+{
+	double start = now();
+
+	for (int i = 0; i < repeat; i++) {
+		LoadPipeline pipeline;
+		vector<LoadTuple> tuples;
+
+		if (pipeline.open(file, threads) < 0) return 0;
+		while (pipeline.next(tuples) == 0) {
+			for (size_t j = 0; j < tuples.size(); j++) {
+				checksum += tuples[j].key + tuples[j].length;
+			}
+		}
+		pipeline.close();
+	}
+	return (now() - start) / repeat;
+}
+
+int main(int argc, char** argv) {
+	int repeat = 10;
+	int first = 1;
+	int threads = LoadPipeline::DEFAULT_THREAD_COUNT;
+
+	if (argc > 1 && atoi(argv[1]) > 0) {
+		repeat = atoi(argv[1]);
+		first = 2;
+	}
+
+	char label[32];
+	sprintf(label, "pipe x%d", threads);
+	printf("%-26s %8s %10s %10s %10s %10s\n", "file", "MB", "old(MB/s)",
+	       "new(MB/s)", "pipe x1", label);
+	for (int i = first; i < argc; i++) {
+		ifstream in(argv[i]);
+		stringstream text;
+		long long c1 = 0, c2 = 0, c3 = 0, c4 = 0;
+
+		if (!in.is_open()) {
+			fprintf(stderr, "cannot open %s\n", argv[i]);
+			continue;
+		}
+		text << in.rdbuf();
+		string s = text.str();
+		double mb = s.size() / 1048576.0;
+
+		double t1 = oldRun(s, repeat, c1);
+		double t2 = newRun(s, repeat, c2);
+		double t3 = pipelineRun(argv[i], 1, repeat, c3);
+		double t4 = pipelineRun(argv[i], threads, repeat, c4);
+		if (c1 != c2 || c1 != c3 || c1 != c4) {
+			fprintf(stderr, "%s: parsers disagree\n", argv[i]);
+		}
+		printf("%-26s %8.2f %10.1f %10.1f %10.1f %10.1f\n", argv[i], mb,
+		       t1 > 0 ? mb / t1 : 0, t2 > 0 ? mb / t2 : 0,
+		       t3 > 0 ? mb / t3 : 0, t4 > 0 ? mb / t4 : 0);
+	}
+	return 0;
+}
@@ -0,0 +1,108 @@
+#include "RecordFile.h"
+#include "PageFile.h"
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+/*
+ * Compares full table scans through the buffer pool ('r' mode, a pread()
+ * per page the pool misses) with scans of a memory-mapped table
+ * ('m' mode).
+ * Usage: pageFileBench [repeat] file.del ...
+ * e.g., cd test-script && ../pageFileBench 20 *.del
+ */
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int load(const char* del, const char* tbl)
+{
+	ifstream in(del);
+	string line;
+	RecordFile rf;
+	RecordId rid;
+	int rows = 0;
+
+	unlink(tbl);
+	if (!in.is_open() || rf.open(tbl, 'w') < 0) {
+		return -1;
+	}
+	while (getline(in, line)) {
+		const char *s = strchr(line.c_str(), ',');
+		if (s == NULL) continue;
+		string value(s + 1);
+		rf.append(atoi(line.c_str()), value, rid);
+		rows++;
+	}
+	rf.close();
+	return rows;
+}
+
+static double scan(const char* tbl, char mode, int repeat, long long& checksum)
+{
+	double start = now();
+
+	for (int i = 0; i < repeat; i++) {
+		RecordFile rf;
+		RecordId rid = {0, 0};
+		PageHandle page;
+		const char *value;
+		int key;
+
+		// reopen every time so that the buffer pool starts cold
+		rf.open(tbl, mode);
+		while (rf.readNext(rid, key, value, page) == 0) {
+			checksum += key + value[0];
+			++rid;
+		}
+		page.unpin();
+		rf.close();
+	}
+	return (now() - start) / repeat;
+}
+
+int main(int argc, char** argv) {
+	int repeat = 10;
+	int first = 1;
+	const char *tbl = "pageFileBench.tbl";
+
+	if (argc > 1 && atoi(argv[1]) > 0) {
+		repeat = atoi(argv[1]);
+		first = 2;
+	}
+
+	printf("%-12s %8s %8s %12s %12s %8s\n", "file", "rows", "pages",
+	       "syscall(ms)", "mmap(ms)", "speedup");
+	for (int i = first; i < argc; i++) {
+		long long c1 = 0, c2 = 0;
+		int rows = load(argv[i], tbl);
+		if (rows < 0) {
+			fprintf(stderr, "cannot load %s\n", argv[i]);
+			continue;
+		}
+
+		PageFile pf(tbl, 'r');
+		int pages = pf.endPid();
+		pf.close();
+
+		double t1 = scan(tbl, 'r', repeat, c1);
+		double t2 = scan(tbl, 'm', repeat, c2);
+		if (c1 != c2) {
+			fprintf(stderr, "%s: scans disagree\n", argv[i]);
+		}
+		printf("%-12s %8d %8d %12.3f %12.3f %7.2fx\n", argv[i], rows, pages,
+		       t1 * 1000, t2 * 1000, (t2 > 0) ? t1 / t2 : 0);
+	}
+	unlink(tbl);
+	return 0;
+}
@@ -1,10 +1,10 @@
 #!/bin/sh
 
-rm -f xsmall.tbl xsmall.idx
-rm -f small.tbl small.idx
-rm -f medium.tbl medium.idx
-rm -f large.tbl large.idx
-rm -f xlarge.tbl xlarge.idx
+rm -f xsmall.tbl xsmall.idx xsmall.vdx xsmall.stat xsmall.tbl.zone xsmall.tbl.val xsmall.tbl.off
+rm -f small.tbl small.idx small.vdx small.stat small.tbl.zone small.tbl.val small.tbl.off
+rm -f medium.tbl medium.idx medium.vdx medium.stat medium.tbl.zone medium.tbl.val medium.tbl.off
+rm -f large.tbl large.idx large.vdx large.stat large.tbl.zone large.tbl.val large.tbl.off
+rm -f xlarge.tbl xlarge.idx xlarge.vdx xlarge.stat xlarge.tbl.zone xlarge.tbl.val xlarge.tbl.off
 
 ./bruinbase < test.sql
 
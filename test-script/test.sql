@@ -14,6 +14,9 @@ LOAD large FROM 'large.del' WITH INDEX
 SELECT COUNT(*) FROM large
 SELECT * FROM large WHERE key > 4500
 SELECT * FROM large WHERE key > 4500 AND key > 0
+CREATE INDEX ON large (value)
+SELECT * FROM large WHERE value >= 'W' AND key < 4500
+SELECT * FROM large WHERE value < 'Ab' AND key > 12
 
 LOAD xlarge FROM 'xlarge.del' WITH INDEX
 SELECT COUNT(*) FROM xlarge